@@ -0,0 +1,53 @@
+local m = require('fstest')
+
+-- multi-year endurance workload with synthetic files, meant for the metadata-only mode:
+--   ./zerofs --headless --meta-only --flash by25q32es --days 365 endurance.lua
+-- the lifetime lines project the wear of the run to the lifecycle of the parts
+
+-- --- CONFIG ------------------------------------------------------
+local DAYS = 365
+local SESSIONS_PER_DAY = 4  -- WRITE mode sessions per day
+local LOGS_PER_SESSION = 2  -- new files per session
+local KEEP = 48             -- newest files kept, the older ones are deleted
+local MIN_LEN = 2000
+local MAX_LEN = 60000
+local CHUNK_SIZE = 512
+local VERIFY_EVERY = 16     -- read back one file every N sessions
+local SEED = m.seed(4711)  -- fleet devices count up from it
+-- ----------------------------------------------------------------
+
+m.badblock(false)
+math.randomseed(SEED)
+m.speed(0, 0)
+m.setstep(false)
+
+local files = {}
+local first, next = 1, 1
+
+for day = 1, DAYS do
+  for session = 1, SESSIONS_PER_DAY do
+    m.setmode("write")
+    for i = 1, LOGS_PER_SESSION do
+      local name = string.format("log%05d.csv", next % 100000)
+      local len = math.random(MIN_LEN, MAX_LEN)
+      if m.write(name, CHUNK_SIZE, len) ~= 0 then m.assert("write " .. name) end
+      files[next] = { name = name, len = len }
+      next = next + 1
+    end
+    local victims = {}
+    while next - first > KEEP do
+      victims[#victims + 1] = files[first].name
+      files[first] = nil
+      first = first + 1
+    end
+    if #victims > 0 then m.delete_many(victims) end
+    m.setmode("read")
+    if session % VERIFY_EVERY == 0 or (day * SESSIONS_PER_DAY + session) % VERIFY_EVERY == 0 then
+      local f = files[math.random(first, next - 1)]
+      if m.verify(f.name, f.len) ~= 0 then m.assert("verify " .. f.name) end
+    end
+  end
+  if day % 30 == 0 then warn("day " .. day) end
+end
+
+warn("ENDURANCE TEST FINISHED OK")
@@ -26,23 +26,47 @@
  */
 #include <stdio.h>
 #include <unistd.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
 
 #include "flash.h"
 #include "test.h"
+#include "zerofs_trace.h"
 
+#define FLASH_PROFILE_DIR "profiles"
 
-int badblock=0;
+#ifndef MIN
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#endif
+#ifndef MAX
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#endif
 
 
+int headless=0;
+
+
+// xorshift64* per area, the bad block sequence of a device does not depend on the other devices
+static double flash_rand(struct flash_area *fa)
+{
+    fa->rng ^= fa->rng >> 12;
+    fa->rng ^= fa->rng << 25;
+    fa->rng ^= fa->rng >> 27;
+    return((double)((fa->rng * 0x2545f4914f6cdd1dULL) >> 11) / (double)(1ULL << 53));
+}
+
 static double prob_bad(int wear, int lifecycle)
 {
     double x = (double)wear / lifecycle;
     if (x < 0) x = 0;
     if (x > 2) x = 2;
-    return (!!badblock)*exp(8 * (x - 1));
+    return exp(8 * (x - 1));
 }
 
 static double stddev(int *arr, int n)
@@ -64,7 +88,223 @@ static double stddev(int *arr, int n)
 }
 
 
-int flash_area_open(int id, struct flash_area *fa, const struct flash_area *fas)
+static void latency_add(struct flash_latency *l, double us)
+{
+    int b;
+
+    l->n++;
+    l->sum += us;
+    if(us > l->max) l->max = us;
+    for(b = 0; b < 31 && (1L << b) < us; b++);
+    l->hist[b]++;
+}
+
+// upper bound of the log2 bucket holding the p-th percentile
+static double latency_percentile(const struct flash_latency *l, double p)
+{
+    long cnt = 0;
+    int b;
+
+    for(b = 0; b < 32; b++)
+    {
+        cnt += l->hist[b];
+        if(cnt >= p * l->n) break;
+    }
+    return(b < 32 ? (double)(1L << b) : l->max);
+}
+
+
+// number fields of the profile table, missing fields keep their value
+static void flash_prop_num(lua_State *L, const char *key, double *v)
+{
+    lua_getfield(L, -1, key);
+    if(lua_isnumber(L, -1)) *v = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+}
+
+static void flash_prop_int(lua_State *L, const char *key, int *v)
+{
+    lua_getfield(L, -1, key);
+    if(lua_isinteger(L, -1)) *v = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+}
+
+// run a profile file, name is a path or a profile in FLASH_PROFILE_DIR
+// returns the lua state with the profile table on the top, NULL on error
+static lua_State *flash_profile_open(const char *name, char *path, size_t size)
+{
+    lua_State *L;
+
+    if(strchr(name, '/') != NULL || strstr(name, ".lua") != NULL) snprintf(path, size, "%s", name);
+    else snprintf(path, size, "%s/%s.lua", FLASH_PROFILE_DIR, name);
+    L = luaL_newstate();
+    if(NULL == L) return(NULL);
+    luaL_openlibs(L);
+    if(luaL_dofile(L, path) != LUA_OK) fprintf(stderr, "profile %s: %s\n", path, lua_tostring(L, -1));
+    else if(!lua_istable(L, -1)) fprintf(stderr, "profile %s: no table returned\n", path);
+    else return(L);
+    lua_close(L);
+    return(NULL);
+}
+
+// load a part profile over prop, the profile is a lua file returning a table with the flash_prop field names
+// size and block_size stay the simulated geometry
+// t_block_erase_us can be a table indexed by the block size, spi_mhz and spi_lines set t_comm_byte_us
+// returns -1 if the profile cannot be loaded or has no erase for the block size
+int flash_prop_load(const char *name, struct flash_prop *prop)
+{
+    char path[PATH_MAX];
+    lua_State *L;
+    int ret = -1;
+
+    if(NULL == name || NULL == prop) return(-1);
+    L = flash_profile_open(name, path, sizeof(path));
+    if(NULL != L)
+    {
+        ret = 0;
+        flash_prop_int(L, "sector_size", &prop->sector_size);
+        flash_prop_int(L, "write_granularity", &prop->write_granularity);
+        flash_prop_int(L, "page_size", &prop->page_size);
+        flash_prop_num(L, "t_sector_erase_us", &prop->t_sector_erase_us);
+        flash_prop_num(L, "t_chip_erase_us", &prop->t_chip_erase_us);
+        flash_prop_num(L, "t_page_program_us", &prop->t_page_program_us);
+        flash_prop_num(L, "t_byte_first_us", &prop->t_byte_first_us);
+        flash_prop_num(L, "t_byte_us", &prop->t_byte_us);
+        flash_prop_num(L, "t_comm_byte_us", &prop->t_comm_byte_us);
+        flash_prop_num(L, "spi_mhz", &prop->spi_mhz);
+        flash_prop_int(L, "spi_lines", &prop->spi_lines);
+        flash_prop_int(L, "addr_bytes", &prop->addr_bytes);
+        flash_prop_int(L, "addr_lines", &prop->addr_lines);
+        flash_prop_int(L, "dummy_cycles", &prop->dummy_cycles);
+        flash_prop_num(L, "t_cs_us", &prop->t_cs_us);
+        if(prop->spi_mhz > 0.0 && prop->spi_lines > 0) prop->t_comm_byte_us = 8.0 / (prop->spi_mhz * prop->spi_lines);
+        flash_prop_int(L, "lifecycle", &prop->lifecycle);
+        flash_prop_num(L, "t_suspend_us", &prop->t_suspend_us);
+        flash_prop_num(L, "t_resume_us", &prop->t_resume_us);
+        flash_prop_num(L, "t_wake_us", &prop->t_wake_us);
+        flash_prop_num(L, "i_active_ua", &prop->i_active_ua);
+        flash_prop_num(L, "i_standby_ua", &prop->i_standby_ua);
+        flash_prop_num(L, "i_dpd_ua", &prop->i_dpd_ua);
+        lua_getfield(L, -1, "t_block_erase_us");
+        if(lua_istable(L, -1))
+        {
+            lua_geti(L, -1, prop->block_size);
+            if(lua_isnumber(L, -1)) prop->t_block_erase_us = lua_tonumber(L, -1);
+            else if(prop->block_size > 0)
+            {
+                fprintf(stderr, "profile %s: no %d byte block erase\n", path, prop->block_size);
+                ret = -1;
+            }
+            lua_pop(L, 1);
+        }
+        else if(lua_isnumber(L, -1)) prop->t_block_erase_us = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, -1, "name");
+        if(ret == 0) CONSOLE(&conlog, "%s() %s %s\n", __FUNCTION__, path, (lua_isstring(L, -1) ? lua_tostring(L, -1) : ""));
+        lua_pop(L, 1);
+        lua_close(L);
+    }
+    return(ret);
+}
+
+// load a cpu profile over prop, the table has the cpu_prop field names
+int cpu_prop_load(const char *name, struct cpu_prop *prop)
+{
+    char path[PATH_MAX];
+    lua_State *L;
+
+    if(NULL == name || NULL == prop) return(-1);
+    L = flash_profile_open(name, path, sizeof(path));
+    if(NULL == L) return(-1);
+    flash_prop_num(L, "mhz", &prop->mhz);
+    flash_prop_num(L, "map_probe_cycles", &prop->map_probe_cycles);
+    flash_prop_num(L, "nm_probe_cycles", &prop->nm_probe_cycles);
+    flash_prop_num(L, "copy_byte_cycles", &prop->copy_byte_cycles);
+    flash_prop_num(L, "crc_byte_cycles", &prop->crc_byte_cycles);
+    lua_getfield(L, -1, "name");
+    CONSOLE(&conlog, "%s() %s %s\n", __FUNCTION__, path, (lua_isstring(L, -1) ? lua_tostring(L, -1) : ""));
+    lua_pop(L, 1);
+    lua_close(L);
+    if(prop->mhz <= 0.0) { fprintf(stderr, "profile %s: no cpu clock\n", path); return(-1); }
+    return(0);
+}
+
+// test file contents: the file name in dir (absolute names as they are), or len synthetic bytes derived from the name if len>=0
+// returns the length and the malloc'ed contents in *data, only the length if data is NULL, -1 on error
+int flash_payload(struct console *con, const char *dir, const char *name, int len, uint8_t **data)
+{
+    char path[PATH_MAX];
+    uint8_t h = 0;
+    FILE *f;
+    int i;
+
+    if(len >= 0)
+    {
+        if(NULL == data) return(len);
+        *data = malloc(len + 1);
+        for(i = 0; name[i] != '\0'; i++) h = (uint8_t)(h * 31 + name[i]);
+        for(i = 0; i < len; i++) (*data)[i] = (uint8_t)(h + i * 7 + (i >> 8));
+        return(len);
+    }
+    if(NULL == dir) dir = ".";
+    if(name[0] == '/') dir = "";
+    if(strlen(dir) + 1 + strlen(name) >= sizeof(path))
+    {
+        CONSOLE(con, "ERROR %s() path too long\n", __FUNCTION__);
+        return(-1);
+    }
+    strcpy(path, dir);
+    if(name[0] != '/') strcat(path, "/");
+    strcat(path, name);
+    f = fopen(path, "rb");
+    if(NULL == f)
+    {
+        CONSOLE(con, "ERROR %s() file '%s' not found\n", __FUNCTION__, path);
+        return(-1);
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(NULL != data)
+    {
+        *data = malloc(len + 1);
+        if(len != fread(*data, 1, len, f))
+        {
+            CONSOLE(con, "ERROR %s() read error '%s'\n", __FUNCTION__, path);
+            free(*data);
+            len = -1;
+        }
+    }
+    fclose(f);
+    return(len);
+}
+
+// workload traces (zerofs_trace.h) are run instead of a lua script
+int flash_is_trace(const char *path)
+{
+    uint8_t hdr[ZEROFS_TRACE_HEADER];
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(path, "rb");
+    if(NULL == f) return(0);
+    if(fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) ret = (memcmp(hdr, ZEROFS_TRACE_MAGIC, 4) == 0 && hdr[4] == ZEROFS_TRACE_VERSION);
+    fclose(f);
+    return(ret);
+}
+
+// a device without areas, con is its log and the seed selects its bad block sequence
+void flash_sim_init(struct flash_sim *sim, struct console *con, uint64_t seed)
+{
+    static const struct cpu_prop cpu = CPU_PROP_CORTEX_M4(64.0);
+
+    memset(sim, 0, sizeof(*sim));
+    sim->cpu = cpu;
+    sim->con = con;
+    sim->seed = seed;
+}
+
+int flash_area_open(struct flash_sim *sim, int id, struct flash_area *fa, const struct flash_area *fas)
 {
     int ret = -1;
     int i;
@@ -72,109 +312,846 @@ int flash_area_open(int id, struct flash_area *fa, const struct flash_area *fas)
     if(fa != NULL)
     {
         for(i = 0; fas[i].id >= 0; i++) if(fas[i].id == id) break;
-        if(fas[i].id == id)
+        if(fas[i].id == id && fas[i].device >= 0 && fas[i].device < FLASH_BUSES)
         {
             memcpy(fa, &fas[i], sizeof(struct flash_area));
             fa->open = 1;
+            fa->sim = sim;
+            fa->opened_at = sim->clock_us;
+            fa->rng = (0x9e3779b97f4a7c15ULL * (uint64_t)(id + 1)) ^ (0xbf58476d1ce4e5b9ULL * sim->seed);
             int *wear = calloc(fa->prop.size/fa->prop.sector_size,sizeof(int));
             fa->wear = wear;
+            if(fa->meta) fa->fill = calloc(fa->prop.size/fa->prop.sector_size, sizeof(uint32_t));
+            fa->first_bad_us = 0.0;
             ret = 0;
-            CONSOLE(&conlog, "%s() FLASH AREA OPEN %d\n", __FUNCTION__, id);
+            CONSOLE(sim->con, "%s() FLASH AREA OPEN %d\n", __FUNCTION__, id);
         }
-        else CONSOLE(&conlog, "ERROR %s() cannot find flash area %d\n", __FUNCTION__, id);
+        else CONSOLE(sim->con, "ERROR %s() cannot find flash area %d\n", __FUNCTION__, id);
     }
 
     return(ret);
 }
 
-int flash_area_write(struct flash_area *fa, uint32_t addr, const uint8_t *data, uint32_t len)
+// trace event timeline of a device: the events go to a temporary file as fixed size records during the run,
+// flash_timeline_export() converts them to the Chrome trace event JSON that Perfetto and chrome://tracing load
+#define FLASH_TL_NAMES (32)             // span names of a device, the rest is exported as "other"
+#define FLASH_TL_PEND  (8)              // areas with an erase that can still be suspended
+
+// lanes (tid) of the export
+#define FLASH_TL_TID_API     (1)        // API calls and the filesystem steps inside them
+#define FLASH_TL_TID_CPU     (2)        // cpu states
+#define FLASH_TL_TID_BUS     (10)       // + bus, transfers on the SPI bus
+#define FLASH_TL_TID_AREA    (100)      // + area id, device time of the operations
+#define FLASH_TL_TID_SUSPEND (200)      // + area id, suspended erases
+
+// event types
+#define FLASH_TL_BEGIN (0)              // span on the api lane, arg is the argument of the call
+#define FLASH_TL_END   (1)              // arg is the return value
+#define FLASH_TL_OP    (2)              // flash operation, arg is the address
+#define FLASH_TL_SPAN  (3)
+
+// preset names, the flash operations are named by their FLASH_OP_* index
+#define FLASH_TL_CPU       (3)          // + cpu state
+#define FLASH_TL_SUSPENDED (3+FLASH_CPU_STATES)
+#define FLASH_TL_PRESET    (4+FLASH_CPU_STATES)
+
+struct flash_tl_event
 {
-    int ret = -1;
-    uint32_t i;
+    double t0_us;
+    double t1_us;
+    long arg;
+    uint32_t len;
+    uint16_t tid;
+    uint8_t type;
+    uint8_t name;
+};
 
-    if(NULL != fa && fa->open)
+struct flash_timeline
+{
+    FILE *f;                            // the events
+    long events;
+    const char *names[FLASH_TL_NAMES];  // the callers keep the strings until the export
+    int nn;
+    struct flash_tl_event cpu;          // not yet written, it grows while the cpu stays in the same state
+    struct
     {
-        if( ((addr % fa->prop.write_granularity) == 0) && ((len % fa->prop.write_granularity) == 0) )
+        const struct flash_area *fa;
+        int cut;                        // written up to the suspend, the rest follows the resume
+        struct flash_tl_event ev;
+    } pend[FLASH_TL_PEND];
+};
+
+static void flash_tl_put(struct flash_timeline *tl, const struct flash_tl_event *ev)
+{
+    if(fwrite(ev, sizeof(struct flash_tl_event), 1, tl->f) == 1) tl->events++;
+}
+
+static int flash_tl_name(struct flash_timeline *tl, const char *name)
+{
+    int i;
+
+    for(i = 0; i < tl->nn; i++) if(tl->names[i] == name || strcmp(tl->names[i], name) == 0) return(i);
+    if(tl->nn >= FLASH_TL_NAMES - 1) return(FLASH_TL_NAMES - 1);
+    tl->names[tl->nn] = name;
+    return(tl->nn++);
+}
+
+// write the pending erase of the area, all of them if fa is NULL
+static void flash_tl_flush(struct flash_timeline *tl, const struct flash_area *fa)
+{
+    int i;
+
+    for(i = 0; i < FLASH_TL_PEND; i++)
+    {
+        if(NULL == tl->pend[i].fa || (NULL != fa && tl->pend[i].fa != fa) || tl->pend[i].cut) continue;
+        flash_tl_put(tl, &tl->pend[i].ev);
+        tl->pend[i].fa = NULL;
+    }
+}
+
+// the device time on the area lane and the transfer on the bus lane, an erase that can be suspended
+// is held back until the next operation of the area shows where it ended
+static void flash_tl_op(struct flash_area *fa, int op, uint32_t addr, uint32_t len, double start, double xfer_us)
+{
+    struct flash_timeline *tl = fa->sim->tl;
+    struct flash_tl_event ev = { start, fa->busy_until, addr, len, FLASH_TL_TID_AREA + fa->id, FLASH_TL_OP, op };
+    int i;
+
+    flash_tl_flush(tl, fa);
+    if(fa->device > 0)
+    {
+        struct flash_tl_event xfer = { start, start + xfer_us, addr, len, FLASH_TL_TID_BUS + fa->device, FLASH_TL_OP, op };
+        flash_tl_put(tl, &xfer);
+    }
+    if(op == FLASH_OP_ERASE && fa->prop.t_suspend_us > 0.0)
+    {
+        for(i = 0; i < FLASH_TL_PEND && NULL != tl->pend[i].fa; i++);
+        if(i < FLASH_TL_PEND)
         {
-            if((addr + len) <= fa->size)
-            {
-                for(i = 0; i < len; i++) if(fa->flash[addr + i] != 0xff) break;
-                if(i < len) CONSOLE(&conlog, "%s() FLASH %d WARNING WRITING TO DIRTY AREA SECTOR %03x ADDR 0x%x\n", __FUNCTION__, fa->id, (addr/fa->prop.sector_size), addr);
-                for(i = 0; i < len; i++) fa->flash[addr + i] &= data[i];
-                ret = len;
-                ///CONSOLE(&conlog, "%s() FLASH %d WRITE SECTOR %03x ADDR 0x%x %d bytes\n", __FUNCTION__, fa->id, (addr/fa->prop.sector_size), addr, len);
-                // delay
-                double delay_us = (fa->prop.t_comm_byte_us * len) + (fa->prop.t_byte_first_us + (len - 1) * fa->prop.t_byte_us);
-                fa->elapsed+=delay_us;
-                usleep((long)(delay_us*simulation_factor));
-                draw_update(0,1);
-            }
-            else CONSOLE(&conlog, "ERROR %s() address %x OVERFLOW\n", __FUNCTION__, addr);
+            tl->pend[i].fa = fa;
+            tl->pend[i].cut = 0;
+            tl->pend[i].ev = ev;
+            return;
         }
-        else CONSOLE(&conlog, "ERROR %s() ALIGNMENT ERROR (g=%d) address %x size %x\n", __FUNCTION__, fa->prop.write_granularity, addr, len);
     }
-    else CONSOLE(&conlog, "ERROR %s() INVALID FLASH AREA addr=%x len=%d\n", __FUNCTION__, addr, len);
-
-    return(ret);
+    flash_tl_put(tl, &ev);
 }
 
-int flash_area_read(struct flash_area *fa, uint32_t addr, uint8_t *data, uint32_t len)
+// the erase ends at the suspend, on resume the suspended time goes to its own lane and the rest of the erase is pending again
+static void flash_tl_suspend(struct flash_area *fa, int resume, double t_us)
 {
-    int ret = -1;
+    struct flash_timeline *tl = fa->sim->tl;
+    int i;
 
-    if(NULL != fa && fa->open)
+    if(resume)
     {
-        if((addr + len) <= fa->size)
+        struct flash_tl_event ev = { fa->suspended_since, t_us, 0, 0, FLASH_TL_TID_SUSPEND + fa->id, FLASH_TL_SPAN, FLASH_TL_SUSPENDED };
+        flash_tl_put(tl, &ev);
+    }
+    for(i = 0; i < FLASH_TL_PEND; i++)
+    {
+        if(tl->pend[i].fa != fa || tl->pend[i].cut != resume) continue;
+        if(resume)
         {
-            if(fa->wear[(addr / fa->prop.sector_size)]>=0) memcpy(data, &fa->flash[addr], len);
-            else memset(data, 0x55, len);
-            ret = len;
-            ///CONSOLE(&conlog, "%s() FLASH %d READ [w=%d] 0x%x %d bytes\n", __FUNCTION__, fa->id, fa->wear[(addr / fa->prop.sector_size)], addr, len);
-            // delay
-            double delay_us = fa->prop.t_comm_byte_us * len;
-            fa->elapsed+=delay_us;
-            usleep((long)(delay_us*simulation_factor));
-            draw_update(0,1);
+            tl->pend[i].ev.t0_us = t_us;
+            tl->pend[i].ev.t1_us = fa->busy_until;
+        }
+        else
+        {
+            tl->pend[i].ev.t1_us = t_us;
+            flash_tl_put(tl, &tl->pend[i].ev);
         }
-        else CONSOLE(&conlog, "ERROR %s() address %x OVERFLOW\n", __FUNCTION__, addr);
+        tl->pend[i].cut = !resume;
     }
+}
+
+static void flash_tl_cpu(struct flash_timeline *tl, int state, double t0_us, double t1_us)
+{
+    if(tl->cpu.name == FLASH_TL_CPU + state && tl->cpu.t1_us == t0_us)
+    {
+        tl->cpu.t1_us = t1_us;
+        return;
+    }
+    if(tl->cpu.t1_us > tl->cpu.t0_us) flash_tl_put(tl, &tl->cpu);
+    tl->cpu = (struct flash_tl_event){ t0_us, t1_us, 0, 0, FLASH_TL_TID_CPU, FLASH_TL_SPAN, FLASH_TL_CPU + state };
+}
+
+// start recording the timeline of the device
+int flash_timeline_open(struct flash_sim *sim)
+{
+    static const char *preset[FLASH_TL_PRESET] = { "read", "write", "erase", "run", "wait", "stall", "idle", "suspended" };
+    struct flash_timeline *tl;
 
+    if(NULL != sim->tl) return(0);
+    tl = calloc(1, sizeof(struct flash_timeline));
+    if(NULL == tl) return(-1);
+    tl->f = tmpfile();
+    if(NULL == tl->f)
+    {
+        free(tl);
+        return(-1);
+    }
+    memcpy(tl->names, preset, sizeof(preset));
+    tl->nn = FLASH_TL_PRESET;
+    tl->names[FLASH_TL_NAMES - 1] = "other";
+    sim->tl = tl;
+    return(0);
+}
+
+// span of a call on the api lane, the calls nest, the name has to be valid until the export
+void flash_timeline_begin(struct flash_sim *sim, const char *name, long arg)
+{
+    if(NULL == sim->tl) return;
+    struct flash_tl_event ev = { sim->clock_us, sim->clock_us, arg, 0, FLASH_TL_TID_API, FLASH_TL_BEGIN, flash_tl_name(sim->tl, name) };
+    flash_tl_put(sim->tl, &ev);
+}
+
+// closes the innermost span and passes the return value of the call through
+int flash_timeline_end(struct flash_sim *sim, int ret)
+{
+    if(NULL == sim->tl) return(ret);
+    struct flash_tl_event ev = { sim->clock_us, sim->clock_us, ret, 0, FLASH_TL_TID_API, FLASH_TL_END, 0 };
+    flash_tl_put(sim->tl, &ev);
     return(ret);
 }
 
-int flash_area_erase(struct flash_area *fa, uint32_t addr, uint32_t len)
+// whole ns, the end of an event rounds to the start of the next one
+static double flash_tl_ns(double us)
 {
-    int ret = -1;
+    return(floor(us * 1000.0 + 0.5));
+}
 
-    if(NULL != fa && fa->open)
+static void flash_tl_lane(FILE *f, int tid, const char *name, int n)
+{
+    fprintf(f, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s", tid, name);
+    if(n >= 0) fprintf(f, " %d", n);
+    fprintf(f, "\"}},\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}", tid, tid);
+}
+
+// write the events recorded so far as a trace event JSON file with the lanes of the areas,
+// returns the number of events, -1 on error
+int flash_timeline_export(struct flash_sim *sim, const char *path, const char *process, const struct flash_area *fa, int n)
+{
+    struct flash_timeline *tl = sim->tl;
+    struct flash_tl_event ev;
+    double ts, dur;
+    char name[32];
+    FILE *f;
+    int i, ret = 0;
+    uint8_t bus = 0;
+
+    if(NULL == tl) return(-1);
+    flash_tl_flush(tl, NULL);
+    if(tl->cpu.t1_us > tl->cpu.t0_us) flash_tl_put(tl, &tl->cpu);
+    memset(&tl->cpu, 0, sizeof(tl->cpu));
+    f = fopen(path, "w");
+    if(NULL == f) return(-1);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"%s\"}}", process);
+    flash_tl_lane(f, FLASH_TL_TID_API, "api", -1);
+    flash_tl_lane(f, FLASH_TL_TID_CPU, "cpu", -1);
+    for(i = 0; i < n; i++)
     {
-        if((addr % fa->prop.sector_size) == 0)
+        if(fa[i].device > 0 && (bus & (1u << fa[i].device)) == 0) flash_tl_lane(f, FLASH_TL_TID_BUS + fa[i].device, "bus", fa[i].device);
+        if(fa[i].device > 0) bus |= 1u << fa[i].device;
+        flash_tl_lane(f, FLASH_TL_TID_AREA + fa[i].id, "area", fa[i].id);
+        snprintf(name, sizeof(name), "area %d suspended", fa[i].id);
+        if(fa[i].prop.t_suspend_us > 0.0) flash_tl_lane(f, FLASH_TL_TID_SUSPEND + fa[i].id, name, -1);
+    }
+    rewind(tl->f);
+    while(fread(&ev, sizeof(ev), 1, tl->f) == 1)
+    {
+        ts = flash_tl_ns(ev.t0_us) / 1000.0;
+        dur = (flash_tl_ns(ev.t1_us) - flash_tl_ns(ev.t0_us)) / 1000.0;
+        switch(ev.type)
         {
-            if((addr + len) <= fa->size)
+            case FLASH_TL_BEGIN:
+                fprintf(f, ",\n{\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"arg\":%ld}}", ev.tid, ts, tl->names[ev.name], ev.arg);
+                break;
+            case FLASH_TL_END:
+                fprintf(f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"ret\":%ld}}", ev.tid, ts, ev.arg);
+                break;
+            case FLASH_TL_OP:
+                fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\",\"args\":{\"addr\":\"0x%lx\",\"len\":%u}}", ev.tid, ts, dur, tl->names[ev.name], ev.arg, ev.len);
+                break;
+            default:
+                fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\"}", ev.tid, ts, dur, tl->names[ev.name]);
+                break;
+        }
+        ret++;
+    }
+    fseek(tl->f, 0, SEEK_END);
+    fprintf(f, "\n]}\n");
+    if(fclose(f) != 0) ret = -1;
+    return(ret);
+}
+
+void flash_timeline_close(struct flash_sim *sim)
+{
+    if(NULL == sim->tl) return;
+    fclose(sim->tl->f);
+    free(sim->tl);
+    sim->tl = NULL;
+}
+
+// the host waits for the simulated time, headless runs only advance the clock
+void flash_sleep(double us)
+{
+    if(!headless && us > 0.0) usleep((long)(us*simulation_factor));
+}
+
+// advance the simulation clock to t_us on the cpu lane in the given state, the host does not wait
+void flash_cpu_until(struct flash_sim *sim, double t_us, int state)
+{
+    if(t_us > sim->clock_us)
+    {
+        if(NULL != sim->tl) flash_tl_cpu(sim->tl, state, sim->clock_us, t_us);
+        sim->cpu_us[state] += t_us - sim->clock_us;
+        sim->clock_us = t_us;
+    }
+}
+
+// the cpu runs the counted filesystem work, the host does not wait like for the poll ticks
+void flash_cpu_charge(struct flash_sim *sim, double map_probes, double nm_probes, double copied, double crc_bytes)
+{
+    const struct cpu_prop *c = &sim->cpu;
+    double us = (map_probes * c->map_probe_cycles + nm_probes * c->nm_probe_cycles + copied * c->copy_byte_cycles + crc_bytes * c->crc_byte_cycles) / c->mhz;
+
+    sim->work.map_probes += map_probes;
+    sim->work.nm_probes += nm_probes;
+    sim->work.copied += copied;
+    sim->work.crc_bytes += crc_bytes;
+    sim->work.us += us;
+    flash_cpu_until(sim, sim->clock_us + us, FLASH_CPU_RUN);
+}
+
+// advance the simulation clock to t_us, the cpu waits
+void flash_wait_until(struct flash_sim *sim, double t_us)
+{
+    if(t_us > sim->clock_us)
+    {
+        flash_sleep(t_us - sim->clock_us);
+        flash_cpu_until(sim, t_us, FLASH_CPU_WAIT);
+    }
+}
+
+// AND the data into the flash a word at a time, returns non-zero if the target was not blank
+static uint64_t flash_program(uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    uint64_t d, w, dirty = 0;
+    uint32_t i;
+
+    for(i = 0; i + sizeof(w) <= len; i += sizeof(w))
+    {
+        memcpy(&d, dst + i, sizeof(d));
+        memcpy(&w, src + i, sizeof(w));
+        dirty |= ~d;
+        d &= w;
+        memcpy(dst + i, &d, sizeof(d));
+    }
+    for(; i < len; i++)
+    {
+        dirty |= (uint8_t)~dst[i];
+        dst[i] &= src[i];
+    }
+    return(dirty);
+}
+
+// metadata-only areas keep the programmed end of every sector instead of the payload, the bytes before
+// it read 0x00 and the rest 0xff, the blank checks see the same sectors programmed as with the payload
+static void flash_meta_read(const struct flash_area *fa, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    uint32_t off, l, n;
+
+    for(; len > 0; addr += l, data += l, len -= l)
+    {
+        off = addr % fa->prop.sector_size;
+        l = MIN(len, fa->prop.sector_size - off);
+        n = (fa->fill[addr / fa->prop.sector_size] > off ? MIN(fa->fill[addr / fa->prop.sector_size] - off, l) : 0);
+        memset(data, 0x00, n);
+        memset(data + n, 0xff, l - n);
+    }
+}
+
+static void flash_meta_program(struct flash_area *fa, uint32_t addr, uint32_t len)
+{
+    uint32_t off, l;
+
+    for(; len > 0; addr += l, len -= l)
+    {
+        off = addr % fa->prop.sector_size;
+        l = MIN(len, fa->prop.sector_size - off);
+        fa->fill[addr / fa->prop.sector_size] = MAX(fa->fill[addr / fa->prop.sector_size], off + l);
+    }
+}
+
+// check the arguments and do the operation on the flash content
+static int flash_op_data(struct flash_area *fa, int op, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    if(NULL == fa || !fa->open)
+    {
+        CONSOLE((NULL != fa && NULL != fa->sim ? fa->sim->con : NULL), "ERROR %s() INVALID FLASH AREA addr=%x len=%d\n", __FUNCTION__, addr, len);
+        return(-1);
+    }
+    if((addr + len) > fa->size)
+    {
+        CONSOLE(fa->sim->con, "ERROR %s() address %x OVERFLOW\n", __FUNCTION__, addr);
+        return(-1);
+    }
+    switch(op)
+    {
+        case FLASH_OP_READ:
+            if(fa->wear[(addr / fa->prop.sector_size)]<0) memset(data, 0x55, len);
+            else if(fa->meta) flash_meta_read(fa, addr, data, len);
+            else memcpy(data, &fa->flash[addr], len);
+            ///CONSOLE(&conlog, "%s() FLASH %d READ [w=%d] 0x%x %d bytes\n", __FUNCTION__, fa->id, fa->wear[(addr / fa->prop.sector_size)], addr, len);
+            break;
+        case FLASH_OP_WRITE:
+            if( ((addr % fa->prop.write_granularity) != 0) || ((len % fa->prop.write_granularity) != 0) )
             {
-                memset(&fa->flash[addr], 0xff, len);
-                ret = len;
-                int w=++fa->wear[(addr / fa->prop.sector_size)];
-                if(((double)rand() / RAND_MAX) < prob_bad(w, fa->prop.lifecycle)) fa->wear[(addr / fa->prop.sector_size)]*=-1;
-                ///CONSOLE(&conlog, "%s() FLASH %d ERASE [w=%d] SECTOR %03x\n", __FUNCTION__, fa->id, fa->wear[(addr / fa->prop.sector_size)], (addr / (fa->prop.sector_size)));
-                double delay_us = fa->prop.t_sector_erase_us;
-                fa->elapsed+=delay_us;
-                usleep((long)(delay_us*simulation_factor));
-                draw_update(0,1);
+                CONSOLE(fa->sim->con, "ERROR %s() ALIGNMENT ERROR (g=%d) address %x size %x\n", __FUNCTION__, fa->prop.write_granularity, addr, len);
+                return(-1);
             }
-            else CONSOLE(&conlog, "ERROR %s() address %x OVERFLOW\n", __FUNCTION__, addr);
-        }
-        else CONSOLE(&conlog, "ERROR %s() adress %x BAD ALIGNMENT\n", __FUNCTION__, addr);
+            // programming can only clear bits, any program over programmed bytes is reported
+            if(fa->meta) flash_meta_program(fa, addr, len);
+            else if(flash_program(&fa->flash[addr], data, len) != 0) CONSOLE(fa->sim->con, "%s() FLASH %d WARNING WRITING TO DIRTY AREA SECTOR %03x ADDR 0x%x\n", __FUNCTION__, fa->id, (addr/fa->prop.sector_size), addr);
+            ///CONSOLE(&conlog, "%s() FLASH %d WRITE SECTOR %03x ADDR 0x%x %d bytes\n", __FUNCTION__, fa->id, (addr/fa->prop.sector_size), addr, len);
+            break;
+        case FLASH_OP_ERASE:
+            if((addr % fa->prop.sector_size) != 0 || (fa->prop.block_size > 0 && ((addr | len) % fa->prop.block_size) != 0))
+            {
+                CONSOLE(fa->sim->con, "ERROR %s() adress %x BAD ALIGNMENT\n", __FUNCTION__, addr);
+                return(-1);
+            }
+            if(!fa->meta) memset(&fa->flash[addr], 0xff, len);
+            // multi sector erase: every sector wears and takes its time
+            int s, n = (len + fa->prop.sector_size - 1) / fa->prop.sector_size;
+            for(s = addr / fa->prop.sector_size; n > 0; n--, s++)
+            {
+                int w=++fa->wear[s];
+                if(fa->meta) fa->fill[s] = 0;
+                if(fa->sim->badblock && flash_rand(fa) < prob_bad(w, fa->prop.lifecycle))
+                {
+                    fa->wear[s]*=-1;
+                    if(fa->first_bad_us == 0.0) fa->first_bad_us = fa->sim->clock_us;
+                }
+            }
+            ///CONSOLE(&conlog, "%s() FLASH %d ERASE [w=%d] SECTOR %03x\n", __FUNCTION__, fa->id, fa->wear[(addr / fa->prop.sector_size)], (addr / (fa->prop.sector_size)));
+            break;
     }
+    return(0);
+}
 
-    return(ret);
+// a program page takes the byte times up to t_page_program_us
+static double flash_page_us(const struct flash_prop *p, uint32_t n)
+{
+    double t = p->t_byte_first_us + (n - 1) * p->t_byte_us;
+    return(p->t_page_program_us > 0.0 ? fmin(t, p->t_page_program_us) : t);
+}
+
+// programs are split at the page boundaries, parts without page_size program in one go
+static double flash_program_us(const struct flash_prop *p, uint32_t addr, uint32_t len, uint32_t *pages)
+{
+    uint32_t ps, head, full, tail;
+
+    *pages = (len > 0);
+    if(len == 0) return(0.0);
+    if(p->page_size <= 0) return(p->t_byte_first_us + (len - 1) * p->t_byte_us);
+    ps = p->page_size;
+    head = MIN(len, ps - addr % ps);
+    full = (len - head) / ps;
+    tail = (len - head) % ps;
+    *pages = 1 + full + (tail > 0);
+    return(flash_page_us(p, head) + full * flash_page_us(p, ps) + (tail > 0 ? flash_page_us(p, tail) : 0.0));
+}
+
+// cost of an operation: the transfer on the bus, the whole device time and the transaction overhead in them
+struct flash_cost
+{
+    double xfer_us;
+    double busy_us;
+    double ovh_us;
+    long tx;
+};
+
+// SPI parts pay a chip select, command and address on every transaction, reads the dummy cycles too,
+// programs and erases a write enable transaction before every command
+// the command is sent on one line, the read address on addr_lines and the data on spi_lines
+static void flash_op_cost(const struct flash_area *fa, int op, uint32_t addr, uint32_t len, struct flash_cost *c)
+{
+    const struct flash_prop *p = &fa->prop;
+    double cmd_us = 0.0, addr_us = 0.0, t;
+    uint32_t n;
+
+    if(p->spi_mhz > 0.0)
+    {
+        cmd_us = p->t_cs_us + 8.0 / p->spi_mhz;
+        addr_us = p->addr_bytes * 8.0 / p->spi_mhz;
+    }
+    switch(op)
+    {
+        case FLASH_OP_READ:
+            n = 1;
+            c->ovh_us = (p->spi_mhz > 0.0 ? cmd_us + (p->addr_bytes * 8.0 / MAX(p->addr_lines, 1) + p->dummy_cycles) / p->spi_mhz : 0.0);
+            c->xfer_us = c->ovh_us + p->t_comm_byte_us * len;
+            t = 0.0;
+            break;
+        case FLASH_OP_WRITE:
+            t = flash_program_us(p, addr, len, &n);
+            c->ovh_us = n * (2.0 * cmd_us + addr_us);
+            c->xfer_us = c->ovh_us + p->t_comm_byte_us * len;
+            n *= 2;
+            break;
+        default:
+            if(p->t_chip_erase_us > 0.0 && len == fa->size)
+            {
+                n = 1;
+                t = p->t_chip_erase_us;
+                addr_us = 0.0;
+            }
+            else if(p->block_size > 0)
+            {
+                n = (len + p->block_size - 1) / p->block_size;
+                t = p->t_block_erase_us * n;
+            }
+            else
+            {
+                n = (len + p->sector_size - 1) / p->sector_size;
+                t = p->t_sector_erase_us * n;
+            }
+            c->ovh_us = n * (2.0 * cmd_us + addr_us);
+            c->xfer_us = c->ovh_us;
+            n *= 2;
+            break;
+    }
+    c->tx = (p->spi_mhz > 0.0 ? n : 0);
+    c->busy_us = c->xfer_us + t;
+}
+
+// queue an operation on the device and bus timelines, the flash content changes at once
+// the transfer takes the bus first, programs and erases keep only the device busy after it
+// a suspended erase lets reads through and is resumed by any other operation
+// the MCU flash halts the cpu until the operation is done
+static double flash_area_queue(struct flash_area *fa, int op, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    struct flash_lane *bus;
+    struct flash_cost c;
+    double start;
+
+    if(flash_op_data(fa, op, addr, data, len) < 0) return(-1.0);
+    if(fa->asleep)
+    {
+        CONSOLE(fa->sim->con, "%s() FLASH %d WARNING ACCESS IN DEEP POWER-DOWN\n", __FUNCTION__, fa->id);
+        flash_area_wake(fa);
+    }
+    if(op != FLASH_OP_READ && fa->suspended) flash_area_resume(fa);
+    double submit_us = fa->sim->clock_us - fa->pend_lat;
+    flash_op_cost(fa, op, addr, len, &c);
+    fa->pend_lat = 0.0;
+    start = fmax(fa->busy_until, fa->sim->clock_us);
+    bus = (fa->device > 0 ? &fa->sim->bus[fa->device] : NULL);
+    if(NULL != bus)
+    {
+        start = fmax(start, bus->busy_until);
+        bus->busy_until = start + c.xfer_us;
+        bus->busy += c.xfer_us;
+    }
+    fa->busy_until = start + c.busy_us;
+    if(op == FLASH_OP_ERASE) fa->erase_until = fa->busy_until;
+    if(op == FLASH_OP_READ) latency_add(&fa->rd, fa->busy_until - submit_us);
+    if(op == FLASH_OP_READ) fa->rd_bytes += len;
+    if(op == FLASH_OP_WRITE) fa->wr_bytes += len;
+    fa->elapsed += c.busy_us;
+    fa->spi_tx += c.tx;
+    fa->t_spi_ovh += c.ovh_us;
+    if(NULL != fa->sim->tl) flash_tl_op(fa, op, addr, len, start, c.xfer_us);
+    if(NULL == bus) flash_cpu_until(fa->sim, fa->busy_until, FLASH_CPU_STALL);
+    return(fa->busy_until);
+}
+
+// start an operation on the device timeline without waiting for it, returns the completion time
+double flash_area_start(struct flash_area *fa, int op, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    if(NULL == fa || !fa->open)
+    {
+        flash_op_data(fa, op, addr, data, len);     // logs the invalid area
+        return(-1.0);
+    }
+    double t0 = fa->sim->clock_us;
+    double t = flash_area_queue(fa, op, addr, data, len);
+    flash_sleep(fa->sim->clock_us - t0);
+    if(t >= 0.0 && !headless) draw_update(0,1);
+    return(t);
+}
+
+// wait for the device to finish, a suspended erase is resumed first
+static void flash_wait(struct flash_area *fa)
+{
+    if(fa->suspended) flash_area_resume(fa);
+    flash_wait_until(fa->sim, fa->busy_until);
+}
+
+int flash_area_write(struct flash_area *fa, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    double t = flash_area_start(fa, FLASH_OP_WRITE, addr, (uint8_t *)data, len);
+    if(t < 0.0) return(-1);
+    flash_wait_until(fa->sim, t);
+    return(len);
+}
+
+int flash_area_read(struct flash_area *fa, uint32_t addr, uint8_t *data, uint32_t len)
+{
+    double t = flash_area_start(fa, FLASH_OP_READ, addr, data, len);
+    if(t < 0.0) return(-1);
+    flash_wait_until(fa->sim, t);
+    return(len);
+}
+
+int flash_area_erase(struct flash_area *fa, uint32_t addr, uint32_t len)
+{
+    double t = flash_area_start(fa, FLASH_OP_ERASE, addr, NULL, len);
+    if(t < 0.0) return(-1);
+    flash_wait_until(fa->sim, t);
+    return(len);
+}
+
+// run synchronous operations one after the other with the timing and wear of the single calls,
+// the host waits and the map is redrawn once per batch, returns the number of operations done
+int flash_area_submit(struct flash_op *ops, int n)
+{
+    struct flash_sim *sim;
+    double t0, t;
+    int i;
+
+    if(n <= 0 || NULL == ops[0].fa || !ops[0].fa->open) return(0);
+    sim = ops[0].fa->sim;
+    t0 = sim->clock_us;
+    for(i = 0; i < n; i++)
+    {
+        t = flash_area_queue(ops[i].fa, ops[i].op, ops[i].addr, ops[i].data, ops[i].len);
+        if(t < 0.0) break;
+        flash_cpu_until(sim, t, FLASH_CPU_WAIT);
+    }
+    flash_sleep(sim->clock_us - t0);
+    if(i > 0 && !headless) draw_update(0,1);
+    return(i);
+}
+
+// start an erase and return without waiting for it, the area stays busy until it is done
+// like a synchronous driver the cpu waits for the device to accept the command
+int flash_area_erase_background(struct flash_area *fa, uint32_t addr, uint32_t len)
+{
+    if(NULL != fa && fa->open && !fa->asleep) flash_wait(fa);
+    if(flash_area_start(fa, FLASH_OP_ERASE, addr, NULL, len) < 0.0) return(-1);
+    return(len);
+}
+
+int flash_area_busy(struct flash_area *fa)
+{
+    return(NULL != fa && fa->open && (fa->suspended || fa->busy_until > fa->sim->clock_us));
+}
+
+// suspend the running erase, returns -1 if the area cannot suspend
+int flash_area_suspend(struct flash_area *fa)
+{
+    if(NULL == fa || !fa->open || fa->prop.t_suspend_us <= 0.0) return(-1);
+    // only an erase at the end of the queue can be suspended
+    if(fa->suspended || fa->busy_until <= fa->sim->clock_us || fa->erase_until != fa->busy_until) return(0);
+    // the erase keeps running until the resume time is over and during the suspend latency
+    double wait_us = fmax(fa->resumed_until - fa->sim->clock_us, 0.0) + fa->prop.t_suspend_us;
+    flash_sleep(wait_us);
+    flash_cpu_until(fa->sim, fa->sim->clock_us + wait_us, FLASH_CPU_WAIT);
+    fa->pend_lat += wait_us;
+    if(fa->busy_until <= fa->sim->clock_us) return(0);
+    fa->erase_left = fa->busy_until - fa->sim->clock_us;
+    fa->busy_until = fa->sim->clock_us;
+    if(NULL != fa->sim->tl) flash_tl_suspend(fa, 0, fa->sim->clock_us);
+    fa->suspended = 1;
+    fa->suspended_since = fa->sim->clock_us;
+    fa->suspends++;
+    return(0);
+}
+
+int flash_area_resume(struct flash_area *fa)
+{
+    if(NULL == fa || !fa->open) return(-1);
+    if(fa->suspended)
+    {
+        fa->suspended = 0;
+        // reads done during the suspend are finished first
+        double t = fmax(fa->busy_until, fa->sim->clock_us);
+        fa->t_suspended += t - fa->suspended_since;
+        fa->busy_until = fa->erase_until = t + fa->erase_left;
+        fa->resumed_until = t + fa->prop.t_resume_us;
+        if(NULL != fa->sim->tl) flash_tl_suspend(fa, 1, t);
+        fa->erase_left = 0.0;
+    }
+    return(0);
+}
+
+// deep power-down, a running erase is finished first
+int flash_area_sleep(struct flash_area *fa)
+{
+    if(NULL == fa || !fa->open) return(-1);
+    if(!fa->asleep)
+    {
+        flash_wait(fa);
+        fa->asleep = 1;
+        fa->sleep_since = fa->sim->clock_us;
+    }
+    return(0);
+}
+
+// release from deep power-down, the wake-up time is charged to the next read
+int flash_area_wake(struct flash_area *fa)
+{
+    if(NULL == fa || !fa->open) return(-1);
+    if(fa->asleep)
+    {
+        fa->asleep = 0;
+        fa->t_dpd += fa->sim->clock_us - fa->sleep_since;
+        flash_sleep(fa->prop.t_wake_us);
+        flash_cpu_until(fa->sim, fa->sim->clock_us + fa->prop.t_wake_us, FLASH_CPU_WAIT);
+        fa->pend_lat += fa->prop.t_wake_us;
+        fa->wakes++;
+    }
+    return(0);
+}
+
+// combined throughput of devices working in parallel, busy is the sum of the device times over the wall time
+void flash_report_throughput(struct flash_area *fa, int n)
+{
+    double rd = 0.0, wr = 0.0, busy = 0.0, total;
+    int i;
+
+    if(n <= 0 || !fa[0].open) return;
+    total = fa[0].sim->clock_us - fa[0].opened_at;
+    for(i = 0; i < n; i++)
+    {
+        rd += fa[i].rd_bytes;
+        wr += fa[i].wr_bytes;
+        busy += fa[i].elapsed;
+    }
+    if(total > 0.0) CONSOLE(fa[0].sim->con, "throughput devices=%d wall=%.1f ms write=%.1f KB/s read=%.1f KB/s busy=%.0f%%\n", n, total/1000.0, wr/1024.0/(total/1e6), rd/1024.0/(total/1e6), 100.0*busy/total);
+}
+
+// time spent with a suspended erase, a running suspend is counted up to now
+static double flash_area_suspended_us(const struct flash_area *fa)
+{
+    return(fa->t_suspended + (fa->suspended ? fa->sim->clock_us - fa->suspended_since : 0.0));
+}
+
+// utilisation of the lanes over the wall time: the cpu states, the SPI buses and the devices of the areas
+void flash_report_timeline(struct flash_area *fa, int n)
+{
+    struct flash_sim *sim;
+    double total;
+    int i, b;
+
+    if(n <= 0 || !fa[0].open) return;
+    sim = fa[0].sim;
+    total = sim->clock_us - fa[0].opened_at;
+    if(total <= 0.0) return;
+    CONSOLE(sim->con, "timeline wall=%.1f ms cpu run=%.0f%% wait=%.0f%% stall=%.0f%% idle=%.0f%%\n", total/1000.0, 100.0*sim->cpu_us[FLASH_CPU_RUN]/total, 100.0*sim->cpu_us[FLASH_CPU_WAIT]/total, 100.0*sim->cpu_us[FLASH_CPU_STALL]/total, 100.0*sim->cpu_us[FLASH_CPU_IDLE]/total);
+    if(sim->work.us > 0.0) CONSOLE(sim->con, "timeline cpu work=%.1f ms %.0f%% map probes=%.0f nm probes=%.0f copied=%.0f crc=%.0f\n", sim->work.us/1000.0, 100.0*sim->work.us/total, sim->work.map_probes, sim->work.nm_probes, sim->work.copied, sim->work.crc_bytes);
+    for(b = 1; b < FLASH_BUSES; b++) if(sim->bus[b].busy > 0.0) CONSOLE(sim->con, "timeline bus %d busy=%.1f ms %.0f%%\n", b, sim->bus[b].busy/1000.0, 100.0*sim->bus[b].busy/total);
+    for(i = 0; i < n; i++) if(fa[i].open) CONSOLE(sim->con, "timeline area %d bus %d busy=%.1f ms %.0f%% suspended=%.1f ms\n", fa[i].id, fa[i].device, fa[i].elapsed/1000.0, 100.0*fa[i].elapsed/total, flash_area_suspended_us(&fa[i])/1000.0);
+}
+
+// wear projection over the lifecycle of the parts, the run stands for days of use (the simulated time if 0)
+// the first bad sector is expected when the most worn sector reaches the lifecycle at the rate of the run
+// returns -1 if there is nothing to project
+int flash_area_stats(const struct flash_area *fa, double days, struct flash_stats *st)
+{
+    double total, sum;
+    int s, w, max, sectors;
+
+    if(NULL == fa || !fa->open || NULL == fa->wear) return(-1);
+    total = fa->sim->clock_us - fa->opened_at;
+    if(days <= 0.0) days = total / 86400e6;
+    if(days <= 0.0) return(-1);
+    sectors = fa->prop.size / fa->prop.sector_size;
+    for(sum = 0.0, max = s = 0; s < sectors; s++)
+    {
+        w = abs(fa->wear[s]);
+        sum += w;
+        if(w > max) max = w;
+    }
+    st->days = days;
+    st->erases_per_day = sum / days;
+    st->wear_max_per_day = max / days;
+    st->years_first_bad = (max > 0 ? fmax(fa->prop.lifecycle - max, 0) / (max / days) / 365.0 : INFINITY);
+    st->first_bad_days = (fa->first_bad_us > 0.0 && total > 0.0 ? (fa->first_bad_us - fa->opened_at) / total * days : 0.0);
+    st->rd_lat_p99_us = (fa->rd.n > 0 ? latency_percentile(&fa->rd, 0.99) : 0.0);
+    st->rd_lat_max_us = fa->rd.max;
+    return(0);
+}
+
+// wear projection over the lifecycle of the parts
+void flash_report_lifetime(FILE *f, struct flash_area *fa, int n, double days)
+{
+    struct flash_stats st;
+    int i;
+
+    for(i = 0; i < n; i++)
+    {
+        if(flash_area_stats(&fa[i], days, &st) < 0) continue;
+        CONSOLE(fa[i].sim->con, "lifetime area %d days=%.3f erases/day=%.1f max sector wear/day=%.3f years to first bad=%.1f\n", fa[i].id, st.days, st.erases_per_day, st.wear_max_per_day, st.years_first_bad);
+        if(st.first_bad_days > 0.0) CONSOLE(fa[i].sim->con, "lifetime area %d first bad sector after %.3f days\n", fa[i].id, st.first_bad_days);
+        if(NULL == f) continue;
+        fprintf(f, "lifetime area=%d days=%.6f erases_per_day=%.3f wear_max_per_day=%.6f years_first_bad=%.2f", fa[i].id, st.days, st.erases_per_day, st.wear_max_per_day, st.years_first_bad);
+        if(st.first_bad_days > 0.0) fprintf(f, " first_bad_days=%.6f", st.first_bad_days);
+        fprintf(f, "\n");
+    }
+}
+
+void flash_cpu_summary(FILE *f, const struct flash_sim *sim)
+{
+    fprintf(f, "cpu run_us=%.1f wait_us=%.1f stall_us=%.1f idle_us=%.1f work_us=%.1f map_probes=%.0f nm_probes=%.0f copied=%.0f crc_bytes=%.0f\n", sim->cpu_us[FLASH_CPU_RUN], sim->cpu_us[FLASH_CPU_WAIT], sim->cpu_us[FLASH_CPU_STALL], sim->cpu_us[FLASH_CPU_IDLE], sim->work.us, sim->work.map_probes, sim->work.nm_probes, sim->work.copied, sim->work.crc_bytes);
+}
+
+// machine-readable statistics of an open area as key=value pairs on one line, wear counts the erases per sector
+void flash_area_summary(FILE *f, struct flash_area *fa)
+{
+    long sum = 0;
+    int min, max, i, n;
+
+    if(NULL == fa || !fa->open) return;
+    fprintf(f, "area=%d bus=%d elapsed_us=%.1f wall_us=%.1f rd_bytes=%.0f wr_bytes=%.0f reads=%ld suspends=%ld suspended_us=%.1f wakes=%ld dpd_us=%.1f", fa->id, fa->device, fa->elapsed, fa->sim->clock_us - fa->opened_at, fa->rd_bytes, fa->wr_bytes, fa->rd.n, fa->suspends, flash_area_suspended_us(fa), fa->wakes, fa->t_dpd + (fa->asleep ? fa->sim->clock_us - fa->sleep_since : 0.0));
+    if(fa->device > 0) fprintf(f, " bus_busy_us=%.1f", fa->sim->bus[fa->device].busy);
+    if(fa->spi_tx > 0) fprintf(f, " spi_tx=%ld spi_overhead_us=%.1f", fa->spi_tx, fa->t_spi_ovh);
+    if(fa->rd.n > 0) fprintf(f, " rd_lat_avg_us=%.1f rd_lat_max_us=%.1f", fa->rd.sum/fa->rd.n, fa->rd.max);
+    if(NULL != fa->wear)
+    {
+        n = fa->prop.size/fa->prop.sector_size;
+        min = max = fa->wear[0];
+        for(i = 0; i < n; i++)
+        {
+            sum += fa->wear[i];
+            if(fa->wear[i] < min) min = fa->wear[i];
+            if(fa->wear[i] > max) max = fa->wear[i];
+        }
+        fprintf(f, " erases=%ld wear_avg=%.2f wear_stddev=%.2f wear_min=%d wear_max=%d", sum, (double)sum/n, stddev(fa->wear, n), min, max);
+    }
+    fprintf(f, "\n");
 }
 
 int flash_area_close(struct flash_area *fa)
 {
     if(NULL != fa && fa->open)
     {
-        CONSOLE(&conlog, "%s() FLASH AREA CLOSE %d elapsed = %.1f ms\n", __FUNCTION__, fa->id, fa->elapsed/1000.0);
+        CONSOLE(fa->sim->con, "%s() FLASH AREA CLOSE %d elapsed = %.1f ms\n", __FUNCTION__, fa->id, fa->elapsed/1000.0);
+        if(fa->asleep) fa->t_dpd += fa->sim->clock_us - fa->sleep_since;
+        if(fa->prop.i_active_ua > 0.0)
+        {
+            // charge in uC: uA * us / 1e6, busy time of background erases overlapping idle time is counted once
+            double total = fa->sim->clock_us - fa->opened_at;
+            double standby = fmax(total - fa->elapsed - fa->t_dpd, 0.0);
+            double charge = (fa->prop.i_active_ua * fa->elapsed + fa->prop.i_standby_ua * standby + fa->prop.i_dpd_ua * fa->t_dpd) / 1e6;
+            CONSOLE(fa->sim->con, "power active=%.1f ms standby=%.1f ms dpd=%.1f ms wakes=%ld charge=%.1f uC idle charge=%.1f uC\n", fa->elapsed/1000.0, standby/1000.0, fa->t_dpd/1000.0, fa->wakes, charge, (fa->prop.i_standby_ua * standby + fa->prop.i_dpd_ua * fa->t_dpd) / 1e6);
+        }
+        if(fa->spi_tx > 0) CONSOLE(fa->sim->con, "spi transactions=%ld overhead=%.1f ms\n", fa->spi_tx, fa->t_spi_ovh/1000.0);
+        if(fa->rd.n > 0) CONSOLE(fa->sim->con, "read latency avg=%.1f us p99<=%.0f us p99.9<=%.0f us max=%.1f us reads=%ld suspends=%ld\n", fa->rd.sum/fa->rd.n, latency_percentile(&fa->rd, 0.99), latency_percentile(&fa->rd, 0.999), fa->rd.max, fa->rd.n, fa->suspends);
         if(NULL!=fa->wear)
         {
             double sum=0.0, ave=0.0;
@@ -189,10 +1166,22 @@ int flash_area_close(struct flash_area *fa)
               if(fa->wear[i]>max) max=fa->wear[i];
             }
             ave=sum/N;
-            CONSOLE(&conlog,"avg=%7.2f stddev=%7.2f min=%d max=%d\n",ave, stddev(fa->wear, N), min, max);
+            CONSOLE(fa->sim->con,"avg=%7.2f stddev=%7.2f min=%d max=%d\n",ave, stddev(fa->wear, N), min, max);
             free(fa->wear);
         }
+        if(NULL!=fa->fill) free(fa->fill);
+        fa->fill=NULL;
         fa->elapsed=0.0;
+        fa->rd_bytes=0.0;
+        fa->wr_bytes=0.0;
+        fa->spi_tx=0;
+        fa->t_spi_ovh=0.0;
+        memset(&fa->rd, 0, sizeof(fa->rd));
+        fa->suspends=0;
+        fa->t_suspended=0.0;
+        fa->t_dpd=0.0;
+        fa->wakes=0;
+        fa->asleep=0;
         fa->open=0;
     }
     return (0);
@@ -28,10 +28,21 @@
 #define FLASH_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define FLASH_AREA_NFFS (17)
 #define FLASH_AREA_SUPER (5)
 
+// SPI buses, the device of an area is its bus, 0 is the MCU flash halting the cpu
+#define FLASH_BUSES (8)
+
+// cpu lane states: running, waiting for an SPI flash, halted by the MCU flash, idle
+#define FLASH_CPU_RUN   (0)
+#define FLASH_CPU_WAIT  (1)
+#define FLASH_CPU_STALL (2)
+#define FLASH_CPU_IDLE  (3)
+#define FLASH_CPU_STATES (4)
+
 struct flash_prop
 {
   uint32_t size;
@@ -43,6 +54,88 @@ struct flash_prop
   double t_byte_us;
   double t_comm_byte_us;
   int lifecycle;
+  double t_suspend_us;          // erase suspend latency, 0 if not supported
+  double t_resume_us;           // min erase progress after resume before the next suspend
+  double t_wake_us;             // release from deep power-down
+  double i_active_ua;           // supply current during operations
+  double i_standby_ua;          // idle, powered up
+  double i_dpd_ua;              // deep power-down
+  int block_size;               // erase unit of parts without sector erase, 0 if sectors can be erased
+  double t_block_erase_us;
+  double t_chip_erase_us;       // erase of the whole area in one command, 0 if not supported
+  int page_size;                // program page, reported in the simulated SFDP table
+  double spi_mhz;               // bus clock and data lines, 0 for memory mapped flash
+  int spi_lines;
+  int addr_bytes;               // 3 or 4 byte addresses
+  int addr_lines;               // read address lines, 4 for 1-4-4 quad reads
+  int dummy_cycles;             // read dummy and mode cycles
+  double t_cs_us;               // chip select setup and hold, driver start per transaction
+};
+
+// built-in parts, profiles/*.lua can replace them at run time (flash_prop_load)
+// BY25Q32ES on an 8 MHz single line SPI bus, the lifecycle is shortened to show the wear in short runs
+#define FLASH_PROP_BY25Q32ES(size, block_size, t_block_erase_us) \
+    { size, 4096, 1, 36000.0, 600.0, 30.0, 2.5, 1.0, 100, 30.0, 100.0, 30.0, 12000.0, 10.0, 1.0, block_size, t_block_erase_us, 0.0, 256, 8.0, 1, 3, 1, 0, 2.0 }
+// nRF52832 internal flash, the cpu halts during program and erase
+#define FLASH_PROP_NRF52832(size) \
+    { size, 4096, 4, 80000.0, 67.5/4*4096, 67.5/4, 67.5/4, 0.0, 100000, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0, 0.0, 0.0, 4, 0.0, 0, 0, 0, 0, 0.0 }
+
+// cpu cost table of the filesystem work counted by the runners, profiles/*.lua can replace it (cpu_prop_load)
+struct cpu_prop
+{
+  double mhz;
+  double map_probe_cycles;      // sector_map or index byte examined
+  double nm_probe_cycles;       // namemap entry or log record examined
+  double copy_byte_cycles;      // byte copied in RAM
+  double crc_byte_cycles;       // byte checksummed
+};
+
+// Cortex-M4 running from cached flash, byte loops and a nibble table crc32
+#define CPU_PROP_CORTEX_M4(mhz) { mhz, 5.0, 20.0, 1.0, 12.0 }
+
+// counted work and its cpu time
+struct cpu_work
+{
+  double map_probes;
+  double nm_probes;
+  double copied;
+  double crc_bytes;
+  double us;
+};
+
+// a resource with its own timeline, work queues behind the work already on it
+struct flash_lane
+{
+  double busy_until;
+  double busy;                  // sum of the busy time
+};
+
+struct console;
+struct flash_timeline;
+
+// simulator state of one device, its areas share the clock, the cpu and the SPI buses
+// fleet runs simulate many devices side by side, each with its own flash_sim
+struct flash_sim
+{
+  double clock_us;              // simulation clock, flash operations and the cpu waiting for them advance it
+  double cpu_us[FLASH_CPU_STATES]; // cpu lane, the time of the clock in each cpu state
+  struct flash_lane bus[FLASH_BUSES]; // indexed by the device of the area, the MCU flash (0) has no bus
+  struct cpu_prop cpu;          // cpu cost table and the work charged with it
+  struct cpu_work work;
+  int badblock;
+  uint64_t seed;                // mixed into the bad block generators of the areas
+  struct console *con;          // log of the device, NULL for none
+  void *user;                   // runner context of the device
+  struct flash_timeline *tl;    // events of the trace event export, NULL if they are not recorded
+};
+
+// read latency statistics
+struct flash_latency
+{
+  long n;
+  double sum;
+  double max;
+  long hist[32];                // log2 buckets in us
 };
 
 struct flash_area
@@ -52,16 +145,94 @@ struct flash_area
   int *wear;
   uint8_t *flash;
   uint32_t size;
-  int device;
+  int device;                   // SPI bus, 0 for the MCU flash
   double elapsed;
-  const struct flash_prop prop;
+  struct flash_prop prop;
+  double busy_until;            // end of the last queued operation on the simulation clock
+  double erase_until;           // end of the last erase
+  double erase_left;            // remaining time of the suspended erase
+  double resumed_until;         // no suspend is accepted before this time
+  int suspended;
+  long suspends;
+  double suspended_since;
+  double t_suspended;           // time with a suspended erase
+  double pend_lat;              // suspend latency charged to the next read
+  struct flash_latency rd;
+  int asleep;
+  long wakes;
+  double opened_at;             // simulation clock at open
+  double sleep_since;
+  double t_dpd;                 // time spent in deep power-down
+  double rd_bytes;
+  double wr_bytes;
+  long spi_tx;                  // SPI transactions and their command, address and chip select time
+  double t_spi_ovh;
+  uint64_t rng;                 // bad block generator state
+  int meta;                     // metadata-only, the payload is not stored (flash_meta_read())
+  uint32_t *fill;               // metadata-only, programmed end of every sector
+  double first_bad_us;          // simulation clock when the first sector went bad, 0 if none
+  struct flash_sim *sim;        // device of the area, set by flash_area_open()
 };
 
+// lifetime and latency figures of an open area, the per-device numbers of the fleet statistics
+struct flash_stats
+{
+  double days;                  // days of use the run stands for
+  double erases_per_day;
+  double wear_max_per_day;      // most worn sector
+  double years_first_bad;       // INFINITY without wear
+  double first_bad_days;        // 0 if no sector went bad
+  double rd_lat_p99_us;
+  double rd_lat_max_us;
+};
+
+// one operation of a flash_area_submit() batch, data is NULL for erase
+struct flash_op
+{
+  struct flash_area *fa;
+  int op;
+  uint32_t addr;
+  uint8_t *data;
+  uint32_t len;
+};
+
+#define FLASH_OP_READ  (0)
+#define FLASH_OP_WRITE (1)
+#define FLASH_OP_ERASE (2)
+
 
-int flash_area_open(int id, struct flash_area *fa, const struct flash_area *fas);
+int flash_prop_load(const char *name, struct flash_prop *prop);
+int cpu_prop_load(const char *name, struct cpu_prop *prop);
+int flash_payload(struct console *con, const char *dir, const char *name, int len, uint8_t **data);
+int flash_is_trace(const char *path);
+void flash_sim_init(struct flash_sim *sim, struct console *con, uint64_t seed);
+int flash_area_open(struct flash_sim *sim, int id, struct flash_area *fa, const struct flash_area *fas);
 int flash_area_write(struct flash_area *fa, uint32_t addr, const uint8_t *data, uint32_t len);
 int flash_area_read(struct flash_area *fa, uint32_t addr, uint8_t *data, uint32_t len);
 int flash_area_erase(struct flash_area *fa, uint32_t addr, uint32_t len);
+int flash_area_erase_background(struct flash_area *fa, uint32_t addr, uint32_t len);
+int flash_area_busy(struct flash_area *fa);
+int flash_area_suspend(struct flash_area *fa);
+int flash_area_resume(struct flash_area *fa);
+int flash_area_sleep(struct flash_area *fa);
+int flash_area_wake(struct flash_area *fa);
+int flash_area_submit(struct flash_op *ops, int n);
+double flash_area_start(struct flash_area *fa, int op, uint32_t addr, uint8_t *data, uint32_t len);
+void flash_wait_until(struct flash_sim *sim, double t_us);
+void flash_cpu_until(struct flash_sim *sim, double t_us, int state);
+void flash_cpu_charge(struct flash_sim *sim, double map_probes, double nm_probes, double copied, double crc_bytes);
+void flash_sleep(double us);
+int flash_timeline_open(struct flash_sim *sim);
+void flash_timeline_begin(struct flash_sim *sim, const char *name, long arg);
+int flash_timeline_end(struct flash_sim *sim, int ret);
+int flash_timeline_export(struct flash_sim *sim, const char *path, const char *process, const struct flash_area *fa, int n);
+void flash_timeline_close(struct flash_sim *sim);
+void flash_report_throughput(struct flash_area *fa, int n);
+void flash_report_timeline(struct flash_area *fa, int n);
+void flash_report_lifetime(FILE *f, struct flash_area *fa, int n, double days);
+int flash_area_stats(const struct flash_area *fa, double days, struct flash_stats *st);
+void flash_area_summary(FILE *f, struct flash_area *fa);
+void flash_cpu_summary(FILE *f, const struct flash_sim *sim);
 int flash_area_close(struct flash_area *fa);
 
 #endif
@@ -42,6 +42,8 @@
 #include "test.h"
 #include "flash.h"
 #include "lfs.h"
+#define ZEROFS_TRACE_IMPLEMENTATION
+#include "zerofs_trace.h"
 
 
 static int quit=0;
@@ -63,6 +65,11 @@ double simulation_factor = 1.0;
 static int step_through = 1;
 
 struct console conlog;
+static struct flash_sim sim;    // the simulated device
+
+// a call as a span on the api lane of the --timeline export, evaluates to the result of the call
+#define SIM_CALL(name, arg, call) (flash_timeline_begin(&sim, name, (long)(arg)), flash_timeline_end(&sim, (call)))
+
 static lfs_t lfs;
 static int height, width;
 static char *test_dir;
@@ -79,7 +86,7 @@ static uint8_t *sector_map; // one byte per block
 
 // flash area descriptors
 
-static const struct flash_prop flash_prop={ sizeof(mem_flash), 4096, 1, 36000.0, 600.0, 30.0, 2.5, 1.0 }; // based on BY25Q32ES datasheet, page is 256 bytes
+static const struct flash_prop flash_prop=FLASH_PROP_BY25Q32ES(sizeof(mem_flash), 0, 0.0);
 
 static struct flash_area fas[]=
 {
@@ -146,12 +153,37 @@ static void files_free(void)
 
 #define OFFSET(fa,blk,off) (((size_t)(blk)) * (fa)->prop.sector_size + (off))
 
+// littlefs work for the cpu cost model, the checksums come through the linker (-Wl,--wrap=lfs_crc)
+// and the bytes of the block device moved through the read and program caches are copies
+static double sim_crc_bytes=0.0;
+static double sim_copied=0.0;
+
+uint32_t __real_lfs_crc(uint32_t crc, const void *buffer, size_t size);
+uint32_t __wrap_lfs_crc(uint32_t crc, const void *buffer, size_t size)
+{
+  sim_crc_bytes+=size;
+  return(__real_lfs_crc(crc, buffer, size));
+}
+
+static void sim_cpu_charge(void)
+{
+  flash_cpu_charge(&sim, 0.0, 0.0, sim_copied, sim_crc_bytes);
+  sim_copied=sim_crc_bytes=0.0;
+}
+
+static void sim_cache_copy(const void *buffer, lfs_size_t size)
+{
+  if(buffer==lfs.rcache.buffer||buffer==lfs.pcache.buffer) sim_copied+=size;
+}
+
 static int lfs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
 {
   struct flash_area *fa=(struct flash_area *)c->context;
   int stk=(stack_baseline-((uintptr_t)&fa));
   if(stk>max_stack) max_stack=stk;
   size_t addr = OFFSET(fa, block, off);
+  sim_cpu_charge();
+  sim_cache_copy(buffer, size);
   int ret=flash_area_read(fa, addr, buffer, size);
   return(ret>=0?0:LFS_ERR_CORRUPT);
 }
@@ -162,6 +194,8 @@ static int lfs_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off
   int stk=(stack_baseline-((uintptr_t)&fa));
   if(stk>max_stack) max_stack=stk;
   size_t addr = OFFSET(fa, block, off);
+  sim_cache_copy(buffer, size);
+  sim_cpu_charge();
   int ret=flash_area_write(fa, addr, buffer, size);
   if(current_file_id!=INVALID_ID) sector_map[addr/(fa)->prop.sector_size]=current_file_id;
   return(ret>=0?0:LFS_ERR_CORRUPT);
@@ -173,6 +207,7 @@ static int lfs_erase(const struct lfs_config *c, lfs_block_t block)
   int stk=(stack_baseline-((uintptr_t)&fa));
   if(stk>max_stack) max_stack=stk;
   size_t addr = OFFSET(fa, block, 0);
+  sim_cpu_charge();
   int ret=flash_area_erase(fa, addr, fa->prop.sector_size);
   sector_map[addr/(fa)->prop.sector_size]=ERASED_ID;
   return(ret>=0?0:LFS_ERR_CORRUPT);
@@ -435,138 +470,113 @@ void draw_update(int wait, int umap)
 
 static int l_getch(lua_State *L)
 {
-  int ch=getch();
+  int ch=(headless?ERR:getch());
   lua_pushinteger(L, ch);
   return(1);
 }
 
+// the file left open by write(..., true) until close()
+static lfs_file_t open_fp;
+static uint8_t open_buf[LITTLEFS_CACHE_SIZE];
+static int open_fp_used=0;
+
+// write(name, chunk [, len [, keep_open]]) writes the file of the data directory, or len synthetic bytes
+// keep_open leaves the file open for writing until close()
 static int l_write(lua_State *L)
 {
     const char *name = luaL_checkstring(L, 1);
     int chunk = luaL_checkinteger(L, 2);
-    char path[PATH_MAX];
+    int keep_open = lua_toboolean(L, 4);
     uint8_t *data;
     uint8_t *p;
     int st=-1;
-    int l;
+    int len, l;
 
-    strcpy(path, test_dir);
-    int len = strlen(path);
-    if(len + strlen(name) < PATH_MAX)
+    if(keep_open && open_fp_used) return(luaL_error(L, "a file is already open"));
+    len = flash_payload(&conlog, test_dir, name, luaL_optinteger(L, 3, -1), &data);
+    if(len >= 0)
     {
-        strcat(path, "/");
-        strcat(path, name);
-        FILE *f = fopen(path, "rb");
-        if(NULL != f)
+      lfs_file_t local_fp;
+      lfs_file_t *fp = (keep_open ? &open_fp : &local_fp);
+      (void)SIM_CALL("delete", 0, lfs_remove(&lfs, name));
+      file_cache(name,0);
+      current_file_id=file_cache(name,1);
+      uint8_t filebuf[LITTLEFS_CACHE_SIZE];
+      struct lfs_file_config cfg = { .buffer = (keep_open ? open_buf : filebuf) };
+      st = SIM_CALL("create", 0, lfs_file_opencfg(&lfs, fp, name, LFS_O_RDWR | LFS_O_CREAT, &cfg));
+      if(st >= 0)
+      {
+        // write in chunk buffer size
+        p=data;
+        l=len;
+        while(l>0&&st>=0)
         {
-            fseek(f, 0, SEEK_END);
-            len = ftell(f);
-            fseek(f, 0, SEEK_SET);
-            data = malloc(len);
-            if(len == fread(data, 1, len, f))
-            {
-              lfs_file_t fp;
-              lfs_remove(&lfs, name);
-              file_cache(name,0);
-              current_file_id=file_cache(name,1);
-              uint8_t filebuf[LITTLEFS_CACHE_SIZE];
-              struct lfs_file_config cfg = { .buffer = filebuf };
-              st = lfs_file_opencfg(&lfs, &fp, name, LFS_O_RDWR | LFS_O_CREAT, &cfg);
-              if(st >= 0)
-              {
-                // write in chunk buffer size
-                p=data;
-                l=len;
-                while(l>0&&st>=0)
-                {
-                  st = lfs_file_write(&lfs, &fp, p, MIN(l,chunk));
-                  p+=MIN(l,chunk);
-                  l-=MIN(l,chunk);
-                }
-                if(st>0) st=0;
-                if(st == 0) CONSOLE(&conlog, "%s() FILE '%s' [%d] WRITTEN\n", __FUNCTION__, name, len);
-                else CONSOLE(&conlog, "ERROR %s() lfs_file_write() error: %d\n", __FUNCTION__, st);
-                lfs_file_close(&lfs, &fp);
-                if(st!=0) lfs_remove(&lfs, name);
-              }
-              else CONSOLE(&conlog, "ERROR %s() lfs_file_opencfg() error: %d\n", __FUNCTION__, st);
-              current_file_id=INVALID_ID;
-              draw_update(1,1);
-            }
-            else CONSOLE(&conlog, "ERROR %s() read error '%s'\n", __FUNCTION__, path);
-            fclose(f);
-            free(data);
+          st = SIM_CALL("write", MIN(l,chunk), lfs_file_write(&lfs, fp, p, MIN(l,chunk)));
+          p+=MIN(l,chunk);
+          l-=MIN(l,chunk);
         }
-        else CONSOLE(&conlog, "ERROR %s() file '%s' not found\n", __FUNCTION__, path);
+        if(st>0) st=0;
+        if(st == 0) CONSOLE(&conlog, "%s() FILE '%s' [%d] WRITTEN%s\n", __FUNCTION__, name, len, (keep_open ? ", LEFT OPEN" : ""));
+        else CONSOLE(&conlog, "ERROR %s() lfs_file_write() error: %d\n", __FUNCTION__, st);
+        if(st == 0 && keep_open) open_fp_used=1;
+        else (void)SIM_CALL("close", 0, lfs_file_close(&lfs, fp));
+        if(st!=0) (void)SIM_CALL("delete", 0, lfs_remove(&lfs, name));
+      }
+      else CONSOLE(&conlog, "ERROR %s() lfs_file_opencfg() error: %d\n", __FUNCTION__, st);
+      current_file_id=INVALID_ID;
+      draw_update(1,1);
+      free(data);
     }
-    else CONSOLE(&conlog, "ERROR %s() path too long\n", __FUNCTION__);
 
     if(!quit) lua_pushinteger(L, st);
     
     return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+// verify(name [, len]) reads back the file in varying chunks
 static int l_verify(lua_State *L)
 {
     const int chunk[]={ 10, 3, 128, 512, 101, 7, -1 };
     const char *name = luaL_checkstring(L, 1);
-    char path[PATH_MAX];
     uint8_t *data, *data2;
     int st=-1;
+    int len;
 
     draw_update(0,0);
 
-    strcpy(path, test_dir);
-    int len = strlen(path);
-    if(len + 1 + strlen(name) < PATH_MAX)
+    len = flash_payload(&conlog, test_dir, name, luaL_optinteger(L, 2, -1), &data);
+    if(len >= 0)
     {
-        strcat(path, "/");
-        strcat(path, name);
-        FILE *f = fopen(path, "rb");
-        if(NULL != f)
+        lfs_file_t fp;
+        draw_update(0,0);
+        data2 = calloc(len+1,1);
+        uint8_t filebuf[LITTLEFS_CACHE_SIZE];
+        struct lfs_file_config cfg = { .buffer = filebuf };
+        st = SIM_CALL("open", 0, lfs_file_opencfg(&lfs, &fp, name, LFS_O_RDONLY, &cfg));
+        if(st == 0)
         {
-            fseek(f, 0, SEEK_END);
-            len = ftell(f);
-            fseek(f, 0, SEEK_SET);
-            data = calloc(len,1);
-            if(len == fread(data, 1, len, f))
+            int ci, cl, j, i;
+            for(ci=j=0; j<len ;++ci)
             {
-                lfs_file_t fp;
-                draw_update(0,0);
-                data2 = calloc(len,1);
-                uint8_t filebuf[LITTLEFS_CACHE_SIZE];
-                struct lfs_file_config cfg = { .buffer = filebuf };
-                st = lfs_file_opencfg(&lfs, &fp, name, LFS_O_RDONLY, &cfg);
-                if(st == 0)
+                if( chunk[ci] < 0 ) ci = 0;
+                cl = MIN( chunk[ci], len);
+                st = SIM_CALL("read", cl, lfs_file_read(&lfs, &fp, data2, cl));
+                if(st >= 0)
                 {
-                    int ci, cl, j, i;
-                    for(ci=j=0; j<len ;++ci)
-                    {
-                        if( chunk[ci] < 0 ) ci = 0;
-                        cl = MIN( chunk[ci], len);
-                        st = lfs_file_read(&lfs, &fp, data2, cl);
-                        if(st >= 0)
-                        {
-                            for(i=0;i<st;i++,j++) if(data[j]!=data2[i]) break;
-                            if(i<st) break;
-                        }
-                        else CONSOLE(&conlog, "ERROR %s() lfs_file_read() error: %d\n", __FUNCTION__, st);
-                    }
-                    if(j>=len) { st=0; CONSOLE(&conlog, "%s() '%s' VERIFIED OK\n", __FUNCTION__, name); }
-                    else { st=-1; CONSOLE(&conlog, "ERROR %s() '%s' differ at char %d\n", __FUNCTION__, name, j); }
-                    lfs_file_close(&lfs, &fp);
+                    for(i=0;i<st;i++,j++) if(data[j]!=data2[i]) break;
+                    if(i<st) break;
                 }
-                else CONSOLE(&conlog, "ERROR %s() lfs_file_opencfg() error: %d\n", __FUNCTION__, st);
-                draw_update(1,0);
-                free(data2);
+                else CONSOLE(&conlog, "ERROR %s() lfs_file_read() error: %d\n", __FUNCTION__, st);
             }
-            else CONSOLE(&conlog, "ERROR %s() read error '%s'\n", __FUNCTION__, path);
-            free(data);
-            fclose(f);
+            if(j>=len) { st=0; CONSOLE(&conlog, "%s() '%s' VERIFIED OK\n", __FUNCTION__, name); }
+            else { st=-1; CONSOLE(&conlog, "ERROR %s() '%s' differ at char %d\n", __FUNCTION__, name, j); }
+            (void)SIM_CALL("close", 0, lfs_file_close(&lfs, &fp));
         }
-        else CONSOLE(&conlog, "ERROR %s() file '%s' not found\n", __FUNCTION__, path);
+        else CONSOLE(&conlog, "ERROR %s() lfs_file_opencfg() error: %d\n", __FUNCTION__, st);
+        draw_update(1,0);
+        free(data2);
+        free(data);
     }
-    else CONSOLE(&conlog, "ERROR %s() path too long\n", __FUNCTION__);
 
     if(!quit) lua_pushinteger(L, st);
 
@@ -654,8 +664,8 @@ static int l_badblock(lua_State *L)
 {
     int isbad = lua_isboolean(L, 1);
     if (!isbad) return(luaL_error(L, "expected boolean"));
-    badblock = !!lua_toboolean(L, 1);
-    CONSOLE(&conlog,"%s() BADBLOCK SIMULATION %s\n",__FUNCTION__, (badblock?"ENABLED":"DISABLED"));
+    sim.badblock = !!lua_toboolean(L, 1);
+    CONSOLE(&conlog,"%s() BADBLOCK SIMULATION %s\n",__FUNCTION__, (sim.badblock?"ENABLED":"DISABLED"));
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
@@ -663,7 +673,7 @@ static int l_delete(lua_State *L)
 {
     const char *name = luaL_checkstring(L, 1);
 
-    int st = lfs_remove(&lfs, name);
+    int st = SIM_CALL("delete", 0, lfs_remove(&lfs, name));
     CONSOLE(&conlog, "%s() '%s' st=%d\n", __FUNCTION__, name, st);
     file_cache(name,0);
     draw_update(1,1);
@@ -671,17 +681,289 @@ static int l_delete(lua_State *L)
     return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+static int l_delete_many(lua_State *L)
+{
+    int i, n, st, cnt = 0;
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = (int)lua_rawlen(L, 1);
+    for(i = 0; i < n; i++)
+    {
+        lua_rawgeti(L, 1, i + 1);
+        const char *name = luaL_checkstring(L, -1);
+        st = SIM_CALL("delete", 0, lfs_remove(&lfs, name));
+        if(st == 0) cnt++;
+        file_cache(name,0);
+        lua_pop(L, 1);
+    }
+    CONSOLE(&conlog, "%s() %d files st=%d\n", __FUNCTION__, n, cnt);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, cnt);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// close() closes the file left open by write(..., true)
+static int l_close(lua_State *L)
+{
+    int st = -1;
+
+    if(open_fp_used)
+    {
+        st = SIM_CALL("close", 0, lfs_file_close(&lfs, &open_fp));
+        open_fp_used = 0;
+    }
+    CONSOLE(&conlog, "%s() st=%d\n", __FUNCTION__, st);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, st);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// delete_if(function(name, len)) removes the files of the root directory the function returns true for
+static int l_delete_if(lua_State *L)
+{
+    struct lfs_info info;
+    char *names[sizeof(files)/sizeof(files[0])];
+    lfs_dir_t dir;
+    int i, n = 0, st, cnt = 0;
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    st = lfs_dir_open(&lfs, &dir, "/");
+    while(st == 0 && n < (int)(sizeof(names)/sizeof(names[0])) && lfs_dir_read(&lfs, &dir, &info) > 0)
+    {
+        if(info.type != LFS_TYPE_REG) continue;
+        lua_pushvalue(L, 1);
+        lua_pushstring(L, info.name);
+        lua_pushinteger(L, info.size);
+        lua_call(L, 2, 1);
+        if(lua_toboolean(L, -1)) names[n++] = strdup(info.name);
+        lua_pop(L, 1);
+    }
+    if(st == 0) lfs_dir_close(&lfs, &dir);
+    for(i = 0; i < n; i++)
+    {
+        if(SIM_CALL("delete", 0, lfs_remove(&lfs, names[i])) == 0) cnt++;
+        file_cache(names[i],0);
+        free(names[i]);
+    }
+    CONSOLE(&conlog, "%s() st=%d\n", __FUNCTION__, cnt);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, cnt);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// erase_async([max_sectors [, max_us]]) -> st, no budget in LittleFS, gc is called max_sectors times
 static int l_erase_async(lua_State *L)
 {
-  int st;
+  int st = 0;
+  int n = (int)luaL_optinteger(L, 1, 1);
   
-  st = lfs_fs_gc(&lfs);
+  while(n-- > 0 && st == 0) st = SIM_CALL("erase", 1, lfs_fs_gc(&lfs));
   CONSOLE(&conlog, "%s() st=%d\n", __FUNCTION__, st);
   draw_update(1,1);
   if(!quit) lua_pushinteger(L, st);
   return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+// erase_suspend(enable) LittleFS erases in the foreground, nothing to suspend
+static int l_erase_suspend(lua_State *L)
+{
+  return(0);
+}
+
+// flash_queue(enable) LittleFS uses its own synchronous block device callbacks
+static int l_flash_queue(lua_State *L)
+{
+  return(0);
+}
+
+// poll_mode(enable [, budget_us]) LittleFS has no non-blocking API
+static int l_poll_mode(lua_State *L)
+{
+  return(0);
+}
+
+// sleep_policy(idle_us [, erase_first]) LittleFS has no power management, the flash stays in standby
+static int l_sleep_policy(lua_State *L)
+{
+  return(0);
+}
+
+// the simulation clock runs without file operations
+static void sim_idle(double us)
+{
+  sim_cpu_charge();
+  flash_timeline_begin(&sim, "idle", (long)us);
+  flash_sleep(us);
+  flash_cpu_until(&sim, sim.clock_us + us, FLASH_CPU_IDLE);
+  flash_timeline_end(&sim, 0);
+}
+
+// idle(us) let the simulation clock run without file operations
+static int l_idle(lua_State *L)
+{
+  sim_idle((double)luaL_checkinteger(L, 1));
+  if(quit) return(luaL_error(L, "Interrupted"));
+  return(0);
+}
+
+// format() erase the filesystem and mount it again, returns the status
+static int l_format(lua_State *L)
+{
+  int st;
+
+  lfs_unmount(&lfs);
+  st=lfs_format(&lfs, &lfs_cfg);
+  if(0==st) st=lfs_mount(&lfs, &lfs_cfg);
+  CONSOLE(&conlog, "%s() st=%d\n", __FUNCTION__, st);
+  lua_pushinteger(L, st);
+  return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// reset() mounts the filesystem again like after a power cycle, the open file is lost
+static int l_reset(lua_State *L)
+{
+  int st;
+
+  open_fp_used=0;
+  lfs_unmount(&lfs);
+  st=lfs_mount(&lfs, &lfs_cfg);
+  CONSOLE(&conlog, "%s() st=%d\n", __FUNCTION__, st);
+  lua_pushinteger(L, st);
+  return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// workload trace of the data directory (zerofs_trace.h) with synthetic payloads, LittleFS has no modes
+// and the batch deletes are single removes, returns the records or -1 if the trace is broken
+static int sim_replay(const char *dir, const char *name, int *errors)
+{
+    static uint8_t filebuf[ZEROFS_TRACE_SLOTS][LITTLEFS_CACHE_SIZE];
+    struct zerofs_trace_rec rec;
+    lfs_file_t fp[ZEROFS_TRACE_SLOTS];
+    uint8_t open[ZEROFS_TRACE_SLOTS];
+    char fname[ZEROFS_TRACE_SLOTS][ZEROFS_TRACE_NAME_MAX+1];
+    uint8_t *trace, *data;
+    uint32_t pos;
+    int len, st = 0, r = 0, n = 0;
+
+    *errors = 0;
+    len = flash_payload(&conlog, dir, name, -1, &trace);
+    if(len < 0) return(-1);
+    if(zerofs_trace_header(trace, len, &pos) < 0)
+    {
+        CONSOLE(&conlog, "ERROR %s() '%s' is not a trace\n", __FUNCTION__, name);
+        free(trace);
+        return(-1);
+    }
+    memset(fname, 0, sizeof(fname));
+    memset(open, 0, sizeof(open));
+
+    while(!quit && (r = zerofs_trace_next(trace, len, &pos, &rec)) > 0)
+    {
+        struct lfs_file_config cfg = { .buffer = filebuf[rec.fd] };
+        n++;
+        // zerofs files can be left open after an error and used without a successful open, LittleFS asserts
+        if(open[rec.fd] && (rec.op == ZEROFS_TRACE_CREATE || rec.op == ZEROFS_TRACE_APPEND || rec.op == ZEROFS_TRACE_OPEN))
+        {
+            lfs_file_close(&lfs, &fp[rec.fd]);
+            open[rec.fd] = 0;
+        }
+        if(!open[rec.fd] && (rec.op == ZEROFS_TRACE_CLOSE || rec.op == ZEROFS_TRACE_WRITE || rec.op == ZEROFS_TRACE_READ || rec.op == ZEROFS_TRACE_SEEK)) st = LFS_ERR_BADF;
+        else switch(rec.op)
+        {
+            case ZEROFS_TRACE_CREATE:
+                strcpy(fname[rec.fd], rec.name);
+                (void)SIM_CALL("delete", 0, lfs_remove(&lfs, rec.name));
+                file_cache(rec.name,0);
+                current_file_id=file_cache(rec.name,1);
+                st = SIM_CALL("create", 0, lfs_file_opencfg(&lfs, &fp[rec.fd], rec.name, LFS_O_RDWR | LFS_O_CREAT, &cfg));
+                open[rec.fd] = (st >= 0);
+                break;
+            case ZEROFS_TRACE_APPEND:
+                strcpy(fname[rec.fd], rec.name);
+                current_file_id=file_find(rec.name);
+                if(current_file_id<0) current_file_id=file_cache(rec.name,1);
+                st = SIM_CALL("append", 0, lfs_file_opencfg(&lfs, &fp[rec.fd], rec.name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND, &cfg));
+                open[rec.fd] = (st >= 0);
+                break;
+            case ZEROFS_TRACE_OPEN:
+                strcpy(fname[rec.fd], rec.name);
+                st = SIM_CALL("open", 0, lfs_file_opencfg(&lfs, &fp[rec.fd], rec.name, LFS_O_RDONLY, &cfg));
+                open[rec.fd] = (st >= 0);
+                break;
+            case ZEROFS_TRACE_CLOSE:
+                st = SIM_CALL("close", 0, lfs_file_close(&lfs, &fp[rec.fd]));
+                open[rec.fd] = 0;
+                current_file_id=INVALID_ID;
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_WRITE:
+                flash_payload(&conlog, NULL, fname[rec.fd], rec.arg, &data);
+                st = SIM_CALL("write", rec.arg, lfs_file_write(&lfs, &fp[rec.fd], data, rec.arg));
+                free(data);
+                break;
+            case ZEROFS_TRACE_READ:
+                data = malloc(MAX(rec.arg, 1));
+                st = SIM_CALL("read", rec.arg, lfs_file_read(&lfs, &fp[rec.fd], data, rec.arg));
+                free(data);
+                break;
+            case ZEROFS_TRACE_SEEK:
+                // negative positions are from the end like in zerofs
+                st = SIM_CALL("seek", (int32_t)rec.arg, lfs_file_seek(&lfs, &fp[rec.fd], (int32_t)rec.arg, ((int32_t)rec.arg < 0 ? LFS_SEEK_END : LFS_SEEK_SET)));
+                break;
+            case ZEROFS_TRACE_DELETE:
+                st = SIM_CALL("delete", 0, lfs_remove(&lfs, rec.name));
+                file_cache(rec.name,0);
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_DELETE_MANY:
+            case ZEROFS_TRACE_MODE:
+                st = 0;
+                break;
+            case ZEROFS_TRACE_ERASE:
+                st = 0;
+                for(uint32_t i = 0; i < rec.arg && st == 0; i++) st = SIM_CALL("erase", 1, lfs_fs_gc(&lfs));
+                break;
+            case ZEROFS_TRACE_IDLE:
+                sim_idle(rec.arg);
+                st = 0;
+                break;
+        }
+        sim_cpu_charge();
+        if(st < 0)
+        {
+            (*errors)++;
+            CONSOLE(&conlog, "ERROR %s() record %d op %d '%s' st=%d\n", __FUNCTION__, n, rec.op, (rec.name[0] ? rec.name : fname[rec.fd]), st);
+        }
+    }
+    for(int i = 0; i < ZEROFS_TRACE_SLOTS; i++) if(open[i]) lfs_file_close(&lfs, &fp[i]);
+    current_file_id=INVALID_ID;
+    if(r < 0) CONSOLE(&conlog, "ERROR %s() '%s' broken record at %u\n", __FUNCTION__, name, pos);
+    CONSOLE(&conlog, "%s() '%s' records=%d errors=%d\n", __FUNCTION__, name, n, *errors);
+    free(trace);
+    return(r < 0 ? -1 : n);
+}
+
+// replay(trace) runs a workload trace of the data directory -> st, failed calls
+static int l_replay(lua_State *L)
+{
+  int errors;
+  int n = sim_replay(test_dir, luaL_checkstring(L, 1), &errors);
+
+  if(quit) return(luaL_error(L, "Interrupted"));
+  lua_pushinteger(L, (n < 0 ? -1 : 0));
+  lua_pushinteger(L, errors);
+  return(2);
+}
+
+// seed(default) the seed of the workload, the LittleFS runner simulates a single device with seed 0
+static int l_seed(lua_State *L)
+{
+  lua_Integer seed = luaL_checkinteger(L, 1);
+
+  lua_pushinteger(L, seed + (lua_Integer)sim.seed);
+  return(1);
+}
+
 void l_warn(void *ud, const char *msg, int tocont)
 {
   lua_State *L=ud;
@@ -715,6 +997,9 @@ static int luaopen_littlefslib(lua_State *L)
         { "setmode", l_setmode },
         { "printdebug", l_printdebug },
         { "delete", l_delete },
+        { "delete_many", l_delete_many },
+        { "delete_if", l_delete_if },
+        { "close", l_close },
         { "speed", l_speed },
         { "setdir", l_setdir },
         { "setstep", l_setstep },
@@ -722,7 +1007,16 @@ static int luaopen_littlefslib(lua_State *L)
         { "assert", l_assert },
         { "badblock", l_badblock },
         { "erase_async", l_erase_async },
+        { "erase_suspend", l_erase_suspend },
+        { "sleep_policy", l_sleep_policy },
+        { "flash_queue", l_flash_queue },
+        { "poll_mode", l_poll_mode },
+        { "idle", l_idle },
+        { "format", l_format },
+        { "reset", l_reset },
         { "dir", l_dir },
+        { "seed", l_seed },
+        { "replay", l_replay },
         { NULL, NULL }
     };
     luaL_newlib(L, funcs);
@@ -748,15 +1042,46 @@ static lua_State *luainit(void)
 int main(int argc, char **argv)
 {
     volatile int stack_marker;
-    if(argc < 2)
+    struct timespec host_t0, host_t1;
+    const char *flash_profile = NULL, *cpu_profile = NULL, *timeline = NULL;
+    double run_days = 0.0;
+    int argi = 1;
+    int st = 0;
+
+    flash_sim_init(&sim, &conlog, 0);
+    for(; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if(strcmp(argv[argi], "--headless") == 0) headless = 1;
+        else if(strcmp(argv[argi], "--flash") == 0 && argi + 1 < argc) flash_profile = argv[++argi];
+        else if(strcmp(argv[argi], "--cpu") == 0 && argi + 1 < argc) cpu_profile = argv[++argi];
+        else if(strcmp(argv[argi], "--days") == 0 && argi + 1 < argc) run_days = atof(argv[++argi]);
+        else if(strcmp(argv[argi], "--timeline") == 0 && argi + 1 < argc) timeline = argv[++argi];
+        else break;
+    }
+    if(argi != argc - 1)
     {
-        printf("Usage: %s testfile.lua\n", argv[0]);
+        printf("Usage: %s [--headless] [--flash profile] [--cpu profile] [--days d] [--timeline file.json] testfile.lua|trace\n", argv[0]);
         exit(0);
     }
+    char *script = argv[argi];
 
-    CONSOLE(&conlog, "\nTEST %s %s STARTED AT %ld\n",argv[0],argv[1],time(NULL));
+    // the part profile replaces the built-in timings, the littlefs geometry stays
+    if(NULL != flash_profile)
+    {
+        if(flash_prop_load(flash_profile, &fas[0].prop) < 0) return(1);
+        if(fas[0].prop.sector_size != flash_prop.sector_size || fas[0].prop.write_granularity != flash_prop.write_granularity)
+        {
+            fprintf(stderr, "profile %s has %d byte sectors and %d byte writes, littlefs uses %d and %d\n", flash_profile, fas[0].prop.sector_size, fas[0].prop.write_granularity, flash_prop.sector_size, flash_prop.write_granularity);
+            return(1);
+        }
+    }
+    if(NULL != cpu_profile && cpu_prop_load(cpu_profile, &sim.cpu) < 0) return(1);
+    if(NULL != timeline && flash_timeline_open(&sim) < 0) { fprintf(stderr, "cannot record the timeline\n"); return(1); }
+    clock_gettime(CLOCK_MONOTONIC, &host_t0);
 
-    char *bn = basename(argv[1]);
+    CONSOLE(&conlog, "\nTEST %s %s STARTED AT %ld\n",argv[0],script,time(NULL));
+
+    char *bn = basename(script);
     char *dot = strrchr(bn, '.');
     if(dot != NULL)
     {
@@ -777,49 +1102,85 @@ int main(int argc, char **argv)
 
     lua_State *L = luainit();
 
-    initscr();                  // Start ncurses mode
-    noecho();                   // Don't echo typed chars
-    curs_set(0);                // Hide the cursor
-    keypad(stdscr, TRUE);       // Enable arrow keys, etc.
-
-    use_default_colors();
-    if(has_colors())
+    if(!headless)
     {
-        start_color();
-        colors_supported=1;
-    }
+        initscr();                  // Start ncurses mode
+        noecho();                   // Don't echo typed chars
+        curs_set(0);                // Hide the cursor
+        keypad(stdscr, TRUE);       // Enable arrow keys, etc.
 
-    getmaxyx(stdscr, height, width);
+        use_default_colors();
+        if(has_colors())
+        {
+            start_color();
+            colors_supported=1;
+        }
+
+        getmaxyx(stdscr, height, width);
+    }
 
-    flash_area_open(FLASH_AREA_NFFS, (struct flash_area *)&fas[0], &fas[0]);
+    flash_area_open(&sim, FLASH_AREA_NFFS, (struct flash_area *)&fas[0], &fas[0]);
     lfs_format(&lfs, &lfs_cfg);
     fas[0].elapsed=0; // reset time measurement, we are not measuring the format part
     lfs_mount(&lfs, &lfs_cfg);
     
-    draw_init=1;
+    draw_init=!headless;
     draw_update(0,1);
 
-    if(luaL_dofile(L, argv[1]))
+    // workload traces run without a script
+    if(flash_is_trace(script))
+    {
+        int errors, n = sim_replay(NULL, script, &errors);
+        st = (n < 0);
+        if(headless) printf("replay trace=%s records=%d errors=%d\n", script, n, errors);
+    }
+    else if(luaL_dofile(L, script))
     {
         CONSOLE(&conlog, "lua error %s\n", lua_tostring(L, -1));
+        if(headless) printf("error=\"%s\"\n", lua_tostring(L, -1));
         lua_pop(L, 1);
+        st=1;
+    }
+    if(st)
+    {
         step_through=1;
         draw_update(1,1);
         quit=0;
+        if(headless) flash_area_summary(stdout, &fas[0]);
     }
     else
     {
+      sim_cpu_charge();
+      flash_report_timeline(fas, 1);
+      flash_report_lifetime((headless ? stdout : NULL), fas, 1, run_days);
+      if(headless) flash_area_summary(stdout, &fas[0]);
       flash_area_close(&fas[0]);
       CONSOLE(&conlog, "%s max stack=%ld\n", "TEST PASSED", 0L);
       step_through=1;
       draw_update(1,1);
     }
+    if(NULL != timeline)
+    {
+        int n = flash_timeline_export(&sim, timeline, "littlefs", fas, 1);
+        if(n < 0) fprintf(stderr, "cannot write %s\n", timeline);
+        else CONSOLE(&conlog, "timeline events=%d file=%s\n", n, timeline);
+        flash_timeline_close(&sim);
+    }
     l_printdebug(NULL);
 
-    curs_set(1);
-    echo();
+    if(headless)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &host_t1);
+        flash_cpu_summary(stdout, &sim);
+        printf("result=%s script=%s sim_clock_us=%.1f host_ms=%.1f\n", (st ? "FAILED" : "PASSED"), script, sim.clock_us, (host_t1.tv_sec - host_t0.tv_sec)*1e3 + (host_t1.tv_nsec - host_t0.tv_nsec)/1e6);
+    }
+    else
+    {
+        curs_set(1);
+        echo();
 
-    endwin();                   // Restore normal terminal behavior
+        endwin();                   // Restore normal terminal behavior
+    }
 
     lua_close(L);
 
@@ -829,5 +1190,5 @@ int main(int argc, char **argv)
     files_free();
     free(sector_map);
 
-    return(0);
+    return(headless ? st : 0);
 }
@@ -0,0 +1,27 @@
+-- BOYA BY25Q32ES 32 Mbit SPI NOR, the built-in data flash of the simulator
+-- typical datasheet times, the bus is the 8 MHz single line SPIM of the nRF52832
+return {
+  name = "BY25Q32ES",
+  sector_size = 4096,
+  write_granularity = 1,
+  page_size = 256,
+  t_sector_erase_us = 36000,
+  t_block_erase_us = { [32768] = 112000, [65536] = 160000 },
+  t_chip_erase_us = 12000000,
+  t_page_program_us = 600,
+  t_byte_first_us = 30,
+  t_byte_us = 2.5,
+  spi_mhz = 8,
+  spi_lines = 1,
+  addr_bytes = 3,
+  addr_lines = 1,
+  dummy_cycles = 0,
+  t_cs_us = 2,
+  lifecycle = 100000,
+  t_suspend_us = 30,
+  t_resume_us = 100,
+  t_wake_us = 30,
+  i_active_ua = 12000,
+  i_standby_ua = 10,
+  i_dpd_ua = 1,
+}
@@ -0,0 +1,9 @@
+-- Cortex-M0 at 16 MHz (nRF51822), no cache, the flash wait states slow the loops
+return {
+  name = "Cortex-M0 16 MHz",
+  mhz = 16,
+  map_probe_cycles = 8,
+  nm_probe_cycles = 36,
+  copy_byte_cycles = 3,
+  crc_byte_cycles = 20,
+}
@@ -0,0 +1,9 @@
+-- Cortex-M33 at 128 MHz (nRF5340 application core)
+return {
+  name = "Cortex-M33 128 MHz",
+  mhz = 128,
+  map_probe_cycles = 4,
+  nm_probe_cycles = 16,
+  copy_byte_cycles = 0.5,
+  crc_byte_cycles = 10,
+}
@@ -0,0 +1,10 @@
+-- Cortex-M4 at 64 MHz (nRF52832), the built-in cpu of the simulator
+-- byte loops from the cached flash, nibble table crc32 of littlefs
+return {
+  name = "Cortex-M4 64 MHz",
+  mhz = 64,
+  map_probe_cycles = 5,
+  nm_probe_cycles = 20,
+  copy_byte_cycles = 1,
+  crc_byte_cycles = 12,
+}
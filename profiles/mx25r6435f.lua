@@ -0,0 +1,27 @@
+-- Macronix MX25R6435F 64 Mbit ultra low power SPI NOR in low power mode,
+-- typical datasheet times on an 8 MHz single line bus, slower erase and program for a low supply current
+return {
+  name = "MX25R6435F",
+  sector_size = 4096,
+  write_granularity = 1,
+  page_size = 256,
+  t_sector_erase_us = 40000,
+  t_block_erase_us = { [32768] = 240000, [65536] = 480000 },
+  t_chip_erase_us = 50000000,
+  t_page_program_us = 3200,
+  t_byte_first_us = 100,
+  t_byte_us = 12,
+  spi_mhz = 8,
+  spi_lines = 1,
+  addr_bytes = 3,
+  addr_lines = 1,
+  dummy_cycles = 0,
+  t_cs_us = 2,
+  lifecycle = 100000,
+  t_suspend_us = 60,
+  t_resume_us = 100,
+  t_wake_us = 35,
+  i_active_ua = 3000,
+  i_standby_ua = 2,
+  i_dpd_ua = 0.007,
+}
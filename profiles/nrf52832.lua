@@ -0,0 +1,14 @@
+-- nRF52832 internal flash, the built-in superblock flash of the simulator
+-- the cpu halts during program and erase, 32 bit words are programmed
+return {
+  name = "nRF52832",
+  sector_size = 4096,
+  write_granularity = 4,
+  page_size = 4,
+  t_sector_erase_us = 80000,
+  t_page_program_us = 67.5 / 4 * 4096,
+  t_byte_first_us = 67.5 / 4,
+  t_byte_us = 67.5 / 4,
+  t_comm_byte_us = 0,
+  lifecycle = 10000,
+}
@@ -0,0 +1,13 @@
+-- nRF52840 internal flash, the cpu halts during program and erase, 32 bit words are programmed
+return {
+  name = "nRF52840",
+  sector_size = 4096,
+  write_granularity = 4,
+  page_size = 4,
+  t_sector_erase_us = 85000,
+  t_page_program_us = 41 / 4 * 4096,
+  t_byte_first_us = 41 / 4,
+  t_byte_us = 41 / 4,
+  t_comm_byte_us = 0,
+  lifecycle = 10000,
+}
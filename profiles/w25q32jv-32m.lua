@@ -0,0 +1,10 @@
+-- Winbond W25Q32JV on a 32 MHz quad bus (nRF52840 QSPI), 1-4-4 fast read with 6 mode and dummy cycles
+-- and 1-1-4 quad page program
+local p = dofile("profiles/w25q32jv.lua")
+p.name = "W25Q32JV 32 MHz quad"
+p.spi_mhz = 32
+p.spi_lines = 4
+p.addr_lines = 4
+p.dummy_cycles = 6
+p.t_cs_us = 0.5
+return p
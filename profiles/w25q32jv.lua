@@ -0,0 +1,26 @@
+-- Winbond W25Q32JV 32 Mbit SPI NOR, typical datasheet times on an 8 MHz single line bus
+return {
+  name = "W25Q32JV",
+  sector_size = 4096,
+  write_granularity = 1,
+  page_size = 256,
+  t_sector_erase_us = 45000,
+  t_block_erase_us = { [32768] = 120000, [65536] = 150000 },
+  t_chip_erase_us = 10000000,
+  t_page_program_us = 400,
+  t_byte_first_us = 30,
+  t_byte_us = 2.5,
+  spi_mhz = 8,
+  spi_lines = 1,
+  addr_bytes = 3,
+  addr_lines = 1,
+  dummy_cycles = 0,
+  t_cs_us = 2,
+  lifecycle = 100000,
+  t_suspend_us = 20,
+  t_resume_us = 20,
+  t_wake_us = 3,
+  i_active_ua = 20000,
+  i_standby_ua = 10,
+  i_dpd_ua = 1,
+}
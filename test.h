@@ -39,7 +39,7 @@
 
 
 extern double simulation_factor;
-extern int badblock;
+extern int headless;            // no terminal and no real-time waits, the summary goes to stdout
 
 void draw_update(int wait, int umap);
 
@@ -53,6 +53,7 @@ struct console
 
 extern struct console conlog;
 
-#define CONSOLE(c,f,a...) do { int _l=snprintf(NULL,0,f,a); if((c)->line[(c)->pos]!=NULL) free((c)->line[(c)->pos]); (c)->line[(c)->pos]=malloc(_l+1); sprintf((c)->line[(c)->pos],f,a); if(++(c)->pos>=ARRAY_SIZE((c)->line)) { (c)->pos=0; } (c)->disp=(c)->pos; } while(0)
+// c is NULL for devices without a log
+#define CONSOLE(c,f,a...) do { if(NULL==(c)) break; int _l=snprintf(NULL,0,f,a); if((c)->line[(c)->pos]!=NULL) free((c)->line[(c)->pos]); (c)->line[(c)->pos]=malloc(_l+1); sprintf((c)->line[(c)->pos],f,a); if(++(c)->pos>=ARRAY_SIZE((c)->line)) { (c)->pos=0; } (c)->disp=(c)->pos; } while(0)
 
 #endif
@@ -4,12 +4,21 @@ local m = require('fstest')
 local TEST_DIR = "data"
 local SIZES = require("testfilesizes")
 local FILES = {};
-local ITERATIONS = 160
+local CFG = TEST2 or {}     -- settings of the test2*.lua variants
+local ITERATIONS = CFG.ITERATIONS or 160
 local CHUNK_SIZE = 510
 local SPEED_FACTOR = 0
 local DELAY_MS = 0
 local DELETE_RATIO = 0.45   -- fraction of existing files to delete when full
 local SEED = 5820;
+local ERASE_BUDGET = CFG.ERASE_BUDGET       -- sectors of one budgeted m.erase_async() call, nil is three single-sector calls
+local ERASE_SUSPEND = CFG.ERASE_SUSPEND or false -- reads suspend the background erase
+local IDLE_US = CFG.IDLE_US or 0            -- idle time between reads in the verify phase
+local SLEEP_IDLE_US = CFG.SLEEP_IDLE_US or 0 -- power down the flash after this idle time, 0 is never
+local SLEEP_ERASE = CFG.SLEEP_ERASE or false -- finish the background erase before powering down
+local FLASH_QUEUE = CFG.FLASH_QUEUE or false -- v2 queue flash driver instead of the synchronous callbacks
+local POLL_MODE = CFG.POLL_MODE or false -- non-blocking zerofs_poll() API for the file operations
+local DELETE_MANY = CFG.DELETE_MANY or false -- delete the victims with one m.delete_many() call
 -- ----------------------------------------------------------------
 
 m.badblock(false)
@@ -19,6 +28,10 @@ math.randomseed(SEED)
 m.setdir(TEST_DIR)
 m.speed(SPEED_FACTOR, DELAY_MS)
 m.setstep(false)
+if ERASE_SUSPEND then m.erase_suspend(true) end
+if SLEEP_IDLE_US > 0 then m.sleep_policy(SLEEP_IDLE_US, SLEEP_ERASE) end
+if FLASH_QUEUE then m.flash_queue(true) end
+if POLL_MODE then m.poll_mode(true) end
 
 for _, s in ipairs(SIZES) do FILES[s]="f" .. s .. ".csv" end
 
@@ -83,9 +96,10 @@ for iter = 1, ITERATIONS do
 
     for _, f in ipairs(victims) do
       warn("Removing " .. f .. " to free space")
-      m.delete(f);
+      if not DELETE_MANY then m.delete(f); end
       state[f] = "deleted"
     end
+    if DELETE_MANY then m.delete_many(victims); end
   end
 
   -- VERIFY PHASE -------------------------------------------------
@@ -95,9 +109,14 @@ for iter = 1, ITERATIONS do
     f=FILES[s]
     if state[f] == "good" then
       local res = m.verify(f)
-      m.erase_async();
-      m.erase_async();
-      m.erase_async();
+      if ERASE_BUDGET then
+        m.erase_async(ERASE_BUDGET);
+      else
+        m.erase_async();
+        m.erase_async();
+        m.erase_async();
+      end
+      if IDLE_US > 0 then m.idle(IDLE_US) end
       if res ~= 0 then
         m.assert("Verification failed for " .. f .. " (code " .. res .. ")")
       end
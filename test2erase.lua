@@ -0,0 +1,3 @@
+-- test2.lua with the budgeted background erase, erase suspend, idle time and the sleep policy
+TEST2 = { ERASE_BUDGET = 3, ERASE_SUSPEND = true, IDLE_US = 50000, SLEEP_IDLE_US = 20000, SLEEP_ERASE = true }
+dofile("test2.lua")
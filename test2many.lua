@@ -0,0 +1,3 @@
+-- test2.lua deleting the victims of an iteration with one m.delete_many() call
+TEST2 = { DELETE_MANY = true }
+dofile("test2.lua")
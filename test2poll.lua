@@ -0,0 +1,3 @@
+-- test2.lua with the queue flash driver and the non-blocking zerofs_poll() API for the file operations
+TEST2 = { FLASH_QUEUE = true, POLL_MODE = true }
+dofile("test2.lua")
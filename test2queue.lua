@@ -0,0 +1,3 @@
+-- test2.lua with the v2 queue flash driver instead of the synchronous callbacks
+TEST2 = { FLASH_QUEUE = true }
+dofile("test2.lua")
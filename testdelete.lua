@@ -0,0 +1,37 @@
+local m = require('fstest');
+
+-- batch deletes skip the files that are still being written
+local chunk = 100000;
+local files = { "frog.qla", "swim.qla", "zerofs.qli" };
+local seen_open = false;
+
+m.speed(0,0);
+m.setdir("data");
+m.setstep(false);
+m.badblock(false)
+
+m.setmode("write");
+for _, f in ipairs(files) do
+  st=m.write(f, chunk);
+  if (st~=0) then m.assert("write " .. f); end
+end
+st=m.write("bench.qla", chunk, -1, true);
+if (st~=0) then m.assert("write bench.qla"); end
+
+st=m.delete_if(function(name, len)
+  if (name=="bench.qla") then seen_open=true; end
+  return true;
+end);
+if (seen_open) then m.assert("delete_if passed the open file"); end
+if (st~=#files) then m.assert("delete_if deleted " .. st .. " files"); end
+st=m.close();
+if (st~=0) then m.assert("close bench.qla"); end
+
+m.setmode("read");
+for _, f in ipairs(files) do
+  st=m.verify(f);
+  if (st==0) then m.assert("delete_if left " .. f); end
+end
+st=m.verify("bench.qla");
+if (st~=0) then m.assert("verify bench.qla"); end
+m.dir();
@@ -0,0 +1,46 @@
+local m = require('fstest');
+
+-- budgeted background erase with its report, reads suspending the erase and the sleep policy
+local chunk = 100000;
+local files = { "frog.qla", "swim.qla", "zerofs.qli", "homework.qla" };
+
+m.speed(0,0);
+m.setdir("data");
+m.setstep(false);
+m.badblock(false)
+m.erase_suspend(true);
+m.sleep_policy(20000, true);
+
+m.setmode("write");
+for _, f in ipairs(files) do
+  st=m.write(f, chunk);
+  if (st~=0) then m.assert("write " .. f); end
+end
+m.delete("frog.qla");
+m.delete("homework.qla");
+m.setmode("read");
+
+-- report only, nothing is erased
+st, erased, ready, remaining = m.erase_async(0);
+if (st~=0 or erased~=0) then m.assert("report only call erased " .. erased); end
+if (remaining==0) then m.assert("nothing to erase"); end
+
+-- EMPTY sectors sharing an erase block with data stay in remaining
+repeat
+  local before = remaining;
+  st, erased, ready, remaining = m.erase_async(2);
+  if (st~=0) then m.assert("erase_async " .. st); end
+  if (erased>2) then m.assert("erased " .. erased .. " of a budget of 2"); end
+  if (remaining>before) then m.assert("remaining " .. remaining .. " above " .. before); end
+  -- the reads suspend the erase in flight
+  for _, f in ipairs({ "swim.qla", "zerofs.qli" }) do
+    st=m.verify(f);
+    if (st~=0) then m.assert("verify " .. f); end
+  end
+  m.idle(50000);
+until (erased==0)
+
+-- a time budget below one erase erases nothing
+st, erased, ready, remaining = m.erase_async(100, 1);
+if (erased~=0) then m.assert("erased " .. erased .. " in 1 us"); end
+m.dir();
@@ -0,0 +1,38 @@
+local m = require('fstest');
+
+-- the superblock driver completes its operations only when polled, the superblock
+-- must not be read before the operations of zerofs_format() are done
+local chunk = 100000;
+local files = { "frog.qla", "swim.qla", "zerofs.qli" };
+
+m.speed(0,0);
+m.setdir("data");
+m.setstep(false);
+m.badblock(false)
+m.flash_queue(true, true);
+
+m.setmode("write");
+for _, f in ipairs(files) do
+  st=m.write(f, chunk);
+  if (st~=0) then m.assert("write " .. f); end
+end
+m.setmode("read");
+for _, f in ipairs(files) do
+  st=m.verify(f);
+  if (st~=0) then m.assert("verify " .. f); end
+end
+
+st=m.format();
+if (st~=0) then m.assert("format"); end
+for _, f in ipairs(files) do
+  st=m.verify(f);
+  if (st==0) then m.assert("format left " .. f); end
+end
+
+m.setmode("write");
+st=m.write("bench.qla", chunk);
+if (st~=0) then m.assert("write bench.qla"); end
+m.setmode("read");
+st=m.verify("bench.qla");
+if (st~=0) then m.assert("verify bench.qla"); end
+m.dir();
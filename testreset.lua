@@ -0,0 +1,51 @@
+local m = require('fstest');
+
+-- the background erase progress survives a reset only for the erases that finished,
+-- and a WRITE session interrupted by a reset voids it
+local chunk = 100000;
+local files = { "frog.qla", "swim.qla", "zerofs.qli", "homework.qla", "bench.qla" };
+
+m.speed(0,0);
+m.setdir("data");
+m.setstep(false);
+m.badblock(false)
+m.erase_suspend(true);
+
+m.setmode("write");
+for _, f in ipairs(files) do
+  st=m.write(f, chunk);
+  if (st~=0) then m.assert("write " .. f); end
+end
+for _, f in ipairs(files) do m.delete(f); end
+m.setmode("read");
+st, erased, ready0, remaining = m.erase_async(0);
+if (remaining<64) then m.assert("only " .. remaining .. " sectors to erase"); end
+
+-- the erases are still running at the reset
+st, erased = m.erase_async(64);
+if (erased==0) then m.assert("nothing erased"); end
+m.reset();
+st, erased, ready = m.erase_async(0);
+if (ready~=ready0) then m.assert("erases in flight persisted: " .. ready .. " ready, " .. ready0 .. " before"); end
+
+-- finished erases are persisted by the next call
+repeat
+  st, erased = m.erase_async(16);
+  m.idle(1000000);
+until (erased==0)
+st, erased, ready_all = m.erase_async(0);
+m.reset();
+st, erased, ready = m.erase_async(0);
+if (ready~=ready_all) then m.assert("erase log lost: " .. ready .. " ready, " .. ready_all .. " before"); end
+
+-- a WRITE session may use the erased sectors, they are not erased after its reset
+m.setmode("write");
+st=m.write("swim.qla", chunk);
+if (st~=0) then m.assert("write swim.qla"); end
+m.reset();
+st, erased, ready = m.erase_async(0);
+if (ready~=ready0) then m.assert("erase log kept over a WRITE session: " .. ready .. " ready, " .. ready0 .. " expected"); end
+
+st=m.verify("frog.qla");
+if (st==0) then m.assert("frog.qla left after the delete"); end
+m.dir();
@@ -40,14 +40,16 @@
 #include <lualib.h>
 #include <math.h>
 #include <locale.h>
+#include <pthread.h>
+#include <stddef.h>
 
 #include "test.h"
 #include "flash.h"
 
 
 
-static uint8_t ram_sector_map[1024];
 static int quit=0;
+static int meta_only=0;
 static const wchar_t *colblocks[] = {L" ", L"_", L"▁", L"▂", L"▃", L"▄", L"▅", L"▆", L"▇", L"█"}; // 0-9
 
 ////////////////////////////////////////////
@@ -58,36 +60,57 @@ void draw_update(int wait, int umap);
 double simulation_factor = 1.0;
 static int step_through = 1;
 static int op_delay=0;
+static struct cpu_prop sim_cpu = CPU_PROP_CORTEX_M4(64.0);    // --cpu profile of every device
 
 struct console conlog;
-static struct zerofs zfs;
 static int height, width;
-static char *test_dir;
 static char *test_out;
 static int draw_init=0;
 static int colors_supported=0;
 
-// simulated flash
-static uint8_t mem_flash[4*1024*1024];  // 4MB -- 1024 blocks
-static uint8_t mem_super[2 * 4096];     // 8KB -- 2    blocks
+#define IDLE_TICK_US (1000.0)
+#define POLL_TICK_US (100.0)
 
-// flash area descriptors
+#define ZEROFS_EXTENSION_LIST \
+    X("csv")                  \
+    X("qla")                  \
+    X("qli")
+#define ZEROFS_VERIFY (0)
+#define ZEROFS_SUPER_BANKS (4)
+#define ZEROFS_BLANK_CHECK (1)
+#define ZEROFS_RUNTIME_GEOMETRY (1)
+#define ZEROFS_CPU_STATS (1)
+// the repacks and relocations nest in the API calls on the --timeline export
+#define ZEROFS_SPAN(zfs, name, begin) ((begin) ? flash_timeline_begin(SIM_SPAN_SIM(zfs), name, 0) : (void)flash_timeline_end(SIM_SPAN_SIM(zfs), 0))
+#define SIM_SPAN_SIM(zfs) (((struct flash_area *)(zfs)->fls->super_ud)->sim)
+
+#define ZEROFS_IMPLEMENTATION
+#include "zerofs.h"
+#define ZEROFS_TRACE_IMPLEMENTATION
+#include "zerofs_trace.h"
+
+// simulated flash, every device has its own (struct sim_dev)
+#define SIM_FLASH_SIZE (ZEROFS_FLASH_SIZE_KB*1024)       // 4MB  -- 1024 blocks
+#define SIM_SUPER_SIZE (ZEROFS_SUPER_BANKS*4096)         // 16KB -- 4    blocks
+
+// striped builds split the data flash into ZEROFS_DATA_DEVICES chips on their own SPI buses
+static_assert(ZEROFS_DATA_DEVICES==1||ZEROFS_DATA_DEVICES==2||ZEROFS_DATA_DEVICES==4, "the simulator supports 1, 2 or 4 data devices");
+#define SIM_DEV_SIZE (SIM_FLASH_SIZE/ZEROFS_DATA_DEVICES)
+// builds with erase blocks erase the data flash only with the 32KB or 64KB block erase
+#define SIM_BLOCK_SIZE (ZEROFS_SECTORS_PER_BLOCK>1?ZEROFS_ERASE_BLOCK_SIZE:0)
+#define SIM_BLOCK_ERASE_US (ZEROFS_ERASE_BLOCK_SIZE>32768?160000.0:112000.0)
+#define SIM_DATA_AREA(d) { FLASH_AREA_NFFS+(d), 0, NULL, NULL, SIM_DEV_SIZE, 1+(d), 0.0, \
+    FLASH_PROP_BY25Q32ES(SIM_DEV_SIZE, SIM_BLOCK_SIZE, SIM_BLOCK_ERASE_US) }
+
+// flash area descriptors, the contents are set by sim_dev_open()
 static struct flash_area fas[] =
 {
   // main flash area (slow SPI flash)
   // SPI comm slows down the operations
   // during erase reading is possible with special
   // erase-pause operation (additional slowdown)
-  {
-    FLASH_AREA_NFFS,
-    0,
-    NULL,
-    mem_flash,
-    sizeof(mem_flash),
-    1,
-    0.0,
-    { sizeof(mem_flash), 4096, 1, 36000.0, 600.0, 30.0, 2.5, 1.0, 100 } // based on BY25Q32ES datasheet, page is 256 bytes
-  },
+  // based on BY25Q32ES datasheet, page is 256 bytes
+  SIM_DATA_AREA(0),
   // superblock area (fast MCU flash on nRF52832)
   // during erase and program, the cpu 
   // halts (no flash access in any kind, 
@@ -96,51 +119,251 @@ static struct flash_area fas[] =
     FLASH_AREA_SUPER,
     0,
     NULL,
-    mem_super,
-    sizeof(mem_super),
+    NULL,
+    SIM_SUPER_SIZE,
     0,
     0.0,
-    { sizeof(mem_super), 4096, 4, 80000.0, 67.5/4*4096, 67.5/4, 67.5/4, 0.0, 100000 } // random public sources
+    FLASH_PROP_NRF52832(SIM_SUPER_SIZE) // random public sources
   },
+#if (ZEROFS_DATA_DEVICES>1)
+  SIM_DATA_AREA(1),
+#endif
+#if (ZEROFS_DATA_DEVICES>2)
+  SIM_DATA_AREA(2),
+  SIM_DATA_AREA(3),
+#endif
   { -1, 0, NULL, NULL, 0, 0, 0.0, {0} }
 };
-static struct flash_area fa[2];
+// JESD216 typical time field: count-1 and the unit index above it, rounded up
+static uint32_t sim_sfdp_time(double us, const double *unit_us, int units, int bits)
+{
+  uint32_t u,c;
+
+  for(u=0;u<units-1&&ceil(us/unit_us[u])>(1u<<bits);u++);
+  c=MIN(MAX((uint32_t)ceil(us/unit_us[u]),1u),1u<<bits);
+  return((c-1)|(u<<bits));
+}
+
+// JESD216B tables of the data flash part with 4/32/64KB erase types, the sector erase, the block erase
+// of the build and the page program times come from the part, the other block erase is 112 or 160 ms
+static void sim_sfdp(uint8_t *sfdp, uint32_t dev_size, const struct flash_prop *p)
+{
+  static const double erase_unit[]={ 1000.0, 16000.0, 128000.0, 1000000.0 };
+  static const double program_unit[]={ 8.0, 64.0 };
+  double t32=112000.0,t64=160000.0;
+  uint32_t bfpt[16],ps;
+
+  if(p->block_size==32768) t32=p->t_block_erase_us;
+  if(p->block_size==65536) t64=p->t_block_erase_us;
+  for(ps=0;(1u<<ps)<p->page_size&&ps<15;ps++);
+  memset(bfpt, 0xff, sizeof(bfpt));
+  bfpt[1]=dev_size*8-1;
+  bfpt[7]=0x520f200c;
+  bfpt[8]=0x0000d810;
+  bfpt[9]=(sim_sfdp_time(p->t_sector_erase_us, erase_unit, 4, 5)<<4)|(sim_sfdp_time(t32, erase_unit, 4, 5)<<11)|(sim_sfdp_time(t64, erase_unit, 4, 5)<<18);
+  bfpt[10]=(ps<<4)|(sim_sfdp_time(p->t_page_program_us, program_unit, 2, 5)<<8);
+  memset(sfdp, 0xff, 0x30);
+  memcpy(sfdp, "SFDP", 4);
+  sfdp[4]=6; sfdp[5]=1; sfdp[6]=0;
+  sfdp[8]=0x00; sfdp[9]=6; sfdp[10]=1; sfdp[11]=16;
+  sfdp[12]=0x30; sfdp[13]=0; sfdp[14]=0; sfdp[15]=0xff;
+  for(int i=0; i<16*4; i++) sfdp[0x30+i]=bfpt[i/4]>>((i%4)*8);
+}
+
+// one simulated device: the filesystem, its flash and the runner state of its script
+// the interactive run has one, fleet runs one per worker thread at a time
+struct sim_dev
+{
+  struct zerofs zfs;
+  struct flash_sim sim;
+  struct flash_area fa[ZEROFS_DATA_DEVICES+1];  // data devices first, the superblock area is the last one
+  uint8_t *mem_flash;                           // NULL in metadata-only runs
+  uint8_t mem_super[SIM_SUPER_SIZE];
+  struct zerofs_geometry geo;                   // data flash geometry parsed from the SFDP tables of the simulated part
+  void *devs[ZEROFS_DATA_DEVICES];
+  struct zerofs_flash_access fac;
+  struct zerofs_cpu_stats cpu_seen;             // the zerofs work already charged
+  struct
+  {
+    struct zerofs_fop *op;
+    double done;
+  } q[ZEROFS_FOP_QUEUE_DEPTH];                  // v2 queue driver, see fls_submit()
+  int qn;
+  int super_defer;                              // superblock operations are completed by fls_poll()
+  struct zerofs_fop *sq[ZEROFS_FOP_QUEUE_DEPTH];
+  int sqn;
+  int poll_mode;                                // non-blocking mode, see sim_poll()
+  struct zerofs_op poll_op;
+  long poll_calls;
+  double poll_step_max;
+  uint8_t ram_sector_map[ZEROFS_NUMBER_OF_SECTORS];
+  struct zerofs_file open_fp;                   // left open by write(..., true) until close()
+  int open_fp_used;
+  char *test_dir;
+  struct zerofs_trace *trace;                   // --record, NULL if the calls are not recorded
+  FILE *trace_f;
+};
 
+#define SIM_SUPER(dev) (&(dev)->fa[ZEROFS_DATA_DEVICES])
+// the device of a flash callback
+#define SIM_DEV(ud) ((struct sim_dev *)((struct flash_area *)(ud))->sim->user)
+// a call as a span on the api lane of the --timeline export, evaluates to the result of the call
+#define SIM_CALL(dev, name, arg, call) (flash_timeline_begin(&(dev)->sim, name, (long)(arg)), flash_timeline_end(&(dev)->sim, (call)))
+
+// the display reads the active bank straight from the simulated memory, paged builds included
+#define SIM_SUPERBLOCK(dev) ((const struct zerofs_superblock *)((dev)->mem_super + (dev)->zfs.bank * ZEROFS_SUPER_SECTOR_SIZE))
+
+// the zerofs work counted since the last call runs on the cpu before the next flash operation
+static void sim_cpu_charge(struct sim_dev *dev)
+{
+  flash_cpu_charge(&dev->sim, (uint32_t)(dev->zfs.cpu.map_probes-dev->cpu_seen.map_probes), (uint32_t)(dev->zfs.cpu.nm_probes-dev->cpu_seen.nm_probes), (uint32_t)(dev->zfs.cpu.copied-dev->cpu_seen.copied), 0.0);
+  dev->cpu_seen=dev->zfs.cpu;
+}
 
 int fls_write(void *ud, uint32_t addr, const uint8_t *data, uint32_t len)
 {
+  sim_cpu_charge(SIM_DEV(ud));
   return flash_area_write(ud, addr, data, len);
 }
 
 int fls_read(void *ud, uint32_t addr, uint8_t *data, uint32_t len)
 {
+  sim_cpu_charge(SIM_DEV(ud));
   return flash_area_read(ud, addr, data, len);
 }
 
+// only the SPI flash erases in the background, the MCU flash halts the cpu
 int fls_erase(void *ud, uint32_t addr, uint32_t len, int background)
 {
+  sim_cpu_charge(SIM_DEV(ud));
+  if(background&&ud!=SIM_SUPER(SIM_DEV(ud))) return flash_area_erase_background(ud, addr, len);
   return flash_area_erase(ud, addr, len);
 }
 
-#define ZEROFS_EXTENSION_LIST \
-    X("csv")                  \
-    X("qla")                  \
-    X("qli")
-#define ZEROFS_VERIFY (0)
+int fls_erase_suspend(void *ud)
+{
+  return flash_area_suspend(ud);
+}
 
-#define ZEROFS_IMPLEMENTATION
-#include "zerofs.h"
+int fls_erase_resume(void *ud)
+{
+  return flash_area_resume(ud);
+}
+
+int fls_busy(void *ud)
+{
+  return flash_area_busy(ud);
+}
+
+// the operation at once with the synchronous callbacks
+static int fls_run(void *ud, struct zerofs_fop *op)
+{
+  if(op->op==ZEROFS_FOP_READ) return(flash_area_read(ud, op->addr, op->buf, op->len));
+  if(op->op==ZEROFS_FOP_PROGRAM) return(flash_area_write(ud, op->addr, op->buf, op->len));
+  return(fls_erase(ud, op->addr, op->len, (op->flags&ZEROFS_FOP_F_BACKGROUND)!=0));
+}
+
+// v2 queue driver, operations are started on the device timelines of flash.c
+// and completed by fls_poll() in completion time order, the cpu waits only there
+int fls_submit(void *ud, struct zerofs_fop *op)
+{
+  static const int flash_op[]={ FLASH_OP_READ, FLASH_OP_WRITE, FLASH_OP_ERASE };
+  struct sim_dev *dev=SIM_DEV(ud);
+  double t;
+
+  sim_cpu_charge(dev);
+  // an asynchronous MCU flash driver, the superblock is changed only when fls_poll() completes the operation
+  if(ud==SIM_SUPER(dev)&&dev->super_defer)
+  {
+    if(dev->sqn>=ZEROFS_FOP_QUEUE_DEPTH) return(-1);
+    dev->sq[dev->sqn++]=op;
+    return(0);
+  }
+  // the MCU flash halts the cpu, a background erase is complete when the device accepted it
+  if(ud==SIM_SUPER(dev)||(op->flags&ZEROFS_FOP_F_BACKGROUND)!=0)
+  {
+    zerofs_fop_complete(op, fls_run(ud, op));
+    return(0);
+  }
+  if(dev->qn>=ZEROFS_FOP_QUEUE_DEPTH) return(-1);
+  t=flash_area_start(ud, flash_op[op->op], op->addr, op->buf, op->len);
+  if(t<0.0) return(-1);
+  dev->q[dev->qn].op=op;
+  dev->q[dev->qn].done=t;
+  dev->qn++;
+  return(0);
+}
+
+int fls_poll(void *ud)
+{
+  struct sim_dev *dev=SIM_DEV(ud);
+  struct zerofs_fop *op;
+  int i,first=0;
+
+  // the deferred superblock operations in submission order
+  if(dev->sqn>0)
+  {
+    op=dev->sq[0];
+    dev->sqn--;
+    memmove(dev->sq, dev->sq+1, dev->sqn*sizeof(dev->sq[0]));
+    zerofs_fop_complete(op, fls_run(SIM_SUPER(dev), op));
+    return(1);
+  }
+  if(dev->qn==0) return(0);
+  for(i=1;i<dev->qn;i++) if(dev->q[i].done<dev->q[first].done) first=i;
+  flash_wait_until(&dev->sim, dev->q[first].done);
+  zerofs_fop_complete(dev->q[first].op, dev->q[first].op->len);
+  dev->q[first]=dev->q[--dev->qn];
+  return(1);
+}
+
+// the completion interrupts of the operations already done at the current time
+static void fls_irq(struct sim_dev *dev)
+{
+  int i=0;
+
+  while(i<dev->qn)
+  {
+    if(dev->q[i].done<=dev->sim.clock_us)
+    {
+      zerofs_fop_complete(dev->q[i].op, dev->q[i].op->len);
+      dev->q[i]=dev->q[--dev->qn];
+    }
+    else i++;
+  }
+}
+
+int fls_sleep(void *ud)
+{
+  return flash_area_sleep(ud);
+}
+
+int fls_wake(void *ud)
+{
+  return flash_area_wake(ud);
+}
 
 
-static struct zerofs_flash_access fac=
+// the callbacks of every device, sim_dev_open() sets the memory and the areas
+static const struct zerofs_flash_access sim_fac=
 {
   fls_write, fls_read, fls_erase,
-  mem_super,
-  &fa[0],&fa[1]
+  NULL,
+  NULL,NULL,
+  fls_erase_suspend, fls_erase_resume, fls_busy,
+  NULL,
+  fls_sleep, fls_wake,
+  fls_submit, fls_poll,
+  NULL,
+  NULL
 };
 
+// the device on the terminal
+static struct sim_dev *tui;
 
-static_assert(ZEROFS_NUMBER_OF_SECTORS == 1024, "change ram_sector_map and flash area sizes before adjusting sector count!");
+// the sector map is drawn in rows of 32 sectors
+static_assert((ZEROFS_NUMBER_OF_SECTORS%32)==0, "the sector map display needs a multiple of 32 sectors");
+#define SIM_CONSOLE_Y (ZEROFS_NUMBER_OF_SECTORS/32+4)
 
 
 // tui tools
@@ -190,7 +413,7 @@ static void set_color(int i)
 static void draw_map(uint8_t *p_map, uint8_t *n_map, int size, int x, int y, int col)
 {
     int i, xx, yy;
-    char buf[5];
+    char buf[8];
     char *str;
 
     for(yy = i = 0; i < size; i += col, yy++)
@@ -214,12 +437,13 @@ static void draw_map(uint8_t *p_map, uint8_t *n_map, int size, int x, int y, int
         else snprintf(str, sizeof(buf), "%02x", n_map[i]);
         {
           // draw wear based on FLASH_ERASE_CYCLE
-          if(NULL!=fa[0].wear)
+          struct flash_area *dev=&tui->fa[i%ZEROFS_DATA_DEVICES];
+          if(NULL!=dev->wear)
           {
-            int w=fa[0].wear[i];
+            int w=dev->wear[i/ZEROFS_DATA_DEVICES];
             if(w>=0)
             {
-              int b=(int)(w/(fa[0].prop.lifecycle/9.0));
+              int b=(int)(w/(dev->prop.lifecycle/9.0));
               if(b>9) b=9;
               if(b<0) b=0;
               mvaddwstr(y + yy + 2, x + xx + 5, colblocks[b]);
@@ -257,7 +481,7 @@ static void draw_status(struct zerofs *zfs, int step, int w)
     attroff(A_REVERSE);
 }
 
-static void draw_files(struct zerofs *zfs, int x, int y, int w, int h)
+static void draw_files(struct sim_dev *dev, int x, int y, int w, int h)
 {
     static const int width=20;
     int id;
@@ -269,10 +493,11 @@ static void draw_files(struct zerofs *zfs, int x, int y, int w, int h)
     int l;
     int valid;
 
-    nm = zfs->superblock->namemap;
+    nm = SIM_SUPERBLOCK(dev)->namemap;
     xx = 0;
     yy = 0;
-    for(id = 0; id < ZEROFS_MAX_NUMBER_OF_FILES; id++)
+    // append log records are not shown
+    for(id = 0; id < zerofs_namemap_limit(&dev->zfs); id++)
     {
         valid=1;
         l = (unsigned)ZEROFS_NM_GET_SIZE(&nm[id]);
@@ -342,12 +567,12 @@ void draw_update(int wait, int umap)
     if(!draw_init) return;
     if(cycle == 0) memset(p_map, 0xff, sizeof(p_map));
     ++cycle;
-    draw_status(&zfs, 0, width);
-    map = (uint8_t *) ZEROFS_SECTOR_MAP(&zfs);
-    if(umap) draw_map(p_map, map, sizeof(p_map), 0, 2, 32);
+    draw_status(&tui->zfs, 0, width);
+    map = tui->zfs.sector_map ? tui->zfs.sector_map : (uint8_t *) SIM_SUPERBLOCK(tui)->sector_map;
+    if(umap) draw_map(p_map, map, ZEROFS_SECTORS(&tui->zfs), 0, 2, 32);
     memcpy(p_map, map, sizeof(p_map));
-    draw_console(0, 36, 32 * 3 + 5, height - 2 - 36);
-    draw_files(&zfs, 32 * 3 + 5 + 2, 2, width - (32 * 3 + 5 + 2), height - 2);
+    draw_console(0, SIM_CONSOLE_Y, 32 * 3 + 5, height - 2 - SIM_CONSOLE_Y);
+    draw_files(tui, 32 * 3 + 5 + 2, 2, width - (32 * 3 + 5 + 2), height - 2);
 
     refresh();
 
@@ -362,26 +587,26 @@ void draw_update(int wait, int umap)
                 case KEY_UP:
                     conlog.disp--;
                     if(conlog.line[conlog.disp]==NULL) conlog.disp++;
-                    draw_console(0, 36, 32 * 3 + 5, height - 2 - 36);
+                    draw_console(0, SIM_CONSOLE_Y, 32 * 3 + 5, height - 2 - SIM_CONSOLE_Y);
                     break;
                 case KEY_DOWN:
                     conlog.disp++;
                     if(conlog.disp>conlog.pos) conlog.disp=conlog.pos;
-                    draw_console(0, 36, 32 * 3 + 5, height - 2 - 36);
+                    draw_console(0, SIM_CONSOLE_Y, 32 * 3 + 5, height - 2 - SIM_CONSOLE_Y);
                     break;
                 case '<':
                   simulation_factor-=log2(simulation_factor);
                   if(simulation_factor<1.001f) simulation_factor=0.0f;
-                  draw_status(&zfs, 0, width);
+                  draw_status(&tui->zfs, 0, width);
                   break;
                 case '>':
                   simulation_factor+=log2(simulation_factor);
                   if(simulation_factor>1000.0f) simulation_factor=1000.0f;
-                  draw_status(&zfs, 0, width);
+                  draw_status(&tui->zfs, 0, width);
                   break;
                 case 's':
                   step_through^=1;
-                  draw_status(&zfs, 0, width);
+                  draw_status(&tui->zfs, 0, width);
                   break;
                 
             }
@@ -412,155 +637,162 @@ void draw_update(int wait, int umap)
     }
 }
 
+// non-blocking mode, the operations are advanced by zerofs_poll() with POLL_TICK_US of other work between the calls
+static int sim_poll(struct sim_dev *dev, int st)
+{
+  double t;
+
+  while(st==ZEROFS_IN_PROGRESS)
+  {
+    t=dev->sim.clock_us;
+    st=zerofs_trace_poll(dev->trace, &dev->zfs);
+    sim_cpu_charge(dev);
+    dev->poll_calls++;
+    dev->poll_step_max=fmax(dev->poll_step_max, dev->sim.clock_us-t);
+    if(st!=ZEROFS_IN_PROGRESS) break;
+    flash_cpu_until(&dev->sim, dev->sim.clock_us+POLL_TICK_US, FLASH_CPU_RUN);
+    fls_irq(dev);
+  }
+  return(st);
+}
+
 // lua procedures
 
+// the device of the script, set by luainit()
+static struct sim_dev *sim_dev_L(lua_State *L)
+{
+  return(*(struct sim_dev **)lua_getextraspace(L));
+}
+
 static int l_getch(lua_State *L)
 {
-  int ch=getch();
+  int ch=(headless?ERR:getch());
   lua_pushinteger(L, ch);
   return(1);
 }
 
+// write(name, chunk [, len [, keep_open]]) writes the file of the data directory, or len synthetic bytes
+// metadata-only runs write the length only, keep_open leaves the file open for writing until close()
 static int l_write(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     const char *name = luaL_checkstring(L, 1);
     int chunk = luaL_checkinteger(L, 2);
-    char path[PATH_MAX];
-    uint8_t *data;
+    int keep_open = lua_toboolean(L, 4);
+    uint8_t *data = NULL;
     uint8_t *p;
     int st=-1;
-    int l;
+    int len, l;
 
-    strcpy(path, test_dir);
-    int len = strlen(path);
-    if(len + strlen(name) < PATH_MAX)
+    if(keep_open && dev->open_fp_used) return(luaL_error(L, "a file is already open"));
+    len = flash_payload(dev->sim.con, dev->test_dir, name, luaL_optinteger(L, 3, -1), (meta_only ? NULL : &data));
+    if(len >= 0)
     {
-        strcat(path, "/");
-        strcat(path, name);
-        FILE *f = fopen(path, "rb");
-        if(NULL != f)
+        struct zerofs_file local_fp;
+        struct zerofs_file *fp = (keep_open ? &dev->open_fp : &local_fp);
+        if(meta_only) data = calloc(MAX(chunk, 1), 1);
+        if(dev->poll_mode) st = SIM_CALL(dev, "create", 0, sim_poll(dev, zerofs_trace_create_start(dev->trace, &dev->zfs, &dev->poll_op, fp, name)));
+        else st = SIM_CALL(dev, "create", 0, zerofs_trace_create(dev->trace, &dev->zfs, fp, name));
+        if(st == 0)
         {
-            fseek(f, 0, SEEK_END);
-            len = ftell(f);
-            fseek(f, 0, SEEK_SET);
-            data = malloc(len);
-            if(len == fread(data, 1, len, f))
+            // write in chunk buffer size
+            p=data;
+            l=len;
+            while(l>0&&st==0)
             {
-                struct zerofs_file fp;
-                st = zerofs_create(&zfs, &fp, name);
-                if(st == 0)
-                {
-                    // write in chunk buffer size
-                    p=data;
-                    l=len;
-                    while(l>0&&st==0)
-                    {
-                      st = zerofs_write(&fp, p, MIN(l,chunk));
-                      p+=MIN(l,chunk);
-                      l-=MIN(l,chunk);
-                    }
-                    if(st == 0)
-                    {
-                        st = zerofs_close(&fp);
-                        if(st == 0) CONSOLE(&conlog, "%s() FILE '%s' [%d] WRITTEN\n", __FUNCTION__, name, len);
-                        else CONSOLE(&conlog, "ERROR %s() zerofs_close error: %d\n", __FUNCTION__, st);
-                    }
-                    else CONSOLE(&conlog, "ERROR %s() zerofs_write error: %d\n", __FUNCTION__, st);
-                }
-                else CONSOLE(&conlog, "ERROR %s() zerofs_create error: %d\n", __FUNCTION__, st);
-                draw_update(1,1);
+              if(dev->poll_mode) st = SIM_CALL(dev, "write", MIN(l,chunk), sim_poll(dev, zerofs_trace_write_start(dev->trace, &dev->zfs, &dev->poll_op, fp, p, MIN(l,chunk))));
+              else st = SIM_CALL(dev, "write", MIN(l,chunk), zerofs_trace_write(dev->trace, fp, p, MIN(l,chunk)));
+              if(!meta_only) p+=MIN(l,chunk);
+              l-=MIN(l,chunk);
+            }
+            if(st == 0 && keep_open)
+            {
+                dev->open_fp_used = 1;
+                CONSOLE(dev->sim.con, "%s() FILE '%s' [%d] WRITTEN, LEFT OPEN\n", __FUNCTION__, name, len);
+            }
+            else if(st == 0)
+            {
+                st = SIM_CALL(dev, "close", 0, zerofs_trace_close(dev->trace, fp));
+                if(st == 0) CONSOLE(dev->sim.con, "%s() FILE '%s' [%d] WRITTEN\n", __FUNCTION__, name, len);
+                else CONSOLE(dev->sim.con, "ERROR %s() zerofs_close error: %d\n", __FUNCTION__, st);
             }
-            else CONSOLE(&conlog, "ERROR %s() read error '%s'\n", __FUNCTION__, path);
-            fclose(f);
-            free(data);
+            else CONSOLE(dev->sim.con, "ERROR %s() zerofs_write error: %d\n", __FUNCTION__, st);
         }
-        else CONSOLE(&conlog, "ERROR %s() file '%s' not found\n", __FUNCTION__, path);
+        else CONSOLE(dev->sim.con, "ERROR %s() zerofs_create error: %d\n", __FUNCTION__, st);
+        draw_update(1,1);
+        free(data);
     }
-    else CONSOLE(&conlog, "ERROR %s() path too long\n", __FUNCTION__);
 
     if(!quit) lua_pushinteger(L, st);
     
     return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+// verify(name [, len]) reads back the file in varying chunks and with seeks, metadata-only runs
+// do the same reads without comparing the contents
 static int l_verify(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     const int chunk[]={ 10, 3, 128, 512, 101, 7, -1 };
     const int seek[]={ 10, 0, 5111, 101, -1 };
     const char *name = luaL_checkstring(L, 1);
-    char path[PATH_MAX];
     uint8_t seek_buf[11];
-    uint8_t *data, *data2;
+    uint8_t *data = NULL, *data2;
     int st=-1;
+    int len;
 
     draw_update(0,0);
 
-    strcpy(path, test_dir);
-    int len = strlen(path);
-    if(len + 1 + strlen(name) < PATH_MAX)
+    len = flash_payload(dev->sim.con, dev->test_dir, name, luaL_optinteger(L, 2, -1), (meta_only ? NULL : &data));
+    if(len >= 0)
     {
-        strcat(path, "/");
-        strcat(path, name);
-        FILE *f = fopen(path, "rb");
-        if(NULL != f)
+        struct zerofs_file fp;
+        draw_update(0,0);
+        data2 = calloc(len+1,1);
+        st = SIM_CALL(dev, "open", 0, zerofs_trace_open(dev->trace, &dev->zfs, &fp, name));
+        if(st == 0)
         {
-            fseek(f, 0, SEEK_END);
-            len = ftell(f);
-            fseek(f, 0, SEEK_SET);
-            data = calloc(len+1,1);
-            if(len == fread(data, 1, len, f))
+            int ci, cl, j, i;
+            for(ci=j=0; j<len ;++ci)
+            {
+                if( chunk[ci] < 0 ) ci = 0;
+                cl = MIN( chunk[ci], len);
+                st = SIM_CALL(dev, "read", cl, zerofs_trace_read(dev->trace, &fp, data2, cl));
+                if(st > 0 && meta_only) j+=st;
+                else if(st >= 0)
+                {
+                    for(i=0;i<st;i++,j++) if(data[j]!=data2[i]) break;
+                    if(i<st) break;
+                }
+                else CONSOLE(dev->sim.con, "ERROR %s() zerofs_read error: %d\n", __FUNCTION__, st);
+            }
+            if(j>=len) st=0;
+            else { st=-1; CONSOLE(dev->sim.con, "ERROR %s() '%s' differ at char %d\n", __FUNCTION__, name, j); }
+            if(st==0)
             {
-                struct zerofs_file fp;
-                draw_update(0,0);
-                data2 = calloc(len+1,1);
-                st = zerofs_open(&zfs, &fp, name);
-                if(st == 0)
+                // if full read on, do seek test
+                for(i=0; seek[i]>0 && st==0; i++)
                 {
-                    int ci, cl, j, i;
-                    for(ci=j=0; j<len ;++ci)
-                    {
-                        if( chunk[ci] < 0 ) ci = 0;
-                        cl = MIN( chunk[ci], len);
-                        st = zerofs_read(&fp, data2, cl);
-                        if(st >= 0)
-                        {
-                            for(i=0;i<st;i++,j++) if(data[j]!=data2[i]) break;
-                            if(i<st) break;
-                        }
-                        else CONSOLE(&conlog, "ERROR %s() zerofs_read error: %d\n", __FUNCTION__, st);
-                    }
-                    if(j>=len) st=0;
-                    else { st=-1; CONSOLE(&conlog, "ERROR %s() '%s' differ at char %d\n", __FUNCTION__, name, j); }
-                    if(st==0)
-                    {
-                        // if full read on, do seek test
-                        for(i=0; seek[i]>0 && st==0; i++)
-                        {
-                            if(seek[i]>=(len-sizeof(seek_buf))) continue;
-                            st = zerofs_seek(&fp, seek[i]);
-                            if(st != 0) break;
-                            st = zerofs_read(&fp, seek_buf, sizeof(seek_buf));
-                            if(st!=sizeof(seek_buf)) break;
-                            for(j=0; j<st; j++) if(seek_buf[j] != data[seek[i]+j]) break;
-                            if(j>=st) st=0;
-                            else CONSOLE(&conlog, "ERROR %s() '%s' seek mismatch at %d 0x%02x != 0x%02x\n",__FUNCTION__, name, seek[i]+j, seek_buf[j], data[seek[i]+j]);
-                        }
-                        if(st==0) { CONSOLE(&conlog, "%s() '%s' VERIFIED OK\n", __FUNCTION__, name); }
-                        else { CONSOLE(&conlog, "ERROR %s() '%s' SEEK FAILED len=%ld pos=%d st=%d\n", __FUNCTION__, name, sizeof(seek_buf), seek[i], st); }
-                    }
-                    zerofs_close(&fp);
+                    if(seek[i]>=(len-sizeof(seek_buf))) continue;
+                    st = SIM_CALL(dev, "seek", seek[i], zerofs_trace_seek(dev->trace, &fp, seek[i]));
+                    if(st != 0) break;
+                    st = SIM_CALL(dev, "read", sizeof(seek_buf), zerofs_trace_read(dev->trace, &fp, seek_buf, sizeof(seek_buf)));
+                    if(st!=sizeof(seek_buf)) break;
+                    if(meta_only) j=st;
+                    else for(j=0; j<st; j++) if(seek_buf[j] != data[seek[i]+j]) break;
+                    if(j>=st) st=0;
+                    else CONSOLE(dev->sim.con, "ERROR %s() '%s' seek mismatch at %d 0x%02x != 0x%02x\n",__FUNCTION__, name, seek[i]+j, seek_buf[j], data[seek[i]+j]);
                 }
-                else CONSOLE(&conlog, "ERROR %s() zerofs_open error: %d\n", __FUNCTION__, st);
-                draw_update(1,0);
-                free(data2);
+                if(st==0) { CONSOLE(dev->sim.con, "%s() '%s' VERIFIED OK\n", __FUNCTION__, name); }
+                else { CONSOLE(dev->sim.con, "ERROR %s() '%s' SEEK FAILED len=%ld pos=%d st=%d\n", __FUNCTION__, name, sizeof(seek_buf), seek[i], st); }
             }
-            else CONSOLE(&conlog, "ERROR %s() read error '%s'\n", __FUNCTION__, path);
-            free(data);
-            fclose(f);
+            (void)SIM_CALL(dev, "close", 0, zerofs_trace_close(dev->trace, &fp));
         }
-        else CONSOLE(&conlog, "ERROR %s() file '%s' not found\n", __FUNCTION__, path);
+        else CONSOLE(dev->sim.con, "ERROR %s() zerofs_open error: %d\n", __FUNCTION__, st);
+        draw_update(1,0);
+        free(data2);
+        free(data);
     }
-    else CONSOLE(&conlog, "ERROR %s() path too long\n", __FUNCTION__);
 
     if(!quit) lua_pushinteger(L, st);
 
@@ -569,13 +801,14 @@ static int l_verify(lua_State *L)
 
 static int l_dir(lua_State *L)
 {
+  struct sim_dev *dev=sim_dev_L(L);
   struct zerofs_dirent de;
   int i=0;
 
   memset(&de, 0, sizeof(struct zerofs_dirent));
-  while(0==zerofs_dir_next(&zfs, &de))
+  while(0==zerofs_dir_next(&dev->zfs, &de))
   {
-    CONSOLE(&conlog, "INFO %s() dirent %d '%s' %d bytes\n", __FUNCTION__, i, de.name, de.len);
+    CONSOLE(dev->sim.con, "INFO %s() dirent %d '%s' %d bytes\n", __FUNCTION__, i, de.name, de.len);
     i++;
   }
   
@@ -586,129 +819,478 @@ static int l_dir(lua_State *L)
 
 static int l_setdir(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     const char *dir = luaL_checkstring(L, 1);
 
     if(NULL != dir)
     {
         if(strlen(dir) < PATH_MAX)
         {
-            if(NULL != test_dir) free(test_dir);
-            test_dir = strdup(dir);
-            CONSOLE(&conlog, "%s() DIR SET TO '%s'\n", __FUNCTION__, test_dir);
+            if(NULL != dev->test_dir) free(dev->test_dir);
+            dev->test_dir = strdup(dir);
+            CONSOLE(dev->sim.con, "%s() DIR SET TO '%s'\n", __FUNCTION__, dev->test_dir);
         } else
-            CONSOLE(&conlog, "ERROR %s() dir too long!\n", __FUNCTION__);
+            CONSOLE(dev->sim.con, "ERROR %s() dir too long!\n", __FUNCTION__);
     }
 
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
+// READ mode if read, WRITE mode with the ram sector map otherwise
+static int sim_setmode(struct sim_dev *dev, int read)
+{
+    uint8_t *map = (read ? NULL : dev->ram_sector_map);
+
+    if(dev->poll_mode) return(SIM_CALL(dev, "mode", read, sim_poll(dev, zerofs_trace_readonly_mode_start(dev->trace, &dev->zfs, &dev->poll_op, map))));
+    return(SIM_CALL(dev, "mode", read, zerofs_trace_readonly_mode(dev->trace, &dev->zfs, map)));
+}
+
 static int l_setmode(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     const char *mode = luaL_checkstring(L, 1);
 
     if(strcmp("read", mode) == 0)
     {
-        zerofs_readonly_mode(&zfs, NULL);
-        CONSOLE(&conlog, "%s() READ MODE ENABLED\n", __FUNCTION__);
+        sim_setmode(dev, 1);
+        CONSOLE(dev->sim.con, "%s() READ MODE ENABLED\n", __FUNCTION__);
     }
     else if(strcmp("write", mode) == 0)
     {
-        zerofs_readonly_mode(&zfs, ram_sector_map);
-        CONSOLE(&conlog, "%s() WRITE MODE ENABLED\n", __FUNCTION__);
+        sim_setmode(dev, 0);
+        CONSOLE(dev->sim.con, "%s() WRITE MODE ENABLED\n", __FUNCTION__);
     }
-    else CONSOLE(&conlog, "ERROR %s() unsupported mode '%s' requested\n", __FUNCTION__, mode);
+    else CONSOLE(dev->sim.con, "ERROR %s() unsupported mode '%s' requested\n", __FUNCTION__, mode);
 
     draw_update(1,1);
 
     return(0);
 }
 
-static int l_printdebug(lua_State *L)
+// append the log to test_out, devices without a log have nothing to print
+static void sim_printdebug(struct console *con)
 {
     FILE *f;
+    if(NULL == con) return;
     f = fopen(test_out, "a");
     if(NULL != f)
     {
-        fprintf(f, "\n%s() at %ld\n", __FUNCTION__, time(NULL));
-        for(int i = 0; i < ARRAY_SIZE(conlog.line); i++)
+        fprintf(f, "\nl_printdebug() at %ld\n", time(NULL));
+        for(int i = 0; i < ARRAY_SIZE(con->line); i++)
         {
-            int x = (conlog.pos + i) % ARRAY_SIZE(conlog.line);
-            if(NULL != conlog.line[x])
-                fprintf(f, "%d: %s", x, conlog.line[x]);
+            int x = (con->pos + i) % ARRAY_SIZE(con->line);
+            if(NULL != con->line[x])
+                fprintf(f, "%d: %s", x, con->line[x]);
         }
         fclose(f);
     }
+}
+
+static int l_printdebug(lua_State *L)
+{
+    sim_printdebug(sim_dev_L(L)->sim.con);
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
+// the speed is a terminal setting, headless runs and fleet devices do not wait for the host
 static int l_speed(lua_State *L)
 {
-    simulation_factor = luaL_checknumber(L, 1);
-    op_delay = luaL_checkinteger(L, 2);
+    double factor = luaL_checknumber(L, 1);
+    int delay = luaL_checkinteger(L, 2);
+    if(!headless)
+    {
+        simulation_factor = factor;
+        op_delay = delay;
+    }
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
 static int l_setstep(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     int isbool = lua_isboolean(L, 1);
     if (!isbool) return(luaL_error(L, "expected boolean"));
     int step = lua_toboolean(L, 1);
-    if(step) step_through=1;
-    else step_through=0;
-    CONSOLE(&conlog,"%s() STEP MODE %s\n",__FUNCTION__, (step?"ENABLED":"DISABLED"));
+    if(!headless) step_through = !!step;
+    CONSOLE(dev->sim.con,"%s() STEP MODE %s\n",__FUNCTION__, (step?"ENABLED":"DISABLED"));
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
 static int l_badblock(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     int isbad = lua_isboolean(L, 1);
     if (!isbad) return(luaL_error(L, "expected boolean"));
-    badblock = !!lua_toboolean(L, 1);
-    CONSOLE(&conlog,"%s() BADBLOCK SIMULATION %s\n",__FUNCTION__, (badblock?"ENABLED":"DISABLED"));
+    dev->sim.badblock = !!lua_toboolean(L, 1);
+    CONSOLE(dev->sim.con,"%s() BADBLOCK SIMULATION %s\n",__FUNCTION__, (dev->sim.badblock?"ENABLED":"DISABLED"));
     return((quit?luaL_error(L, "Interrupted"):0));
 }
 
 static int l_delete(lua_State *L)
 {
+    struct sim_dev *dev = sim_dev_L(L);
     const char *name = luaL_checkstring(L, 1);
     int st;
 
-    st=zerofs_delete(&zfs, name);
-    CONSOLE(&conlog, "%s() '%s' st=%d\n", __FUNCTION__, name, st);
+    if(dev->poll_mode) st=SIM_CALL(dev, "delete", 0, sim_poll(dev, zerofs_trace_delete_start(dev->trace, &dev->zfs, &dev->poll_op, name)));
+    else st=SIM_CALL(dev, "delete", 0, zerofs_trace_delete(dev->trace, &dev->zfs, name));
+    CONSOLE(dev->sim.con, "%s() '%s' st=%d\n", __FUNCTION__, name, st);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, st);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+static int l_delete_many(lua_State *L)
+{
+    struct sim_dev *dev = sim_dev_L(L);
+    const char *names[ZEROFS_MAX_NUMBER_OF_FILES];
+    int i, n, st;
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = (int)lua_rawlen(L, 1);
+    if(n > ZEROFS_MAX_NUMBER_OF_FILES) return(luaL_error(L, "too many names"));
+    for(i = 0; i < n; i++)
+    {
+        lua_rawgeti(L, 1, i + 1);
+        names[i] = luaL_checkstring(L, -1);
+        lua_pop(L, 1);
+    }
+    st=SIM_CALL(dev, "delete_many", n, zerofs_trace_delete_many(dev->trace, &dev->zfs, names, n));
+    CONSOLE(dev->sim.con, "%s() %d files st=%d\n", __FUNCTION__, n, st);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, st);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// close() closes the file left open by write(..., true)
+static int l_close(lua_State *L)
+{
+    struct sim_dev *dev = sim_dev_L(L);
+    int st = -1;
+
+    if(dev->open_fp_used)
+    {
+        st = SIM_CALL(dev, "close", 0, zerofs_trace_close(dev->trace, &dev->open_fp));
+        dev->open_fp_used = 0;
+    }
+    CONSOLE(dev->sim.con, "%s() st=%d\n", __FUNCTION__, st);
+    draw_update(1,1);
+    if(!quit) lua_pushinteger(L, st);
+    return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// the predicate of delete_if() is called with the name and the length of the file
+static int sim_delete_match(const struct zerofs_dirent *de, void *ud)
+{
+    lua_State *L = ud;
+    int ret;
+
+    lua_pushvalue(L, 1);
+    lua_pushstring(L, de->name);
+    lua_pushinteger(L, de->len);
+    lua_call(L, 2, 1);
+    ret = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return(ret);
+}
+
+// delete_if(function(name, len)) deletes the files the function returns true for, not recorded by --record
+static int l_delete_if(lua_State *L)
+{
+    struct sim_dev *dev = sim_dev_L(L);
+    int st;
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    st=SIM_CALL(dev, "delete_if", 0, zerofs_delete_if(&dev->zfs, sim_delete_match, L));
+    CONSOLE(dev->sim.con, "%s() st=%d\n", __FUNCTION__, st);
     draw_update(1,1);
     if(!quit) lua_pushinteger(L, st);
     return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+// erase_async([max_sectors [, max_us]]) -> st, erased, ready, remaining
+// without a budget zerofs_background_erase() is called, the report is only filled with a budget
 static int l_erase_async(lua_State *L)
 {
+  struct sim_dev *dev=sim_dev_L(L);
   int st;
+  struct zerofs_erase_report rep={0};
+  int max_sectors = (int)luaL_optinteger(L, 1, 1);
+  uint32_t max_us = (uint32_t)luaL_optinteger(L, 2, 0);
   
-  st=zerofs_background_erase(&zfs);
-  CONSOLE(&conlog,"%s() st=%d\n", __FUNCTION__, st);
+  if(lua_isnoneornil(L, 1)) st=SIM_CALL(dev, "erase", 1, zerofs_trace_background_erase(dev->trace, &dev->zfs));
+  else st=SIM_CALL(dev, "erase", max_sectors, zerofs_trace_background_erase_budget(dev->trace, &dev->zfs, max_sectors, max_us, &rep));
+  CONSOLE(dev->sim.con,"%s() st=%d erased=%d ready=%d remaining=%d\n", __FUNCTION__, st, rep.erased, rep.ready, rep.remaining);
   draw_update(1,1);
-  if(!quit) lua_pushinteger(L, st);
+  if(quit) return(luaL_error(L, "Interrupted"));
+  lua_pushinteger(L, st);
+  lua_pushinteger(L, rep.erased);
+  lua_pushinteger(L, rep.ready);
+  lua_pushinteger(L, rep.remaining);
+  return(4);
+}
+
+// erase_suspend(enable) reads suspend the background erase instead of waiting for it
+static int l_erase_suspend(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  int on = lua_toboolean(L, 1);
+
+  dev->fac.fls_erase_suspend = on ? fls_erase_suspend : NULL;
+  dev->fac.fls_erase_resume = on ? fls_erase_resume : NULL;
+  dev->fac.fls_busy = on ? fls_busy : NULL;
+  CONSOLE(dev->sim.con, "%s() %s\n", __FUNCTION__, on ? "on" : "off");
+  return(0);
+}
+
+// flash_queue(enable [, defer_super]) use the v2 queue driver instead of the synchronous callbacks
+// with defer_super the superblock operations are queued as well and change the flash only when polled
+static int l_flash_queue(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  int on = lua_toboolean(L, 1);
+
+  dev->fac.fls_submit = on ? fls_submit : NULL;
+  dev->fac.fls_poll = on ? fls_poll : NULL;
+  dev->super_defer = on && lua_toboolean(L, 2);
+  CONSOLE(dev->sim.con, "%s() %s%s\n", __FUNCTION__, on ? "on" : "off", dev->super_defer ? " defer_super" : "");
+  return(0);
+}
+
+// poll_mode(enable [, budget_us]) use the non-blocking API for write, create, delete and setmode
+static int l_poll_mode(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  dev->poll_mode = lua_toboolean(L, 1);
+  dev->poll_op.budget_us = (uint32_t)luaL_optinteger(L, 2, 0);
+  CONSOLE(dev->sim.con, "%s() %s budget=%u\n", __FUNCTION__, dev->poll_mode ? "on" : "off", dev->poll_op.budget_us);
+  return(0);
+}
+
+// sleep_policy(idle_us [, erase_first]) power down the data flash after idle_us
+static int l_sleep_policy(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  uint32_t idle_us = (uint32_t)luaL_checkinteger(L, 1);
+  int erase_first = lua_toboolean(L, 2);
+
+  zerofs_set_sleep_policy(&dev->zfs, idle_us, erase_first);
+  CONSOLE(dev->sim.con, "%s() idle_us=%u erase_first=%d\n", __FUNCTION__, idle_us, erase_first);
+  return(0);
+}
+
+// the simulation clock runs without file operations, zerofs_idle() is called every IDLE_TICK_US
+static void sim_idle(struct sim_dev *dev, double us)
+{
+  double end = dev->sim.clock_us + us;
+  double step;
+
+  if(NULL != dev->trace) zerofs_trace_gap(dev->trace, (uint32_t)us);
+  flash_timeline_begin(&dev->sim, "idle", (long)us);
+  while(dev->sim.clock_us < end)
+  {
+    zerofs_idle(&dev->zfs, (uint32_t)(uint64_t)dev->sim.clock_us);
+    sim_cpu_charge(dev);
+    if(dev->sim.clock_us >= end) break;
+    step = fmin(IDLE_TICK_US, end - dev->sim.clock_us);
+    flash_sleep(step);
+    flash_cpu_until(&dev->sim, dev->sim.clock_us + step, FLASH_CPU_IDLE);
+  }
+  zerofs_idle(&dev->zfs, (uint32_t)(uint64_t)dev->sim.clock_us);
+  flash_timeline_end(&dev->sim, 0);
+}
+
+// idle(us) let the simulation clock run without file operations
+static int l_idle(lua_State *L)
+{
+  sim_idle(sim_dev_L(L), (double)luaL_checkinteger(L, 1));
+  if(quit) return(luaL_error(L, "Interrupted"));
+  return(0);
+}
+
+// format() erase the filesystem and mount it again like after a reset, returns the status
+static int l_format(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  int st=zerofs_format(&dev->zfs);
+
+  // zerofs_init() clears the counters of the work
+  sim_cpu_charge(dev);
+  memset(&dev->cpu_seen, 0, sizeof(dev->cpu_seen));
+  if(0==st) st=zerofs_init(&dev->zfs, &dev->fac);
+  CONSOLE(dev->sim.con, "%s() st=%d\n", __FUNCTION__, st);
+  lua_pushinteger(L, st);
+  return((quit?luaL_error(L, "Interrupted"):1));
+}
+
+// reset() mounts the filesystem again like after a power cycle, the queued operations and the open file are lost
+static int l_reset(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  int st;
+
+  dev->qn = 0;
+  dev->sqn = 0;
+  dev->open_fp_used = 0;
+  // zerofs_init() clears the counters of the work
+  sim_cpu_charge(dev);
+  memset(&dev->cpu_seen, 0, sizeof(dev->cpu_seen));
+  st=zerofs_init(&dev->zfs, &dev->fac);
+  CONSOLE(dev->sim.con, "%s() st=%d\n", __FUNCTION__, st);
+  lua_pushinteger(L, st);
   return((quit?luaL_error(L, "Interrupted"):1));
 }
 
+// seed(default) the seed of the workload, default plus the --seed of the run, fleet devices count up from it
+static int l_seed(lua_State *L)
+{
+  lua_Integer seed = luaL_checkinteger(L, 1);
+
+  lua_pushinteger(L, seed + (lua_Integer)sim_dev_L(L)->sim.seed);
+  return(1);
+}
+
+// workload trace of the data directory (zerofs_trace.h) with synthetic payloads, the calls go through the recorder
+// failed calls are counted in errors like the ones of the recording, returns the records or -1 if the trace is broken
+static int sim_replay(struct sim_dev *dev, const char *dir, const char *name, int *errors)
+{
+    struct zerofs_trace_rec rec;
+    struct zerofs_file fp[ZEROFS_TRACE_SLOTS];
+    char fname[ZEROFS_TRACE_SLOTS][ZEROFS_TRACE_NAME_MAX+1];
+    char batch[ZEROFS_MAX_NUMBER_OF_FILES][ZEROFS_TRACE_NAME_MAX+1];
+    const char *names[ZEROFS_MAX_NUMBER_OF_FILES];
+    uint8_t *trace, *data;
+    uint32_t pos;
+    int len, flags, st = 0, r = 0, k, m, n = 0;
+
+    *errors = 0;
+    len = flash_payload(dev->sim.con, dir, name, -1, &trace);
+    if(len < 0) return(-1);
+    flags = zerofs_trace_header(trace, len, &pos);
+    if(flags < 0)
+    {
+        CONSOLE(dev->sim.con, "ERROR %s() '%s' is not a trace\n", __FUNCTION__, name);
+        free(trace);
+        return(-1);
+    }
+    memset(fp, 0, sizeof(fp));
+    memset(fname, 0, sizeof(fname));
+    // the recording starts in the mode of the device
+    if(!(flags & ZEROFS_TRACE_F_READ) != !zerofs_is_readonly_mode(&dev->zfs)) sim_setmode(dev, flags & ZEROFS_TRACE_F_READ);
+
+    while(!quit && (r = zerofs_trace_next(trace, len, &pos, &rec)) > 0)
+    {
+        n++;
+        switch(rec.op)
+        {
+            case ZEROFS_TRACE_CREATE:
+                strcpy(fname[rec.fd], rec.name);
+                if(dev->poll_mode) st = SIM_CALL(dev, "create", 0, sim_poll(dev, zerofs_trace_create_start(dev->trace, &dev->zfs, &dev->poll_op, &fp[rec.fd], rec.name)));
+                else st = SIM_CALL(dev, "create", 0, zerofs_trace_create(dev->trace, &dev->zfs, &fp[rec.fd], rec.name));
+                break;
+            case ZEROFS_TRACE_APPEND:
+                strcpy(fname[rec.fd], rec.name);
+                st = SIM_CALL(dev, "append", 0, zerofs_trace_append(dev->trace, &dev->zfs, &fp[rec.fd], rec.name));
+                break;
+            case ZEROFS_TRACE_OPEN:
+                strcpy(fname[rec.fd], rec.name);
+                st = SIM_CALL(dev, "open", 0, zerofs_trace_open(dev->trace, &dev->zfs, &fp[rec.fd], rec.name));
+                break;
+            case ZEROFS_TRACE_CLOSE:
+                st = SIM_CALL(dev, "close", 0, zerofs_trace_close(dev->trace, &fp[rec.fd]));
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_WRITE:
+                // metadata-only runs write the length only
+                if(meta_only) data = calloc(MAX(rec.arg, 1), 1);
+                else flash_payload(dev->sim.con, NULL, fname[rec.fd], rec.arg, &data);
+                if(dev->poll_mode) st = SIM_CALL(dev, "write", rec.arg, sim_poll(dev, zerofs_trace_write_start(dev->trace, &dev->zfs, &dev->poll_op, &fp[rec.fd], data, rec.arg)));
+                else st = SIM_CALL(dev, "write", rec.arg, zerofs_trace_write(dev->trace, &fp[rec.fd], data, rec.arg));
+                free(data);
+                break;
+            case ZEROFS_TRACE_READ:
+                data = malloc(MAX(rec.arg, 1));
+                st = SIM_CALL(dev, "read", rec.arg, zerofs_trace_read(dev->trace, &fp[rec.fd], data, rec.arg));
+                free(data);
+                break;
+            case ZEROFS_TRACE_SEEK:
+                st = SIM_CALL(dev, "seek", (int32_t)rec.arg, zerofs_trace_seek(dev->trace, &fp[rec.fd], (int32_t)rec.arg));
+                break;
+            case ZEROFS_TRACE_DELETE:
+                if(dev->poll_mode) st = SIM_CALL(dev, "delete", 0, sim_poll(dev, zerofs_trace_delete_start(dev->trace, &dev->zfs, &dev->poll_op, rec.name)));
+                else st = SIM_CALL(dev, "delete", 0, zerofs_trace_delete(dev->trace, &dev->zfs, rec.name));
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_DELETE_MANY:
+                // the names are the DELETE records of the batch
+                m = MIN(rec.arg, ZEROFS_MAX_NUMBER_OF_FILES);
+                for(k = 0; k < m && zerofs_trace_next(trace, len, &pos, &rec) > 0; k++)
+                {
+                    strcpy(batch[k], rec.name);
+                    names[k] = batch[k];
+                }
+                n += k;
+                st = SIM_CALL(dev, "delete_many", k, zerofs_trace_delete_many(dev->trace, &dev->zfs, names, k));
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_MODE:
+                st = sim_setmode(dev, rec.arg);
+                draw_update(1,1);
+                break;
+            case ZEROFS_TRACE_ERASE:
+                st = SIM_CALL(dev, "erase", rec.arg, zerofs_trace_background_erase_budget(dev->trace, &dev->zfs, rec.arg, rec.arg2, NULL));
+                break;
+            case ZEROFS_TRACE_IDLE:
+                sim_idle(dev, rec.arg);
+                st = 0;
+                break;
+        }
+        sim_cpu_charge(dev);
+        if(st < 0)
+        {
+            (*errors)++;
+            CONSOLE(dev->sim.con, "ERROR %s() record %d op %d '%s' st=%d\n", __FUNCTION__, n, rec.op, (rec.name[0] ? rec.name : fname[rec.fd]), st);
+        }
+    }
+    if(r < 0) CONSOLE(dev->sim.con, "ERROR %s() '%s' broken record at %u\n", __FUNCTION__, name, pos);
+    CONSOLE(dev->sim.con, "%s() '%s' records=%d errors=%d\n", __FUNCTION__, name, n, *errors);
+    free(trace);
+    return(r < 0 ? -1 : n);
+}
+
+// replay(trace) runs a workload trace of the data directory -> st, failed calls
+static int l_replay(lua_State *L)
+{
+  struct sim_dev *dev=sim_dev_L(L);
+  int errors;
+  int n = sim_replay(dev, dev->test_dir, luaL_checkstring(L, 1), &errors);
+
+  if(quit) return(luaL_error(L, "Interrupted"));
+  lua_pushinteger(L, (n < 0 ? -1 : 0));
+  lua_pushinteger(L, errors);
+  return(2);
+}
+
 void l_warn(void *ud, const char *msg, int tocont)
 {
   lua_State *L=ud;
+  struct sim_dev *dev=sim_dev_L(L);
   lua_Debug ar;
   lua_getstack(L, 1, &ar);
   lua_getinfo(L, "nSl", &ar);
   int line = ar.currentline;
-  CONSOLE(&conlog, "lua info line %d: %s\n", line, msg);
+  CONSOLE(dev->sim.con, "lua info line %d: %s\n", line, msg);
 }
 
 int l_assert(lua_State *L)
 {
+  struct sim_dev *dev=sim_dev_L(L);
   const char *msg = luaL_checkstring(L, 1);
   lua_Debug ar;
   lua_getstack(L, 1, &ar);
   lua_getinfo(L, "nSl", &ar);
   int line = ar.currentline;
-  CONSOLE(&conlog, "lua error line %d: %s\n", line, msg);
+  CONSOLE(dev->sim.con, "lua error line %d: %s\n", line, msg);
   const char *ret = luaL_optstring(L, 1, "test failed");
   lua_pushfstring(L, "%s", ret);
   return lua_error(L);
@@ -719,8 +1301,8 @@ int l_assert(lua_State *L)
 void lua_linehook(lua_State *L, lua_Debug *ar)
 {
   // called after every line of lua
-  // do nothing normally -- later on we can refresh the garphics from here
-  // or do some periodic processing
+  // charge the work of the last zerofs calls after their last flash operation
+  sim_cpu_charge(sim_dev_L(L));
 }
 
 static int luaopen_zerofslib(lua_State *L)
@@ -731,6 +1313,9 @@ static int luaopen_zerofslib(lua_State *L)
         { "setmode", l_setmode },
         { "printdebug", l_printdebug },
         { "delete", l_delete },
+        { "delete_many", l_delete_many },
+        { "delete_if", l_delete_if },
+        { "close", l_close },
         { "speed", l_speed },
         { "setdir", l_setdir },
         { "setstep", l_setstep },
@@ -738,7 +1323,16 @@ static int luaopen_zerofslib(lua_State *L)
         { "assert", l_assert },
         { "badblock", l_badblock },
         { "erase_async", l_erase_async },
+        { "erase_suspend", l_erase_suspend },
+        { "sleep_policy", l_sleep_policy },
+        { "flash_queue", l_flash_queue },
+        { "poll_mode", l_poll_mode },
+        { "idle", l_idle },
+        { "format", l_format },
+        { "reset", l_reset },
         { "dir", l_dir },
+        { "seed", l_seed },
+        { "replay", l_replay },
         { NULL, NULL }
     };
     luaL_newlib(L, funcs);
@@ -746,9 +1340,10 @@ static int luaopen_zerofslib(lua_State *L)
     return (1);
 }
 
-static lua_State *luainit(void)
+static lua_State *luainit(struct sim_dev *dev)
 {
     lua_State *L = luaL_newstate();
+    *(struct sim_dev **)lua_getextraspace(L) = dev;
     luaL_openlibs(L);
     lua_getglobal(L, "package");
     lua_getfield(L, -1, "preload");
@@ -761,17 +1356,240 @@ static lua_State *luainit(void)
 }
 
 
-int main(int argc, char **argv)
+// a formatted device with erased flash, con is its log (NULL for none), the seed selects its bad blocks and workload
+static int sim_dev_open(struct sim_dev *dev, struct console *con, uint64_t seed)
 {
-    if(argc < 2)
+    uint8_t sfdp[0x30+16*4];
+
+    memset(dev, 0, sizeof(*dev));
+    // flash empty state is FF, metadata-only runs keep no data flash contents
+    if(!meta_only)
     {
-        printf("Usage: %s testfile.lua\n", argv[0]);
-        exit(0);
+        dev->mem_flash = malloc(SIM_FLASH_SIZE);
+        if(NULL == dev->mem_flash) return(-1);
+        memset(dev->mem_flash, 0xff, SIM_FLASH_SIZE);
+    }
+    memset(dev->mem_super, 0xff, sizeof(dev->mem_super));
+    flash_sim_init(&dev->sim, con, seed);
+    dev->sim.cpu = sim_cpu;
+    dev->sim.user = dev;
+    for(int d = 0; d < ZEROFS_DATA_DEVICES; d++)
+    {
+        flash_area_open(&dev->sim, FLASH_AREA_NFFS + d, &dev->fa[d], fas);
+        if(NULL != dev->mem_flash) dev->fa[d].flash = dev->mem_flash + d * SIM_DEV_SIZE;
+        dev->devs[d] = &dev->fa[d];
     }
+    flash_area_open(&dev->sim, FLASH_AREA_SUPER, SIM_SUPER(dev), fas);
+    SIM_SUPER(dev)->flash = dev->mem_super;
+    sim_sfdp(sfdp, SIM_DEV_SIZE, &dev->fa[0].prop);
+    if(zerofs_sfdp_parse(sfdp, sizeof(sfdp), &dev->geo)<0) CONSOLE(con, "ERROR %s\n", "sfdp parse failed");
+    else CONSOLE(con, "sfdp sectors=%u erase=%02xh %u us page=%u program=%u ns/byte\n", dev->geo.sectors, dev->geo.erase_opcode, dev->geo.erase_us, dev->geo.page_size, dev->geo.program_byte_ns);
+    dev->fac = sim_fac;
+#if (ZEROFS_SUPER_PAGED==0)
+    dev->fac.superblock_banks = dev->mem_super;
+#endif
+    dev->fac.data_ud = &dev->fa[0];
+    dev->fac.super_ud = SIM_SUPER(dev);
+    dev->fac.data_devs = dev->devs;
+    dev->fac.geometry = &dev->geo;
+    zerofs_init(&dev->zfs, &dev->fac);
+    zerofs_format(&dev->zfs);
+    return(0);
+}
 
-    CONSOLE(&conlog, "\nTEST %s %s STARTED AT %ld\n",argv[0],argv[1],time(NULL));
+// run the script on the device, the reports go to its log and the summary lines to f if not NULL
+// the areas stay open for sim_dev_stats(), returns 0 if the script passed
+static int sim_dev_run(struct sim_dev *dev, const char *script, double run_days, FILE *f)
+{
+    lua_State *L = luainit(dev);
+    int st = 0;
 
-    char *bn = basename(argv[1]);
+    lua_sethook(L, lua_linehook, LUA_MASKLINE | LUA_MASKCALL, 0);
+    // workload traces run without a script
+    if(flash_is_trace(script))
+    {
+        int errors, n = sim_replay(dev, NULL, script, &errors);
+        st = (n < 0);
+        if(NULL != f) fprintf(f, "replay trace=%s records=%d errors=%d\n", script, n, errors);
+    }
+    else if(luaL_dofile(L, script))
+    {
+        CONSOLE(dev->sim.con, "lua error %s\n", lua_tostring(L, -1));
+        if(NULL != f) fprintf(f, "error=\"%s\"\n", lua_tostring(L, -1));
+        st = 1;
+    }
+    if(0 == st)
+    {
+        flash_report_throughput(dev->fa, ZEROFS_DATA_DEVICES);
+        flash_report_timeline(dev->fa, ZEROFS_DATA_DEVICES+1);
+        flash_report_lifetime(f, dev->fa, ZEROFS_DATA_DEVICES+1, run_days);
+    }
+    if(NULL != f) for(int d = 0; d <= ZEROFS_DATA_DEVICES; d++) flash_area_summary(f, &dev->fa[d]);
+    lua_close(L);
+    return(st);
+}
+
+// --record: the calls of the script go to a workload trace
+// without a clock, the requested idle time is recorded by sim_idle() and not the blocking erases of zerofs_idle()
+static int sim_trace_emit(void *ud, const uint8_t *data, uint32_t len)
+{
+    return(fwrite(data, 1, len, ((struct sim_dev *)ud)->trace_f) == len ? 0 : -1);
+}
+
+static void sim_dev_close(struct sim_dev *dev)
+{
+    if(NULL != dev->trace)
+    {
+        zerofs_trace_flush(dev->trace);
+        CONSOLE(dev->sim.con, "trace dropped=%u\n", dev->trace->dropped);
+        fclose(dev->trace_f);
+        dev->trace = NULL;
+        dev->trace_f = NULL;
+    }
+    for(int d = 0; d <= ZEROFS_DATA_DEVICES; d++) flash_area_close(&dev->fa[d]);
+    if(dev->poll_calls>0) CONSOLE(dev->sim.con, "poll calls=%ld max step=%.1f us\n", dev->poll_calls, dev->poll_step_max);
+    free(dev->mem_flash);
+    free(dev->test_dir);
+    dev->mem_flash = NULL;
+    dev->test_dir = NULL;
+}
+
+// per-device results of a fleet run
+struct sim_result
+{
+    int st;                     // -1 if the device could not be simulated
+    double clock_us;
+    double erases_per_day;      // sum of the data devices
+    double wear_max_per_day;    // most worn data sector
+    double years_first_bad;     // the first area to reach its lifecycle, the superblock included
+    double rd_lat_p99_us;       // slowest data device
+};
+
+static void sim_dev_stats(struct sim_dev *dev, double run_days, struct sim_result *r)
+{
+    struct flash_stats fst;
+
+    r->clock_us = dev->sim.clock_us;
+    r->years_first_bad = INFINITY;
+    for(int d = 0; d <= ZEROFS_DATA_DEVICES; d++)
+    {
+        if(flash_area_stats(&dev->fa[d], run_days, &fst) < 0) continue;
+        r->years_first_bad = fmin(r->years_first_bad, fst.years_first_bad);
+        if(SIM_SUPER(dev) == &dev->fa[d]) continue;
+        r->erases_per_day += fst.erases_per_day;
+        r->wear_max_per_day = fmax(r->wear_max_per_day, fst.wear_max_per_day);
+        r->rd_lat_p99_us = fmax(r->rd_lat_p99_us, fst.rd_lat_p99_us);
+    }
+}
+
+// fleet run: a pool of threads simulates the devices, device i runs script i modulo the scripts with seed+i
+static struct
+{
+    char **scripts;
+    int scripts_n;
+    int devices;
+    uint64_t seed;
+    double run_days;
+    int next;                   // next device to simulate
+    pthread_mutex_t lock;
+    struct sim_result *res;
+} fleet = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void *fleet_worker(void *arg)
+{
+    struct sim_dev *dev = malloc(sizeof(*dev));
+    int i;
+
+    while(NULL != dev)
+    {
+        pthread_mutex_lock(&fleet.lock);
+        i = fleet.next++;
+        pthread_mutex_unlock(&fleet.lock);
+        if(i >= fleet.devices) break;
+        if(sim_dev_open(dev, NULL, fleet.seed + i) < 0) continue;
+        fleet.res[i].st = sim_dev_run(dev, fleet.scripts[i % fleet.scripts_n], fleet.run_days, NULL);
+        sim_dev_stats(dev, fleet.run_days, &fleet.res[i]);
+        sim_dev_close(dev);
+    }
+    free(dev);
+    return(NULL);
+}
+
+static int fleet_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return((x > y) - (x < y));
+}
+
+// distribution of a result field over the devices with nearest rank percentiles
+#define FLEET_P(v, n, p) ((v)[(int)ceil((p) * (n)) - 1])
+static void fleet_report(FILE *f, const char *name, size_t off)
+{
+    double *v = malloc(fleet.devices * sizeof(double));
+    int i, n = fleet.devices;
+
+    if(NULL == v) return;
+    for(i = 0; i < n; i++) memcpy(&v[i], (const char *)&fleet.res[i] + off, sizeof(double));
+    qsort(v, n, sizeof(double), fleet_cmp);
+    fprintf(f, "fleet metric=%s min=%.6g p50=%.6g p90=%.6g p99=%.6g max=%.6g\n", name, v[0], FLEET_P(v, n, 0.5), FLEET_P(v, n, 0.9), FLEET_P(v, n, 0.99), v[n - 1]);
+    free(v);
+}
+
+static int run_fleet(char **scripts, int scripts_n, int devices, int threads, uint64_t seed, double run_days)
+{
+    struct timespec host_t0, host_t1;
+    pthread_t *tid;
+    int i, n, passed = 0;
+
+    if(threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    threads = MAX(MIN(threads, devices), 1);
+    fleet.scripts = scripts;
+    fleet.scripts_n = scripts_n;
+    fleet.devices = devices;
+    fleet.seed = seed;
+    fleet.run_days = run_days;
+    fleet.res = calloc(devices, sizeof(*fleet.res));
+    tid = calloc(threads, sizeof(*tid));
+    if(NULL == fleet.res || NULL == tid) { fprintf(stderr, "out of memory\n"); return(1); }
+    for(i = 0; i < devices; i++) fleet.res[i].st = -1;
+    clock_gettime(CLOCK_MONOTONIC, &host_t0);
+    for(n = 0; n < threads; n++) if(pthread_create(&tid[n], NULL, fleet_worker, NULL) != 0) break;
+    if(n == 0) fleet_worker(NULL);
+    for(i = 0; i < n; i++) pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &host_t1);
+
+    for(i = 0; i < devices; i++)
+    {
+        struct sim_result *r = &fleet.res[i];
+        if(r->st == 0) passed++;
+        printf("device=%d seed=%llu script=%s result=%s sim_clock_us=%.1f erases_per_day=%.3f wear_max_per_day=%.6f years_first_bad=%.2f rd_lat_p99_us=%.0f\n", i, (unsigned long long)(seed + i), scripts[i % scripts_n],
+               (r->st == 0 ? "PASSED" : "FAILED"), r->clock_us, r->erases_per_day, r->wear_max_per_day, r->years_first_bad, r->rd_lat_p99_us);
+    }
+    fleet_report(stdout, "sim_clock_us", offsetof(struct sim_result, clock_us));
+    fleet_report(stdout, "erases_per_day", offsetof(struct sim_result, erases_per_day));
+    fleet_report(stdout, "wear_max_per_day", offsetof(struct sim_result, wear_max_per_day));
+    fleet_report(stdout, "years_first_bad", offsetof(struct sim_result, years_first_bad));
+    fleet_report(stdout, "rd_lat_p99_us", offsetof(struct sim_result, rd_lat_p99_us));
+    printf("result=%s fleet=%d passed=%d threads=%d host_ms=%.1f\n", (passed == devices ? "PASSED" : "FAILED"), devices, passed, MAX(n, 1),
+           (host_t1.tv_sec - host_t0.tv_sec)*1e3 + (host_t1.tv_nsec - host_t0.tv_nsec)/1e6);
+    free(tid);
+    free(fleet.res);
+    return(passed == devices ? 0 : 1);
+}
+
+static int run_single(const char *prog, char *script, uint64_t seed, double run_days, const char *record, const char *timeline)
+{
+    struct timespec host_t0, host_t1;
+    struct console *con = &conlog;
+    struct zerofs_trace tr;
+    struct sim_dev *dev;
+    int st;
+
+    clock_gettime(CLOCK_MONOTONIC, &host_t0);
+
+    CONSOLE(con, "\nTEST %s %s STARTED AT %ld\n",prog,script,time(NULL));
+
+    char *bn = basename(script);
     char *dot = strrchr(bn, '.');
     if(dot != NULL)
     {
@@ -783,66 +1601,156 @@ int main(int argc, char **argv)
     } else
         test_out = strdup("OUT");
 
-    // flash empty state is FF
-    memset(mem_flash, 0xff, sizeof(mem_flash));
-    memset(mem_super, 0xff, sizeof(mem_super));
-
-    lua_State *L = luainit();
-
-    setlocale(LC_ALL, "");
-    initscr();                  // Start ncurses mode
-    noecho();                   // Don't echo typed chars
-    curs_set(0);                // Hide the cursor
-    keypad(stdscr, TRUE);       // Enable arrow keys, etc.
-
-    use_default_colors();
-    if(has_colors())
+    dev = malloc(sizeof(*dev));
+    if(NULL == dev || sim_dev_open(dev, con, seed) < 0)
     {
-        start_color();
-        colors_supported=1;
+        fprintf(stderr, "out of memory\n");
+        free(dev);
+        return(1);
+    }
+    if(NULL != record)
+    {
+        dev->trace_f = fopen(record, "wb");
+        if(NULL == dev->trace_f)
+        {
+            fprintf(stderr, "cannot create %s\n", record);
+            sim_dev_close(dev);
+            free(dev);
+            return(1);
+        }
+        zerofs_trace_init(&tr, &dev->zfs, sim_trace_emit, NULL, dev);
+        dev->trace = &tr;
+    }
+    if(NULL != timeline && flash_timeline_open(&dev->sim) < 0)
+    {
+        fprintf(stderr, "cannot record the timeline\n");
+        sim_dev_close(dev);
+        free(dev);
+        return(1);
     }
 
-    getmaxyx(stdscr, height, width);
+    if(!headless)
+    {
+        setlocale(LC_ALL, "");
+        initscr();                  // Start ncurses mode
+        noecho();                   // Don't echo typed chars
+        curs_set(0);                // Hide the cursor
+        keypad(stdscr, TRUE);       // Enable arrow keys, etc.
+
+        use_default_colors();
+        if(has_colors())
+        {
+            start_color();
+            colors_supported=1;
+        }
 
-    flash_area_open(FLASH_AREA_NFFS, &fa[0], &fas[0]);
-    flash_area_open(FLASH_AREA_SUPER, &fa[1], &fas[1]);
-    zerofs_init(&zfs, &fac);
-    zerofs_format(&zfs);
-    
-    draw_init=1;
+        getmaxyx(stdscr, height, width);
+    }
+
+    tui=dev;
+    draw_init=!headless;
     draw_update(0,1);
 
-    lua_sethook(L, lua_linehook, LUA_MASKLINE | LUA_MASKCALL, 0);
-    if(luaL_dofile(L, argv[1]))
+    st = sim_dev_run(dev, script, run_days, (headless ? stdout : NULL));
+    if(st)
     {
-        CONSOLE(&conlog, "lua error %s\n", lua_tostring(L, -1));
-        lua_pop(L, 1);
         step_through=1;
         draw_update(1,1);
         quit=0;
-        flash_area_close(&fa[0]);
-        flash_area_close(&fa[1]);
     }
-    else
+    if(NULL != timeline)
     {
-      flash_area_close(&fa[0]);
-      flash_area_close(&fa[1]);
-      CONSOLE(&conlog, "%s max_stack=%ld\n", "TEST PASSED", 0L);
+        const char *pn = strrchr(prog, '/');
+        int n = flash_timeline_export(&dev->sim, timeline, (NULL != pn ? pn + 1 : prog), dev->fa, ZEROFS_DATA_DEVICES+1);
+        if(n < 0) fprintf(stderr, "cannot write %s\n", timeline);
+        else CONSOLE(con, "timeline events=%d file=%s\n", n, timeline);
+        flash_timeline_close(&dev->sim);
+    }
+    sim_dev_close(dev);
+    if(!st)
+    {
+      CONSOLE(con, "%s max_stack=%ld\n", "TEST PASSED", 0L);
       step_through=1;
       draw_update(1,1);
     }
-    l_printdebug(NULL);
+    sim_printdebug(con);
 
-    curs_set(1);
-    echo();
+    if(headless)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &host_t1);
+        flash_cpu_summary(stdout, &dev->sim);
+        printf("result=%s script=%s sim_clock_us=%.1f host_ms=%.1f poll_calls=%ld\n", (st ? "FAILED" : "PASSED"), script, dev->sim.clock_us, (host_t1.tv_sec - host_t0.tv_sec)*1e3 + (host_t1.tv_nsec - host_t0.tv_nsec)/1e6, dev->poll_calls);
+    }
+    else
+    {
+        curs_set(1);
+        echo();
 
-    endwin();                   // Restore normal terminal behavior
+        endwin();                   // Restore normal terminal behavior
+    }
+    tui=NULL;
+    draw_init=0;
+    free(dev);
+    return(st);
+}
 
-    lua_close(L);
+
+int main(int argc, char **argv)
+{
+    const char *flash_profile = NULL, *mcu_profile = NULL, *cpu_profile = NULL, *record = NULL, *timeline = NULL;
+    int shared_bus = 0;
+    double run_days = 0.0;
+    uint64_t seed = 0;
+    int fleet_n = 0, threads = 0;
+    int argi = 1;
+    int st = 0;
+
+    for(; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if(strcmp(argv[argi], "--headless") == 0) headless = 1;
+        else if(strcmp(argv[argi], "--flash") == 0 && argi + 1 < argc) flash_profile = argv[++argi];
+        else if(strcmp(argv[argi], "--mcu") == 0 && argi + 1 < argc) mcu_profile = argv[++argi];
+        else if(strcmp(argv[argi], "--shared-bus") == 0) shared_bus = 1;
+        else if(strcmp(argv[argi], "--cpu") == 0 && argi + 1 < argc) cpu_profile = argv[++argi];
+        else if(strcmp(argv[argi], "--meta-only") == 0) meta_only = 1;
+        else if(strcmp(argv[argi], "--days") == 0 && argi + 1 < argc) run_days = atof(argv[++argi]);
+        else if(strcmp(argv[argi], "--seed") == 0 && argi + 1 < argc) seed = strtoull(argv[++argi], NULL, 0);
+        else if(strcmp(argv[argi], "--fleet") == 0 && argi + 1 < argc) fleet_n = atoi(argv[++argi]);
+        else if(strcmp(argv[argi], "--threads") == 0 && argi + 1 < argc) threads = atoi(argv[++argi]);
+        else if(strcmp(argv[argi], "--record") == 0 && argi + 1 < argc) record = argv[++argi];
+        else if(strcmp(argv[argi], "--timeline") == 0 && argi + 1 < argc) timeline = argv[++argi];
+        else break;
+    }
+    // a trace and a timeline record a single device
+    if(argi >= argc || (fleet_n <= 0 && argi != argc - 1) || (fleet_n > 0 && (NULL != record || NULL != timeline)))
+    {
+        printf("Usage: %s [--headless] [--flash profile] [--mcu profile] [--shared-bus] [--cpu profile] [--meta-only] [--days d] [--seed s] [--record trace] [--timeline file.json] testfile.lua|trace\n"
+               "       %s [options] --fleet devices [--threads t] testfile.lua|trace [testfile.lua|trace ...]\n", argv[0], argv[0]);
+        exit(0);
+    }
+    // fleet devices have no terminal and no log
+    if(fleet_n > 0) headless = 1;
+
+    // part profiles replace the built-in timings, the geometry of the build stays
+    for(int i = 0; fas[i].id >= 0; i++)
+    {
+        const char *profile = (fas[i].id == FLASH_AREA_SUPER ? mcu_profile : flash_profile);
+        // striped data devices on one SPI bus share its transfer time
+        if(shared_bus && fas[i].id != FLASH_AREA_SUPER) fas[i].device = 1;
+        // zerofs keeps no metadata in the data flash, only the superblock needs the contents
+        fas[i].meta = (meta_only && fas[i].id != FLASH_AREA_SUPER);
+        int sector_size = (fas[i].id == FLASH_AREA_SUPER ? ZEROFS_SUPER_SECTOR_SIZE : ZEROFS_FLASH_SECTOR_SIZE);
+        if(NULL == profile) continue;
+        if(flash_prop_load(profile, &fas[i].prop) < 0) return(1);
+        if(fas[i].prop.sector_size != sector_size) { fprintf(stderr, "profile %s has %d byte sectors, the build uses %d\n", profile, fas[i].prop.sector_size, sector_size); return(1); }
+    }
+    if(NULL != cpu_profile && cpu_prop_load(cpu_profile, &sim_cpu) < 0) return(1);
+
+    if(fleet_n > 0) st = run_fleet(argv + argi, argc - argi, fleet_n, threads, seed, run_days);
+    else st = run_single(argv[0], argv[argi], seed, run_days, record, timeline);
 
     for(int i = 0; i < ARRAY_SIZE(conlog.line); i++) if(NULL != conlog.line[i]) free(conlog.line[i]);
-    if(NULL != test_dir) free(test_dir);
     if(NULL != test_out) free(test_out);
 
-    return(0);
+    return(headless ? st : 0);
 }
@@ -38,6 +38,16 @@
 #define ZEROFS_FLASH_SECTOR_SIZE (4096)
 #endif
 
+// erase unit of the data flash, a multiple of the sector size (e.g. parts with 64KB erase only)
+#ifndef ZEROFS_ERASE_BLOCK_SIZE
+#define ZEROFS_ERASE_BLOCK_SIZE ZEROFS_FLASH_SECTOR_SIZE
+#endif
+
+// data flash size from struct zerofs_geometry at init, ZEROFS_FLASH_SIZE_KB is the largest supported one
+#ifndef ZEROFS_RUNTIME_GEOMETRY
+#define ZEROFS_RUNTIME_GEOMETRY (0)
+#endif
+
 #ifndef ZEROFS_MAX_NUMBER_OF_FILES
 #define ZEROFS_MAX_NUMBER_OF_FILES (191)
 #endif
@@ -46,6 +56,22 @@
 #define ZEROFS_SUPER_SECTOR_SIZE (4096)
 #endif
 
+#ifndef ZEROFS_SUPER_BANKS
+#define ZEROFS_SUPER_BANKS (2)
+#endif
+
+#ifndef ZEROFS_SUPER_PAGED
+#define ZEROFS_SUPER_PAGED (0)
+#endif
+
+#ifndef ZEROFS_SUPER_PAGE_SIZE
+#define ZEROFS_SUPER_PAGE_SIZE (64)
+#endif
+
+#ifndef ZEROFS_SUPER_CACHE_PAGES
+#define ZEROFS_SUPER_CACHE_PAGES (3)
+#endif
+
 #ifndef ZEROFS_SUPER_WRITE_GRANULARITY
 #define ZEROFS_SUPER_WRITE_GRANULARITY (4)
 #endif
@@ -54,6 +80,80 @@
 #define ZEROFS_VERIFY (0)
 #endif
 
+// typical erase time estimates for the background erase budget, one erase block of the data flash
+#ifndef ZEROFS_SECTOR_ERASE_US
+#define ZEROFS_SECTOR_ERASE_US (36000)
+#endif
+
+#ifndef ZEROFS_SUPER_ERASE_US
+#define ZEROFS_SUPER_ERASE_US ZEROFS_SECTOR_ERASE_US
+#endif
+
+// typical program time per byte of the superblock flash, zerofs_poll() splits the superblock programs by it
+#ifndef ZEROFS_SUPER_PROGRAM_BYTE_NS
+#define ZEROFS_SUPER_PROGRAM_BYTE_NS (16875)
+#endif
+
+// max adjacent erase blocks erased by one fls_erase() call in the background
+#ifndef ZEROFS_ERASE_COALESCE_MAX
+#define ZEROFS_ERASE_COALESCE_MAX (16)
+#endif
+
+// background erase progress in sectors between two erase log records in the superblock
+#ifndef ZEROFS_ERASE_LOG_STEP
+#define ZEROFS_ERASE_LOG_STEP (64)
+#endif
+
+// v2 flash interface: number of flash operations in flight
+#ifndef ZEROFS_FOP_QUEUE_DEPTH
+#define ZEROFS_FOP_QUEUE_DEPTH (4)
+#endif
+
+// data flash devices, sector s of the data area is sector s/N of device s%N
+#ifndef ZEROFS_DATA_DEVICES
+#define ZEROFS_DATA_DEVICES (1)
+#endif
+
+// max estimated flash time of one zerofs_poll() call and the typical program time per byte
+#ifndef ZEROFS_POLL_BUDGET_US
+#define ZEROFS_POLL_BUDGET_US (2000)
+#endif
+
+#ifndef ZEROFS_PROGRAM_BYTE_NS
+#define ZEROFS_PROGRAM_BYTE_NS (3500)
+#endif
+
+// check EMPTY sectors for 0xff before an inline erase, blank sectors are used without erase
+#ifndef ZEROFS_BLANK_CHECK
+#define ZEROFS_BLANK_CHECK (0)
+#endif
+
+// bytes read at once by the blank check when there is no fls_blank_check()
+#ifndef ZEROFS_BLANK_CHECK_CHUNK
+#define ZEROFS_BLANK_CHECK_CHUNK (64)
+#endif
+
+// a sector failing the blank check after its first chunk skips the full check of the next N sectors
+#ifndef ZEROFS_BLANK_CHECK_BACKOFF
+#define ZEROFS_BLANK_CHECK_BACKOFF (8)
+#endif
+
+// typical time of one blank check read, zerofs_poll() splits the blank check by it
+#ifndef ZEROFS_BLANK_CHECK_CHUNK_US
+#define ZEROFS_BLANK_CHECK_CHUNK_US (80)
+#endif
+
+// count the sector_map and namemap probes and the copied bytes in struct zerofs_cpu_stats for CPU cost models
+#ifndef ZEROFS_CPU_STATS
+#define ZEROFS_CPU_STATS (0)
+#endif
+
+// called with begin 1 before and 0 after the long internal steps (superblock repack, file relocation),
+// the simulator draws them on its timeline, name is a string literal
+#ifndef ZEROFS_SPAN
+#define ZEROFS_SPAN(zfs, name, begin) ((void)0)
+#endif
+
 #ifndef ZEROFS_PACKED
 #define ZEROFS_PACKED __attribute__((packed))
 #endif
@@ -78,8 +178,16 @@
 
 static_assert(ZEROFS_FLASH_SECTOR_SIZE<=0xffff,"Sector size must be fit in 16 bit");
 static_assert(ZEROFS_MAX_NUMBER_OF_FILES<=ZEROFS_MAX_FILES,"Max number of files with this superblock structure is 0xfd");
+static_assert(ZEROFS_SUPER_BANKS>=2&&ZEROFS_SUPER_BANKS<=8,"Number of superblock banks should be between 2 and 8");
+static_assert((ZEROFS_FLASH_SECTOR_SIZE%ZEROFS_BLANK_CHECK_CHUNK)==0, "ZEROFS_BLANK_CHECK_CHUNK should divide the sector size");
+static_assert(ZEROFS_FOP_QUEUE_DEPTH>=1&&ZEROFS_FOP_QUEUE_DEPTH<=255, "ZEROFS_FOP_QUEUE_DEPTH should be between 1 and 255");
 
 #define ZEROFS_NUMBER_OF_SECTORS ((ZEROFS_FLASH_SIZE_KB*1024)/ZEROFS_FLASH_SECTOR_SIZE)
+static_assert(ZEROFS_DATA_DEVICES>=1&&(ZEROFS_NUMBER_OF_SECTORS%ZEROFS_DATA_DEVICES)==0, "ZEROFS_DATA_DEVICES should divide the number of sectors");
+
+#define ZEROFS_SECTORS_PER_BLOCK (ZEROFS_ERASE_BLOCK_SIZE/ZEROFS_FLASH_SECTOR_SIZE)
+static_assert((ZEROFS_ERASE_BLOCK_SIZE%ZEROFS_FLASH_SECTOR_SIZE)==0&&(ZEROFS_NUMBER_OF_SECTORS%ZEROFS_SECTORS_PER_BLOCK)==0, "ZEROFS_ERASE_BLOCK_SIZE should be a multiple of the sector size and divide the flash");
+static_assert(ZEROFS_SECTORS_PER_BLOCK==1||ZEROFS_DATA_DEVICES==1, "erase blocks larger than a sector are not supported on striped data devices");
 
 #define ZEROFS_SUPERBLOCK_VERSION_MAX (0xfffe)
 
@@ -87,6 +195,11 @@ static_assert(ZEROFS_MAX_NUMBER_OF_FILES<=ZEROFS_MAX_FILES,"Max number of files
 #define ZEROFS_MAP_ERASED   (0xfeu)
 #define ZEROFS_MAP_BAD      (0xfdu)
 
+// bit set of namemap entries
+#define ZEROFS_IDSET_SIZE ((ZEROFS_MAX_NUMBER_OF_FILES+7)/8)
+#define ZEROFS_IDSET_HAS(set, id) (((set)[(id)>>3]&(1u<<((id)&7)))!=0)
+#define ZEROFS_IDSET_ADD(set, id) ((set)[(id)>>3]|=(1u<<((id)&7)))
+
 #define ZEROFS_SUPER_MAPPED (~(uint16_t)0)
 
 typedef uint16_t sector_t;
@@ -95,10 +208,44 @@ typedef uint16_t sector_t;
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #endif
 
+#ifndef MAX
+#define MAX(a,b) (((a)>(b))?(a):(b))
+#endif
+
 #ifndef ABS
 #define ABS(a) ((a)<0 ? -(a) : (a))
 #endif
 
+// v2 flash interface operations
+#define ZEROFS_FOP_READ     (0)
+#define ZEROFS_FOP_PROGRAM  (1)
+#define ZEROFS_FOP_ERASE    (2)
+
+#define ZEROFS_FOP_F_BACKGROUND (1u<<0)   // erase, may complete when the device accepted it
+#define ZEROFS_FOP_F_DONE       (1u<<7)   // set by zerofs_fop_complete()
+
+// v2 flash interface descriptor, owned by zerofs until completed
+struct zerofs_fop
+{
+  void *ud;                     // device: data device or super_ud
+  uint32_t addr;
+  uint8_t *buf;                 // read destination or program source, NULL for erase
+  uint32_t len;
+  uint8_t op;                   // ZEROFS_FOP_*
+  volatile uint8_t flags;       // ZEROFS_FOP_F_*
+  int32_t result;               // bytes done or negative error
+};
+
+// data flash geometry, filled by the driver or by zerofs_sfdp_parse()
+struct zerofs_geometry
+{
+  uint32_t sectors;             // data sectors of ZEROFS_FLASH_SECTOR_SIZE on all data devices
+  uint32_t erase_us;            // typical erase block erase time, 0 is ZEROFS_SECTOR_ERASE_US
+  uint32_t program_byte_ns;     // typical program time per byte, 0 is ZEROFS_PROGRAM_BYTE_NS
+  uint16_t page_size;           // program page size for the driver
+  uint8_t erase_opcode;         // erase block erase instruction for the driver
+};
+
 // rom struct for flash access
 struct zerofs_flash_access
 {
@@ -108,6 +255,25 @@ struct zerofs_flash_access
   const uint8_t *superblock_banks;
   void *data_ud;
   void *super_ud;
+  // optional, NULL if the device cannot suspend a background erase
+  int (*fls_erase_suspend)(void *ud);
+  int (*fls_erase_resume)(void *ud);
+  int (*fls_busy)(void *ud);
+  // optional, returns 1 if the range reads all 0xff, NULL to check with fls_read
+  int (*fls_blank_check)(void *ud, uint32_t addr, uint32_t len);
+  // optional, power down the data flash and wake it up
+  int (*fls_sleep)(void *ud);
+  int (*fls_wake)(void *ud);
+  // optional v2 queue interface, NULL runs the operations synchronously with fls_read/fls_write/fls_erase
+  // fls_submit() queues the operation and the driver calls zerofs_fop_complete() when it is done,
+  // operations of one device complete in submission order
+  int (*fls_submit)(void *ud, struct zerofs_fop *op);
+  // optional, called while waiting for a completion, polled drivers complete operations here
+  int (*fls_poll)(void *ud);
+  // ZEROFS_DATA_DEVICES>1: the devices of the striped data area, data_ud only identifies the area
+  void *const *data_devs;
+  // ZEROFS_RUNTIME_GEOMETRY: the data flash geometry, NULL is ZEROFS_FLASH_SIZE_KB
+  const struct zerofs_geometry *geometry;
 };
 
 enum zerofs_mode
@@ -118,8 +284,14 @@ enum zerofs_mode
   ZEROFS_MODEMAX
 };
 
+#if (ZEROFS_SUPER_PAGED==0)
 #define ZEROFS_SECTOR_MAP(zfs) ( (zfs)->sector_map ? (zfs)->sector_map : (zfs)->superblock->sector_map )
 
+#define ZEROFS_SUPER_BANK(zfs, b) ((const struct zerofs_superblock *)((zfs)->fls->superblock_banks + ((b)*ZEROFS_SUPER_SECTOR_SIZE)))
+#else
+#define ZEROFS_SUPER_BANK(zfs, b) ((const struct zerofs_superblock *)NULL)
+#endif
+
 #define ZEROFS_TYPE_UNKNOWN (0)
 
 // error codes
@@ -135,9 +307,26 @@ enum zerofs_mode
 #define ZEROFS_ERR_INVALIDNAME (-11)
 #define ZEROFS_ERR_INVALIDFP   (-12)
 #define ZEROFS_ERR_ENDOFDIR    (-13)
+#define ZEROFS_ERR_BUSY        (-14) // another non-blocking operation is running
+
+// non-blocking operation is not finished, call zerofs_poll()
+#define ZEROFS_IN_PROGRESS     (1)
+
+// number of data sectors, sector index of the ring and the estimated flash times
+#if (ZEROFS_RUNTIME_GEOMETRY!=0)
+#define ZEROFS_SECTORS(zfs) ((zfs)->sectors)
+#define ZEROFS_RING(zfs, s) ((zfs)->ring_mask ? ((s)&(zfs)->ring_mask) : ((s)%(zfs)->sectors))
+#define ZEROFS_ERASE_US(zfs) ((zfs)->erase_us)
+#define ZEROFS_BYTE_NS(zfs) ((zfs)->program_byte_ns)
+#else
+#define ZEROFS_SECTORS(zfs) (ZEROFS_NUMBER_OF_SECTORS)
+#define ZEROFS_RING(zfs, s) ((s)%ZEROFS_NUMBER_OF_SECTORS)
+#define ZEROFS_ERASE_US(zfs) (ZEROFS_SECTOR_ERASE_US)
+#define ZEROFS_BYTE_NS(zfs) (ZEROFS_PROGRAM_BYTE_NS)
+#endif
 
 // get sector_map index from the base of last_written
-#define ZEROFS_BLOCK(zfs, i) (((zfs)->meta.last_written+(i))%ZEROFS_NUMBER_OF_SECTORS)
+#define ZEROFS_BLOCK(zfs, i) ZEROFS_RING(zfs, (zfs)->meta.last_written+(i))
 
 static_assert(sizeof(int)>=4, "int should be at least 4 bytes");
 
@@ -166,14 +355,35 @@ static_assert( (ZEROFS_NUMBER_OF_SECTORS % ZEROFS_SUPER_WRITE_GRANULARITY) == 0,
 #define ZEROFS_NM_GET_SIZE(nm) ((nm)->type_len&0xffffff)
 
 #define ZEROFS_FLAGS_EMPTY      (1u<<0)
+#define ZEROFS_FLAGS_ACTIVE     (1u<<1)    // data flash accessed since the last zerofs_idle()
+#define ZEROFS_FLAGS_ASLEEP     (1u<<2)    // data flash is powered down
+#define ZEROFS_FLAGS_SLEEP_ERASE (1u<<3)   // finish the background erase before powering down
 
 static_assert(sizeof(struct zerofs_namemap)==16, "struct zerofs_namemap length should be 16");
 
+// append log record, programmed downwards from the top of the namemap area during a WRITE session
+// supersedes the first sector/offset and the length of file 'id', folded into the namemap on repack
+struct ZEROFS_PACKED zerofs_applog
+{
+  sector_t first_sector;
+  uint16_t first_offset;
+  uint32_t id_len;              // id and length combined: MSB is id 3 LSB are length
+};
+
+static_assert(sizeof(struct zerofs_applog)*2==sizeof(struct zerofs_namemap), "struct zerofs_applog should be half of a namemap entry");
+static_assert( (sizeof(struct zerofs_applog) % ZEROFS_SUPER_WRITE_GRANULARITY) == 0, "struct zerofs_applog not matching to ZEROFS_SUPER_WRITE_GRANULARITY");
+
+#define ZEROFS_APPLOG_TOP (ZEROFS_MAX_NUMBER_OF_FILES*sizeof(struct zerofs_namemap))
+
+// erase log record: append log record of id 0xff, the length is the erased_max reached by the background erase
+// of the READ session, a WRITE session in the same bank starts with a record of 0 that voids the older ones
+#define ZEROFS_APPLOG_ERASED (0xffu)
+
 struct zerofs_metadata
 {
   uint16_t last_written;			              // last written block
   uint16_t last_written_len;		                      // length of the last written block or 0 if no data
-  uint16_t version;                                           // choose the smaller on boot
+  uint16_t version;                                           // counts down, choose the newest on boot
   uint16_t padding;
 };
 
@@ -188,13 +398,42 @@ struct zerofs_superblock
   struct zerofs_metadata meta;
 };
 
+#if (ZEROFS_SUPER_PAGED!=0)
+static_assert(ZEROFS_SUPER_CACHE_PAGES>=2, "Paged superblock needs a map window and at least one namemap page");
+static_assert((ZEROFS_SUPER_PAGE_SIZE&(ZEROFS_SUPER_PAGE_SIZE-1))==0, "ZEROFS_SUPER_PAGE_SIZE should be power of two");
+static_assert((ZEROFS_SUPER_PAGE_SIZE%sizeof(struct zerofs_namemap))==0, "ZEROFS_SUPER_PAGE_SIZE should hold whole namemap entries");
+static_assert((offsetof(struct zerofs_superblock, namemap)%sizeof(struct zerofs_namemap))==0, "namemap entries should not cross superblock pages");
+
+// superblock page cache, page 0 is the sector_map window
+struct zerofs_super_cache
+{
+  uint32_t addr[ZEROFS_SUPER_CACHE_PAGES];                    // flash address of the cached page or ~0
+  uint8_t data[ZEROFS_SUPER_CACHE_PAGES][ZEROFS_SUPER_PAGE_SIZE];
+  uint8_t next;                                               // next namemap page to replace
+};
+#endif
+
+#if (ZEROFS_CPU_STATS!=0)
+// free running counters of the CPU work, the caller converts the differences to cycles
+struct zerofs_cpu_stats
+{
+  uint32_t map_probes;				// sector_map and name index bytes examined
+  uint32_t nm_probes;				// namemap entries and append log records examined
+  uint32_t copied;				// bytes copied in RAM
+};
+#define ZEROFS_COUNT(zfs, field, n) ((zfs)->cpu.field+=(n))
+#else
+#define ZEROFS_COUNT(zfs, field, n) ((void)0)
+#endif
+
 // RAM instance of zerofs
 struct zerofs
 {
-  const struct zerofs_superblock *superblock; 	// read only struct in flash
+  const struct zerofs_superblock *superblock; 	// read only struct in flash (NULL if paged)
   uint8_t *sector_map;				// sector_map when read/write mode enabled (RAM)
   uint8_t last_namemap_id;			// on boot look for the last non-FF namemap entry
   uint8_t bank;
+  uint8_t super_erased;				// bitmap of the superblock banks known to be erased
   uint8_t flags;
 #if (ZEROFS_VERIFY!=0)
   uint8_t verify;
@@ -203,11 +442,39 @@ struct zerofs
   struct zerofs_metadata meta;
   const struct zerofs_flash_access *fls;	// flash access struct in rom
   sector_t erased_max;
+  sector_t erased_logged;			// erased_max of the newest erase log record, see zerofs_erase_log()
+  uint16_t applog;				// namemap area offset of the newest append log record
+  uint16_t applog_end;				// end of the append log records of this session
+  uint8_t repacks;				// superblock repacks, the append log reservations before it are lost
+  uint16_t erase_reserve;			// erased sectors to keep ready, 0 is erase all
+  uint16_t erase_hint;				// sectors needed by the next WRITE session
+  uint8_t blank_skip;				// full blank checks to skip after a late mismatch
+  sector_t ahead;				// striped data area, sector erased ahead +1, 0 if none
+#if (ZEROFS_RUNTIME_GEOMETRY!=0)
+  sector_t sectors;				// data sectors of the flash
+  sector_t ring_mask;				// sectors-1 if it is a power of two, 0 otherwise
+  uint32_t erase_us;
+  uint32_t program_byte_ns;
+#endif
+  uint32_t sleep_idle_us;			// power down the data flash after this idle time, 0 is never
+  uint32_t idle_since;				// zerofs_idle() time of the last data flash access
+  struct zerofs_fop fq[ZEROFS_FOP_QUEUE_DEPTH];	// flash operations in flight
+  uint8_t fq_head;
+  uint8_t fq_count;
+  struct zerofs_op *op;				// running non-blocking operation
+#if (ZEROFS_SUPER_PAGED!=0)
+  struct zerofs_super_cache cache;
+  uint8_t name_hash[ZEROFS_MAX_NUMBER_OF_FILES];// resident name index of the namemap
+#endif
+#if (ZEROFS_CPU_STATS!=0)
+  struct zerofs_cpu_stats cpu;
+#endif
 };
 
 static_assert(sizeof(struct zerofs_superblock)<=ZEROFS_FLASH_SECTOR_SIZE, "Superblock too large, reduce ZEROFS_MAX_NUMBER_OF_FILES!");
 
 #define ZEROFS_FILE_NOMORE (1<<0)
+#define ZEROFS_FILE_APPEND (1<<1)
 
 struct zerofs_file
 {
@@ -220,10 +487,56 @@ struct zerofs_file
   uint8_t flags;
   uint32_t size;
   uint32_t bytepos;
+  sector_t first_sector;        // first sector, bounds the allocation; with offset the append log record
+  uint16_t first_offset;
+  uint16_t applog;              // append only: reserved append log record
+  uint8_t repacks;              // append only: zfs->repacks at the reservation
 };
 
 #define zerofs_file_len(fp) ((fp)->size)
 
+// result of a background erase call
+struct zerofs_erase_report
+{
+  uint16_t erased;              // sectors erased by this call (superblock banks included)
+  uint16_t ready;               // erased data sectors available for the next WRITE session
+  uint16_t remaining;           // data sectors still waiting for an erase
+  uint16_t shortfall;           // erased sectors missing from the reserve
+  uint32_t elapsed_us;          // estimated erase time of this call
+};
+
+#define ZEROFS_OP_WRITE         (1)
+#define ZEROFS_OP_CREATE        (2)
+#define ZEROFS_OP_DELETE        (3)
+#define ZEROFS_OP_READONLY_MODE (4)
+
+// progress of a superblock repack split into zerofs_poll() steps
+struct zerofs_repack
+{
+  uint8_t phase;
+  uint16_t id;                  // next namemap entry of the active bank
+  uint16_t dropped;             // deleted entries left out so far
+  uint32_t pos;                 // sector_map bytes programmed
+  uint8_t ids[ZEROFS_IDSET_SIZE];  // the deleted entries
+};
+
+// context of a non-blocking operation, owned by zerofs until zerofs_poll() returns the result
+struct zerofs_op
+{
+  uint32_t budget_us;           // max estimated flash time per zerofs_poll() call, 0 is ZEROFS_POLL_BUDGET_US
+  uint8_t type;                 // ZEROFS_OP_*
+  uint8_t state;
+  int ret;                      // result, valid when the last flash operations are done
+  struct zerofs_file *fp;
+  const char *name;
+  uint8_t *buf;                 // data to write or the sector_map of zerofs_readonly_mode()
+  uint32_t len;
+  uint32_t done;
+  uint32_t pos;                 // blank check progress of the sector being prepared
+  int id;                       // namemap entry of the file being deleted
+  struct zerofs_repack repack;
+};
+
 int zerofs_format(struct zerofs *zfs);
 int zerofs_init(struct zerofs *zfs, const struct zerofs_flash_access *fls_acc);
 int zerofs_is_readonly_mode(struct zerofs *zfs);
@@ -231,6 +544,10 @@ int zerofs_readonly_mode(struct zerofs *zfs, uint8_t *sector_map);
 int zerofs_dir_next(struct zerofs *zfs, struct zerofs_dirent *de);
 int zerofs_open(struct zerofs *zfs, struct zerofs_file *fp, const char *name);
 int zerofs_delete(struct zerofs *zfs, const char *name);
+int zerofs_delete_many(struct zerofs *zfs, const char *names[], int n);
+int zerofs_delete_if(struct zerofs *zfs, int (*match)(const struct zerofs_dirent *de, void *ud), void *ud);
+int zerofs_delete_by_type(struct zerofs *zfs, const char *extension);
+int zerofs_delete_except(struct zerofs *zfs, const char *names[], int n);
 int zerofs_create(struct zerofs *zfs, struct zerofs_file *fp, const char *name);
 int zerofs_close(struct zerofs_file *fp);
 int zerofs_read(struct zerofs_file *fp, uint8_t *buf, uint32_t len);
@@ -238,6 +555,18 @@ int zerofs_seek(struct zerofs_file *fp, int32_t pos);
 int zerofs_append(struct zerofs *zfs, struct zerofs_file *fp, const char *name);
 int zerofs_write(struct zerofs_file *fp, uint8_t *buf, uint32_t len);
 int zerofs_background_erase(struct zerofs *zfs);
+int zerofs_background_erase_budget(struct zerofs *zfs, int max_sectors, uint32_t max_us, struct zerofs_erase_report *report);
+int zerofs_set_erase_reserve(struct zerofs *zfs, uint32_t sectors);
+int zerofs_hint_write(struct zerofs *zfs, uint32_t bytes);
+int zerofs_set_sleep_policy(struct zerofs *zfs, uint32_t idle_us, int erase_first);
+int zerofs_idle(struct zerofs *zfs, uint32_t now_us);
+void zerofs_fop_complete(struct zerofs_fop *op, int32_t result);
+int zerofs_write_start(struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, uint8_t *buf, uint32_t len);
+int zerofs_create_start(struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, const char *name);
+int zerofs_delete_start(struct zerofs *zfs, struct zerofs_op *op, const char *name);
+int zerofs_readonly_mode_start(struct zerofs *zfs, struct zerofs_op *op, uint8_t *sector_map);
+int zerofs_poll(struct zerofs *zfs);
+int zerofs_sfdp_parse(const uint8_t *sfdp, uint32_t len, struct zerofs_geometry *geo);
 
 #endif
 
@@ -255,323 +584,1021 @@ static const char *zerofs_extensions[]=
 };
 
 
-int zerofs_format(struct zerofs *zfs)
+// superblock versions are counting down and wrap around from 1 to
+// ZEROFS_SUPERBLOCK_VERSION_MAX, the valid banks of the ring are always
+// within ZEROFS_SUPER_BANKS steps from each other
+static inline int zerofs_version_newer(uint16_t a, uint16_t b)
 {
-  if(NULL==zfs) return(ZEROFS_ERR_ARG);
-
-  zfs->sector_map=NULL;
-  zfs->meta.last_written=0;
-  zfs->meta.last_written_len=0;
-  zfs->last_namemap_id=0;
-  zfs->fls->fls_erase(zfs->fls->super_ud, 0, ZEROFS_SUPER_SECTOR_SIZE, 0);
-  zfs->fls->fls_erase(zfs->fls->super_ud, ZEROFS_SUPER_SECTOR_SIZE, ZEROFS_SUPER_SECTOR_SIZE, 0);
-  zfs->flags|=ZEROFS_FLAGS_EMPTY;
-
-  return(0);
+  return(a!=b && (uint16_t)(b-a)<0x8000u);
 }
 
-int zerofs_init(struct zerofs *zfs, const struct zerofs_flash_access *fls_acc)
+static inline int zerofs_version_valid(uint16_t v)
 {
-  int i,bank;
-  uint16_t v0,v1;
-
-  if(NULL==zfs||NULL==fls_acc) return(ZEROFS_ERR_ARG);
-
-  memset(zfs, 0, sizeof(struct zerofs));
-  zfs->fls=fls_acc;
-
-  bank=0;
-  struct zerofs_superblock *sb0=(struct zerofs_superblock *)(zfs->fls->superblock_banks + (bank*ZEROFS_SUPER_SECTOR_SIZE));
-  v0=sb0->meta.version;
-  bank=1;
-  struct zerofs_superblock *sb1=(struct zerofs_superblock *)(zfs->fls->superblock_banks + (bank*ZEROFS_SUPER_SECTOR_SIZE));
-  v1=sb1->meta.version;
-  if(v1==v0 || (v1>ZEROFS_SUPERBLOCK_VERSION_MAX && v0>ZEROFS_SUPERBLOCK_VERSION_MAX)) zerofs_format(zfs);
-  zfs->bank=(v0 < v1 ? 0 : 1);
-  zfs->superblock=(const struct zerofs_superblock *)(v0 < v1 ? sb0 : sb1 );
-  memcpy(&zfs->meta, &zfs->superblock->meta, sizeof(struct zerofs_metadata));
-  if(zfs->meta.version>ZEROFS_SUPERBLOCK_VERSION_MAX) zfs->meta.version=ZEROFS_SUPERBLOCK_VERSION_MAX;
-#if (ZEROFS_VERIFY!=0)
-  zfs->verify_cnt=zfs->verify=ZEROFS_VERIFY;
-#endif
-  zfs->sector_map=NULL;
-  zfs->last_namemap_id=0;
-  zfs->erased_max=0;
-  for(i=0;i<ZEROFS_MAX_NUMBER_OF_FILES;i++) if(zfs->superblock->namemap[i].type_len!=0&&zfs->superblock->namemap[i].type_len!=0xffffffff) zfs->last_namemap_id=i+1;
-
-  return(0);
+  return(v!=0 && v<=ZEROFS_SUPERBLOCK_VERSION_MAX);
 }
 
-// is zerofs in read only mode?
-int zerofs_is_readonly_mode(struct zerofs *zfs)
+// completion callback of the v2 flash interface, can be called from interrupt
+void zerofs_fop_complete(struct zerofs_fop *op, int32_t result)
 {
-  if(NULL==zfs) return(ZEROFS_ERR_ARG);
-  return(NULL==zfs->sector_map);
+  op->result=result;
+  op->flags|=ZEROFS_FOP_F_DONE;
 }
 
-// copy superblock to the secondary flash sector and 
-// update the sector_map and compact the namemap entries
-static void zerofs_repack_superblock(struct zerofs *zfs)
+static int32_t zerofs_fop_wait(struct zerofs *zfs, struct zerofs_fop *op)
 {
-  static const char zero[6];
-  struct zerofs_namemap nm;
-  uint32_t addr;
-  int id,of,j,ni,valid;
-
-  if(NULL==zfs||zerofs_is_readonly_mode(zfs)) return;
-  int nb=zfs->bank^1;
-  // erase secondary superblock sector
-  zfs->fls->fls_erase(zfs->fls->super_ud, nb*ZEROFS_SUPER_SECTOR_SIZE, ZEROFS_SUPER_SECTOR_SIZE, 0);
-  // program the namemap and skip the deleted items
-  addr = offsetof(struct zerofs_superblock, namemap);
-  for(of=id=ni=0;id<=zfs->last_namemap_id;id++)
-  {
-    valid=1;
-    if(memcmp(&zfs->superblock->namemap[id].name, zero, sizeof(zero))==0) valid=0;
-    else if(ZEROFS_NM_GET_SIZE(&zfs->superblock->namemap[id])==0) valid=0;
-    else if(zfs->superblock->namemap[id].type_len==0xffffffff) valid=0;
-    if(!valid)
-    {
-      // id 'id' deleted, decrement all larger ids in sector_map
-      for(j=0;j<ZEROFS_NUMBER_OF_SECTORS;j++) if(zfs->sector_map[j]<ZEROFS_MAP_BAD&&zfs->sector_map[j]>(id-of)) --zfs->sector_map[j];
-      of++;
-    }
-    else
-    {
-      // program the name entry
-      memcpy(&nm, &zfs->superblock->namemap[id], sizeof(struct zerofs_namemap));
-      zfs->fls->fls_write(zfs->fls->super_ud, addr+(nb*ZEROFS_SUPER_SECTOR_SIZE), (uint8_t *)&nm, sizeof(struct zerofs_namemap));
-      addr+=sizeof(struct zerofs_namemap);
-      ni++;
-    }
-  }
-  // update the free slot for the next namemap entry
-  zfs->last_namemap_id=ni;
-  // program the updated RAM sector map
-  zfs->fls->fls_write(zfs->fls->super_ud, nb*ZEROFS_SUPER_SECTOR_SIZE, zfs->sector_map, sizeof(zfs->superblock->sector_map));
-  // copy the metadata fields from RAM if present
-  zfs->meta.version--;
-  if(zfs->meta.version==0) zfs->meta.version=ZEROFS_SUPERBLOCK_VERSION_MAX;
-  addr=offsetof(struct zerofs_superblock, meta);
-  zfs->fls->fls_write(zfs->fls->super_ud, addr+(nb*ZEROFS_SUPER_SECTOR_SIZE), (uint8_t *)&zfs->meta, sizeof(struct zerofs_metadata) );
-  // if we reset the version, we erase the other superblock too
-  if(zfs->meta.version==ZEROFS_SUPERBLOCK_VERSION_MAX) zfs->fls->fls_erase(zfs->fls->super_ud, zfs->bank*ZEROFS_SUPER_SECTOR_SIZE, ZEROFS_SUPER_SECTOR_SIZE, 0);
-  zfs->bank=nb;
-  zfs->superblock=(const struct zerofs_superblock *)(zfs->fls->superblock_banks + (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE));
+  while((op->flags&ZEROFS_FOP_F_DONE)==0) if(NULL!=zfs->fls->fls_poll) zfs->fls->fls_poll(op->ud);
+  return(op->result);
 }
 
-int zerofs_readonly_mode(struct zerofs *zfs, uint8_t *sector_map)
+// free the completed operations at the head of the queue
+static void zerofs_fop_retire(struct zerofs *zfs)
 {
-  if(NULL==zfs) return(ZEROFS_ERR_ARG);
-  
-  if(NULL==sector_map&&NULL!=zfs->sector_map)
-  {
-    // SET READ MODE
-    zerofs_repack_superblock(zfs);
-  }
-  zfs->sector_map=sector_map;
-  if(NULL!=sector_map)
+  while(zfs->fq_count>0&&(zfs->fq[zfs->fq_head].flags&ZEROFS_FOP_F_DONE)!=0)
   {
-    // SET WRITE MODE
-    if((zfs->flags&ZEROFS_FLAGS_EMPTY)==0) memcpy(sector_map, zfs->superblock->sector_map, sizeof(zfs->superblock->sector_map));
-    else memset(sector_map, ZEROFS_MAP_EMPTY, sizeof(zfs->superblock->sector_map));
-    zfs->flags&=~ZEROFS_FLAGS_EMPTY;
-    uint8_t *sm=sector_map;
-    // mark all background erased sectors erased
-    for(int i=0; i<zfs->erased_max; i++) if(sm[ZEROFS_BLOCK(zfs, i)]==ZEROFS_MAP_EMPTY) sm[ZEROFS_BLOCK(zfs, i)]=ZEROFS_MAP_ERASED;
-    zfs->erased_max=0;
+    zfs->fq_head=(zfs->fq_head+1)%ZEROFS_FOP_QUEUE_DEPTH;
+    zfs->fq_count--;
   }
-  
-  return(0);
 }
 
-// helper to convert a char to the 6bit encoded version
-static inline uint8_t str6bit(char a)
+// a waited operation at the end of the queue is freed at once, the ones before it can be in flight
+// on another device, reads would fill the queue behind a long program otherwise
+static void zerofs_fop_release(struct zerofs *zfs, struct zerofs_fop *o)
 {
-  if(a>='a'&&a<='z') return(2+a-'a');
-  if(a>='A'&&a<='Z') return(2+26+a-'A');
-  if(a>='0'&&a<='9') return(2+2*26+a-'0');
-  if(a=='-') return(1);
-  return(0);
+  if(zfs->fq_count>0&&o==&zfs->fq[(zfs->fq_head+zfs->fq_count-1)%ZEROFS_FOP_QUEUE_DEPTH]&&(o->flags&ZEROFS_FOP_F_DONE)!=0) zfs->fq_count--;
 }
 
-static inline int zerofs_get_type(const char *extension)
+// wait for all operations in flight, their buffers can be reused after it
+static void zerofs_fop_drain(struct zerofs *zfs)
 {
-  int ret=ZEROFS_TYPE_UNKNOWN;
-  int i;
-
-  assert(extension);
-  
-  for(i=0; NULL!=zerofs_extensions[i]; i++)
+  while(zfs->fq_count>0)
   {
-    if(zerofs_extensions[i][0]>extension[0]) break;
-    if(zerofs_extensions[i][0]==extension[0])
-    {
-      if(zerofs_extensions[i][1]==extension[1] && zerofs_extensions[i][2]==extension[2]) { ret=i; break; }
-    }
+    zerofs_fop_wait(zfs, &zfs->fq[zfs->fq_head]);
+    zerofs_fop_retire(zfs);
   }
-
-  return(ret);
 }
 
-// code/decode name
-// if str is empty, decode the encoded name to str
-// otherwise encode str to encoded array
-// length is fixed 8 char and 6 byte encoded
-static int zerofs_name_codec(char *str, uint8_t *encoded, uint8_t *type)
+// queue a flash operation, the returned descriptor is valid until the next submit
+// without fls_submit the operation is done at once with the v1 callbacks (sync shim)
+static struct zerofs_fop *zerofs_fop_submit(struct zerofs *zfs, uint8_t op, uint8_t flags, void *ud, uint32_t addr, uint8_t *buf, uint32_t len)
 {
-  static const char hexdigits[]="_-abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"; // 64 char
+  const struct zerofs_flash_access *f=zfs->fls;
+  struct zerofs_fop *o;
 
-  assert(str&&encoded);
-
-  if(str[0]=='\0')
+  zerofs_fop_retire(zfs);
+  if(zfs->fq_count>=ZEROFS_FOP_QUEUE_DEPTH)
   {
-    // decode
-    str[0]=hexdigits[encoded[0]&0x3f];
-    str[1]=hexdigits[encoded[1]&0x3f];
-    str[2]=hexdigits[encoded[2]&0x3f];
-    str[3]=hexdigits[ (encoded[0]&0xc0)>>2 | (encoded[1]&0xc0)>>4 | (encoded[2]&0xc0)>>6 ];
-    str[4]=hexdigits[encoded[3]&0x3f];
-    str[5]=hexdigits[encoded[4]&0x3f];
-    str[6]=hexdigits[encoded[5]&0x3f];
-    str[7]=hexdigits[ (encoded[3]&0xc0)>>2 | (encoded[4]&0xc0)>>4 | (encoded[5]&0xc0)>>6 ];
-    str[8]='\0';
+    zerofs_fop_wait(zfs, &zfs->fq[zfs->fq_head]);
+    zerofs_fop_retire(zfs);
   }
-  else
+  o=&zfs->fq[(zfs->fq_head+zfs->fq_count)%ZEROFS_FOP_QUEUE_DEPTH];
+  zfs->fq_count++;
+  o->ud=ud;
+  o->addr=addr;
+  o->buf=buf;
+  o->len=len;
+  o->op=op;
+  o->flags=flags;
+  o->result=0;
+  if(NULL!=f->fls_submit)
   {
-    // encode
-    uint8_t x;
-    char n[8];
-    int j,i;
-    for(i=0;str[i]!='.'&&str[i]!='\0';i++);  // find '.'
-    if(str[i]=='\0'||i>8) return(ZEROFS_ERR_INVALIDNAME);
-    if(NULL!=type) *type=zerofs_get_type(&str[i+1]);
-    for(j=7,--i;i>=0;--i) n[j--]=str[i]; // copy basename to n[]
-    for(;j>=0;--j) n[j]='_'; // fill rest of n[] with '_'
-    x=str6bit(n[3]);
-    encoded[0]=str6bit(n[0]) | ((x&0x30)<<2);
-    encoded[1]=str6bit(n[1]) | ((x&0x0c)<<4);
-    encoded[2]=str6bit(n[2]) | ((x&0x03)<<6);
-    x=str6bit(n[7]);
-    encoded[3]=str6bit(n[4]) | ((x&0x30)<<2);
-    encoded[4]=str6bit(n[5]) | ((x&0x0c)<<4);
-    encoded[5]=str6bit(n[6]) | ((x&0x03)<<6);
+    if(f->fls_submit(ud, o)<0) zerofs_fop_complete(o, -1);
   }
-  return(0);
+  else switch(op)
+  {
+    case ZEROFS_FOP_READ:
+      zerofs_fop_complete(o, f->fls_read(ud, addr, buf, len));
+      break;
+    case ZEROFS_FOP_PROGRAM:
+      zerofs_fop_complete(o, f->fls_write(ud, addr, buf, len));
+      break;
+    default:
+      zerofs_fop_complete(o, f->fls_erase(ud, addr, len, (flags&ZEROFS_FOP_F_BACKGROUND)!=0));
+      break;
+  }
+
+  return(o);
 }
 
-// look for available sector for data
-static int zerofs_find_free_block(struct zerofs *zfs)
+// device and device address of a data area address, other devices are returned as they are
+// an operation never crosses a sector boundary except the erase
+static inline void *zerofs_data_dev(const struct zerofs_flash_access *f, void *ud, uint32_t *addr)
 {
-  int ret=-1;
-  int i,fre=-1;
-  const uint8_t *sm;
-  sector_t sec;
+#if (ZEROFS_DATA_DEVICES>1)
+  uint32_t s;
+
+  if(ud!=f->data_ud) return(ud);
+  s=*addr/ZEROFS_FLASH_SECTOR_SIZE;
+  *addr=(s/ZEROFS_DATA_DEVICES)*ZEROFS_FLASH_SECTOR_SIZE+(*addr%ZEROFS_FLASH_SECTOR_SIZE);
+  return(f->data_devs[s%ZEROFS_DATA_DEVICES]);
+#else
+  return(ud);
+#endif
+}
 
-  assert(zfs);
+// program flash, with wait the buffer can be reused on return, otherwise only after zerofs_fop_drain()
+static void zerofs_fls_program(struct zerofs *zfs, void *ud, uint32_t addr, const void *data, uint32_t len, int wait)
+{
+  struct zerofs_fop *o;
 
-  sm=ZEROFS_SECTOR_MAP(zfs);
-  for(i=0;i<ZEROFS_NUMBER_OF_SECTORS;i++)
+  ud=zerofs_data_dev(zfs->fls, ud, &addr);
+  o=zerofs_fop_submit(zfs, ZEROFS_FOP_PROGRAM, 0, ud, addr, (uint8_t *)data, len);
+  if(wait)
   {
-    sec=ZEROFS_BLOCK(zfs, i);
-    if(sm[sec]==ZEROFS_MAP_ERASED) break;
-    if(fre<0&&sm[sec]==ZEROFS_MAP_EMPTY) fre=sec;
+    zerofs_fop_wait(zfs, o);
+    zerofs_fop_release(zfs, o);
   }
-  if(i<ZEROFS_NUMBER_OF_SECTORS) ret=sec;
-  else if(fre>=0) ret=fre;
-  
-  return(ret);
 }
 
-// look for a specific type of sector
-static int zerofs_find_sector_type(struct zerofs *zfs, sector_t from, uint8_t type)
+static void zerofs_fls_erase(struct zerofs *zfs, void *ud, uint32_t addr, uint32_t len, int background)
 {
-  int ret;
-  int i;
-  const uint8_t *sm;
+  uint8_t flags=(background?ZEROFS_FOP_F_BACKGROUND:0);
+#if (ZEROFS_DATA_DEVICES>1)
+  uint32_t s,n,d,a;
 
-  assert(zfs);
+  // a striped range is one erase per device, adjacent on the device, they run in parallel
+  if(ud==zfs->fls->data_ud)
+  {
+    s=addr/ZEROFS_FLASH_SECTOR_SIZE;
+    n=len/ZEROFS_FLASH_SECTOR_SIZE;
+    for(d=0;d<ZEROFS_DATA_DEVICES&&d<n;d++)
+    {
+      a=(s+d)*ZEROFS_FLASH_SECTOR_SIZE;
+      ud=zerofs_data_dev(zfs->fls, zfs->fls->data_ud, &a);
+      zerofs_fop_submit(zfs, ZEROFS_FOP_ERASE, flags, ud, a, NULL, ((n-d+ZEROFS_DATA_DEVICES-1)/ZEROFS_DATA_DEVICES)*ZEROFS_FLASH_SECTOR_SIZE);
+    }
+    return;
+  }
+#endif
+  zerofs_fop_submit(zfs, ZEROFS_FOP_ERASE, flags, ud, addr, NULL, len);
+}
+
+// fls_sleep() or fls_wake() of every data device
+static void zerofs_data_power(struct zerofs *zfs, int (*fn)(void *ud))
+{
+  if(NULL==fn) return;
+#if (ZEROFS_DATA_DEVICES>1)
+  for(int d=0;d<ZEROFS_DATA_DEVICES;d++) fn(zfs->fls->data_devs[d]);
+#else
+  fn(zfs->fls->data_ud);
+#endif
+}
 
-  sm=ZEROFS_SECTOR_MAP(zfs);
-  for(i=1;i<ZEROFS_NUMBER_OF_SECTORS;i++)
+// called before every data flash access, wakes up the powered down flash
+static inline void zerofs_data_access(struct zerofs *zfs)
+{
+  if((zfs->flags&ZEROFS_FLAGS_ASLEEP)!=0)
   {
-    if(sm[(from+i)%ZEROFS_NUMBER_OF_SECTORS]==type) break;
+    zfs->flags&=~ZEROFS_FLAGS_ASLEEP;
+    zerofs_data_power(zfs, zfs->fls->fls_wake);
   }
-  ret=(from+i)%ZEROFS_NUMBER_OF_SECTORS;
-  if(sm[ret]!=type) ret=-1;
+  zfs->flags|=ZEROFS_FLAGS_ACTIVE;
+}
+
+// read from flash, a running background erase is suspended for the read
+static int zerofs_fls_read(struct zerofs *zfs, void *ud, uint32_t addr, uint8_t *data, uint32_t len)
+{
+  const struct zerofs_flash_access *f=zfs->fls;
+  struct zerofs_fop *o;
+  int ret,suspended=0;
+
+  if(ud==f->data_ud) zerofs_data_access(zfs);
+  ud=zerofs_data_dev(f, ud, &addr);
+  if(NULL!=f->fls_busy&&NULL!=f->fls_erase_suspend&&NULL!=f->fls_erase_resume&&f->fls_busy(ud)) suspended=(f->fls_erase_suspend(ud)==0);
+  o=zerofs_fop_submit(zfs, ZEROFS_FOP_READ, 0, ud, addr, data, len);
+  ret=zerofs_fop_wait(zfs, o);
+  zerofs_fop_release(zfs, o);
+  if(suspended) f->fls_erase_resume(ud);
 
   return(ret);
 }
 
-// look for the given name in the namemap (ignores other field in nm)
-static uint8_t zerofs_namemap_find_name(struct zerofs *zfs, struct zerofs_namemap *nm, uint8_t type)
+// read raw bytes from a superblock bank
+static void zerofs_super_read(struct zerofs *zfs, int bank, uint32_t offs, void *buf, uint32_t len)
 {
-  uint8_t ret=ZEROFS_MAP_EMPTY;
-  uint8_t *p;
-  unsigned long offs;
+#if (ZEROFS_SUPER_PAGED!=0)
+  zerofs_fls_read(zfs, zfs->fls->super_ud, (bank*ZEROFS_SUPER_SECTOR_SIZE)+offs, buf, len);
+#else
+  memcpy(buf, zfs->fls->superblock_banks+(bank*ZEROFS_SUPER_SECTOR_SIZE)+offs, len);
+  ZEROFS_COUNT(zfs, copied, len);
+#endif
+}
 
-  if(NULL==zfs||NULL==nm) return(ret);
+#if (ZEROFS_SUPER_PAGED!=0)
+static inline uint8_t zerofs_name_hash(const uint8_t *name)
+{
+  uint8_t h=0;
+  int i;
 
-  p=(uint8_t *)zfs->superblock->namemap;
-  do
-  {
-    p=memmem(p, sizeof(zfs->superblock->namemap), nm->name, sizeof(nm->name));
-    offs=(unsigned long)(p-(uint8_t *)zfs->superblock->namemap);
-    ret=(uint8_t)(offs / sizeof(struct zerofs_namemap));
-  } while(p!=NULL && ZEROFS_NM_GET_TYPE(&nm[ret])!=type && ( (offs % sizeof(struct zerofs_namemap)) != 0));
-  if(p==NULL) ret=ZEROFS_MAP_EMPTY;
+  for(i=0;i<sizeof(((struct zerofs_namemap *)0)->name);i++) h=(uint8_t)(h*31+name[i]);
 
-  return(ret);
+  return(h);
 }
 
-// look for the given first_sector in the namemap (ignores other field in nm)
-static uint8_t zerofs_namemap_find_sector(struct zerofs *zfs, sector_t first)
+static void zerofs_super_cache_flush(struct zerofs *zfs)
 {
-  uint8_t ret=ZEROFS_MAP_EMPTY;
   int i;
-  
-  if(NULL==zfs) return(ret);
-  
-  for(i=0;i<zfs->last_namemap_id;i++) if(zfs->superblock->namemap[i].type_len!=0&&first==zfs->superblock->namemap[i].first_sector) break;
-  if(i<zfs->last_namemap_id) ret=i;
 
-  return(ret);
+  for(i=0;i<ZEROFS_SUPER_CACHE_PAGES;i++) zfs->cache.addr[i]=~(uint32_t)0;
+  zfs->cache.next=1;
 }
 
-// fill out next file in provided struct zerofs_dirent
-// if name is \0 it returns the first file
-// return 0 if ok, -1 if last file reached
-int zerofs_dir_next(struct zerofs *zfs, struct zerofs_dirent *de)
+// return the cached superblock byte at flash address addr
+// sector_map reads always go to the map window to keep it resident
+static const uint8_t *zerofs_super_cached(struct zerofs *zfs, uint32_t addr, int map)
+{
+  struct zerofs_super_cache *c=&zfs->cache;
+  uint32_t page=addr&~(uint32_t)(ZEROFS_SUPER_PAGE_SIZE-1);
+  int i=0;
+
+  if(!map)
+  {
+    for(i=1;i<ZEROFS_SUPER_CACHE_PAGES;i++) if(c->addr[i]==page) break;
+    if(i>=ZEROFS_SUPER_CACHE_PAGES)
+    {
+      i=c->next;
+      if(++c->next>=ZEROFS_SUPER_CACHE_PAGES) c->next=1;
+    }
+  }
+  if(c->addr[i]!=page)
+  {
+    zerofs_fls_read(zfs, zfs->fls->super_ud, page, c->data[i], ZEROFS_SUPER_PAGE_SIZE);
+    c->addr[i]=page;
+  }
+
+  return(&c->data[i][addr-page]);
+}
+#endif
+
+// copy namemap entry id of the active bank to nm
+static inline void zerofs_nm_read(struct zerofs *zfs, int id, struct zerofs_namemap *nm)
+{
+  ZEROFS_COUNT(zfs, nm_probes, 1);
+  ZEROFS_COUNT(zfs, copied, sizeof(struct zerofs_namemap));
+#if (ZEROFS_SUPER_PAGED!=0)
+  memcpy(nm, zerofs_super_cached(zfs, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE)+offsetof(struct zerofs_superblock, namemap)+(id*sizeof(struct zerofs_namemap)), 0), sizeof(struct zerofs_namemap));
+#else
+  memcpy(nm, &zfs->superblock->namemap[id], sizeof(struct zerofs_namemap));
+#endif
+}
+
+// copy namemap entry id of the active bank to nm with the newest append log record applied
+static void zerofs_nm_get(struct zerofs *zfs, int id, struct zerofs_namemap *nm)
+{
+  struct zerofs_applog rec;
+  uint32_t offs;
+
+  zerofs_nm_read(zfs, id, nm);
+  if(nm->type_len==0||nm->type_len==0xffffffff) return;
+  for(offs=zfs->applog;offs<zfs->applog_end;offs+=sizeof(rec))
+  {
+    ZEROFS_COUNT(zfs, nm_probes, 1);
+    ZEROFS_COUNT(zfs, copied, sizeof(rec));
+#if (ZEROFS_SUPER_PAGED!=0)
+    memcpy(&rec, zerofs_super_cached(zfs, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE)+offsetof(struct zerofs_superblock, namemap)+offs, 0), sizeof(rec));
+#else
+    memcpy(&rec, ((const uint8_t *)zfs->superblock->namemap)+offs, sizeof(rec));
+#endif
+    if((rec.id_len>>24)==id)
+    {
+      nm->first_sector=rec.first_sector;
+      nm->first_offset=rec.first_offset;
+      nm->type_len=(nm->type_len&0xff000000)|(rec.id_len&0xffffff);
+      break;
+    }
+  }
+}
+
+// never programmed namemap entry
+static inline int zerofs_nm_blank(const struct zerofs_namemap *nm)
+{
+  const uint8_t *p=(const uint8_t *)nm;
+  int i;
+
+  for(i=0;i<sizeof(struct zerofs_namemap);i++) if(p[i]!=0xff) return(0);
+  return(1);
+}
+
+// first namemap slot not available for new entries, one blank slot separates the append log
+static inline int zerofs_namemap_limit(struct zerofs *zfs)
+{
+  if(zfs->applog>=ZEROFS_APPLOG_TOP) return(ZEROFS_MAX_NUMBER_OF_FILES);
+  return(zfs->applog/sizeof(struct zerofs_namemap)-1);
+}
+
+// sector_map entry from RAM in WRITE mode or from the active bank in READ mode
+static inline uint8_t zerofs_map_get(struct zerofs *zfs, sector_t sec)
+{
+  ZEROFS_COUNT(zfs, map_probes, 1);
+  if(NULL!=zfs->sector_map) return(zfs->sector_map[sec]);
+#if (ZEROFS_SUPER_PAGED!=0)
+  return(*zerofs_super_cached(zfs, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE)+offsetof(struct zerofs_superblock, sector_map)+sec, 1));
+#else
+  return(zfs->superblock->sector_map[sec]);
+#endif
+}
+
+// EMPTY sectors of the erase block of sector s, -1 if a sector of the block holds data
+// only these blocks can be erased
+static int zerofs_block_empty(struct zerofs *zfs, sector_t s)
+{
+  int i,n=0;
+  uint8_t v;
+
+  s-=s%ZEROFS_SECTORS_PER_BLOCK;
+  for(i=0;i<ZEROFS_SECTORS_PER_BLOCK;i++)
+  {
+    v=zerofs_map_get(zfs, s+i);
+    if(v==ZEROFS_MAP_EMPTY) n++;
+    else if(v!=ZEROFS_MAP_ERASED) return(-1);
+  }
+
+  return(n);
+}
+
+// program a superblock bank, keeps the page cache and the name index coherent
+static void zerofs_super_write(struct zerofs *zfs, int bank, uint32_t offs, const void *data, uint32_t len)
+{
+  uint32_t addr=(bank*ZEROFS_SUPER_SECTOR_SIZE)+offs;
+
+  zerofs_fls_program(zfs, zfs->fls->super_ud, addr, data, len, 1);
+#if (ZEROFS_SUPER_PAGED!=0)
+  const uint8_t *d=data;
+  uint32_t a,nmo;
+  int i,id;
+
+  for(i=0;i<ZEROFS_SUPER_CACHE_PAGES;i++)
+  {
+    if(zfs->cache.addr[i]==~(uint32_t)0) continue;
+    for(a=(addr>zfs->cache.addr[i]?addr:zfs->cache.addr[i]);a<addr+len&&a<zfs->cache.addr[i]+ZEROFS_SUPER_PAGE_SIZE;a++) zfs->cache.data[i][a-zfs->cache.addr[i]]&=d[a-addr];
+  }
+  // entries with fully programmed names update the index
+  nmo=offsetof(struct zerofs_superblock, namemap);
+  for(id=0;id<ZEROFS_MAX_NUMBER_OF_FILES;id++,nmo+=sizeof(struct zerofs_namemap))
+  {
+    if(nmo>=offs+len) break;
+    if(nmo>=offs&&nmo+sizeof(((struct zerofs_namemap *)0)->name)<=offs+len) zfs->name_hash[id]=zerofs_name_hash(&d[nmo-offs]);
+  }
+#endif
+}
+
+// check a superblock bank for the erased state
+static int zerofs_super_bank_blank(struct zerofs *zfs, int bank)
+{
+  uint8_t buf[16];
+  uint32_t offs;
+  int i;
+
+  for(offs=0;offs<ZEROFS_SUPER_SECTOR_SIZE;offs+=sizeof(buf))
+  {
+    zerofs_super_read(zfs, bank, offs, buf, sizeof(buf));
+    for(i=0;i<sizeof(buf);i++) if(buf[i]!=0xff) return(0);
+  }
+
+  return(1);
+}
+
+static void zerofs_super_erase_bank(struct zerofs *zfs, int bank, int background)
+{
+  zerofs_fls_erase(zfs, zfs->fls->super_ud, bank*ZEROFS_SUPER_SECTOR_SIZE, ZEROFS_SUPER_SECTOR_SIZE, background);
+  zfs->super_erased|=(1u<<bank);
+#if (ZEROFS_SUPER_PAGED!=0)
+  int i;
+  for(i=0;i<ZEROFS_SUPER_CACHE_PAGES;i++) if(zfs->cache.addr[i]/ZEROFS_SUPER_SECTOR_SIZE==bank) zfs->cache.addr[i]=~(uint32_t)0;
+#endif
+}
+
+#if (ZEROFS_BLANK_CHECK!=0)
+// returns 1 if the data sectors from s read all 0xff up to end bytes, -1 if it ran out of chunks
+// to read first, *pos is the progress in bytes from s
+// the first chunk is programmed in every used sector, it is always read, the rest
+// of the sector is skipped for a while if the previous full checks failed late
+static int zerofs_blank_read(struct zerofs *zfs, sector_t s, uint32_t *pos, uint32_t end, uint32_t chunks)
+{
+  uint8_t buf[ZEROFS_BLANK_CHECK_CHUNK];
+  uint32_t addr=s*ZEROFS_FLASH_SECTOR_SIZE;
+  uint32_t n;
+  int i;
+
+  for(;*pos<end;*pos+=sizeof(buf))
+  {
+    n=*pos%ZEROFS_FLASH_SECTOR_SIZE;
+    if(n==sizeof(buf)&&zfs->blank_skip>0)
+    {
+      zfs->blank_skip--;
+      return(0);
+    }
+    if(chunks==0) return(-1);
+    chunks--;
+    zerofs_fls_read(zfs, zfs->fls->data_ud, addr+*pos, buf, sizeof(buf));
+    for(i=0;i<sizeof(buf);i++) if(buf[i]!=0xff) break;
+    if(i<sizeof(buf))
+    {
+      if(n>0) zfs->blank_skip=ZEROFS_BLANK_CHECK_BACKOFF;
+      return(0);
+    }
+  }
+
+  return(1);
+}
+
+// checks s and the sectors after it in its erase block, they are ready for the file when blank
+static int zerofs_blank_check(struct zerofs *zfs, sector_t s, uint32_t *pos, uint32_t chunks)
+{
+  uint32_t addr=s*ZEROFS_FLASH_SECTOR_SIZE;
+  uint32_t len=(ZEROFS_SECTORS_PER_BLOCK-s%ZEROFS_SECTORS_PER_BLOCK)*ZEROFS_FLASH_SECTOR_SIZE;
+  void *ud;
+
+  zerofs_data_access(zfs);
+  zerofs_fop_drain(zfs);
+  if(NULL!=zfs->fls->fls_blank_check)
+  {
+    ud=zerofs_data_dev(zfs->fls, zfs->fls->data_ud, &addr);
+    return(zfs->fls->fls_blank_check(ud, addr, len)==1);
+  }
+
+  return(zerofs_blank_read(zfs, s, pos, len, chunks));
+}
+#endif
+
+// prepare an EMPTY data sector for writing, the blank check is resumed at *pos and
+// reads max chunks, returns ZEROFS_IN_PROGRESS if it is not finished
+static int zerofs_erase_empty_step(struct zerofs *zfs, sector_t s, uint32_t *pos, uint32_t chunks)
+{
+  if(zfs->ahead==s+1)
+  {
+    // erased or found blank ahead
+    zfs->ahead=0;
+    return(0);
+  }
+#if (ZEROFS_SECTORS_PER_BLOCK>1)
+  // the whole erase block is erased (or found blank from s), the EMPTY sectors after s are ready for the
+  // file being written, the ones before s stay EMPTY, allocating them later could break the ring order of the file
+  for(int i=s+1;i%ZEROFS_SECTORS_PER_BLOCK!=0;i++) if(zfs->sector_map[i]==ZEROFS_MAP_EMPTY) zfs->sector_map[i]=ZEROFS_MAP_ERASED;
+  ZEROFS_COUNT(zfs, map_probes, ZEROFS_SECTORS_PER_BLOCK-1-s%ZEROFS_SECTORS_PER_BLOCK);
+#endif
+#if (ZEROFS_BLANK_CHECK!=0)
+  int ret=zerofs_blank_check(zfs, s, pos, chunks);
+  if(ret<0) return(ZEROFS_IN_PROGRESS);
+  if(ret==1) return(0);
+#endif
+  zerofs_data_access(zfs);
+  zerofs_fls_erase(zfs, zfs->fls->data_ud, (s-s%ZEROFS_SECTORS_PER_BLOCK)*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_ERASE_BLOCK_SIZE, 0);
+
+  return(0);
+}
+
+static void zerofs_erase_empty(struct zerofs *zfs, sector_t s)
+{
+  uint32_t pos=0;
+
+  zerofs_erase_empty_step(zfs, s, &pos, ~(uint32_t)0);
+}
+
+int zerofs_format(struct zerofs *zfs)
+{
+  int bank;
+
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+
+  zfs->sector_map=NULL;
+  zfs->meta.last_written=0;
+  zfs->meta.last_written_len=0;
+  zfs->last_namemap_id=0;
+  zfs->applog=zfs->applog_end=ZEROFS_APPLOG_TOP;
+  for(bank=0;bank<ZEROFS_SUPER_BANKS;bank++) zerofs_super_erase_bank(zfs, bank, 0);
+  // the active bank receives the namemap entries of the next WRITE session
+  zfs->super_erased&=~(1u<<zfs->bank);
+  zfs->flags|=ZEROFS_FLAGS_EMPTY;
+  // the banks are read right after, e.g. by zerofs_init() through the memory map
+  zerofs_fop_drain(zfs);
+
+  return(0);
+}
+
+// data flash size and timing of the runtime geometry, larger flash is used up to ZEROFS_FLASH_SIZE_KB
+static int zerofs_geometry_init(struct zerofs *zfs)
+{
+#if (ZEROFS_RUNTIME_GEOMETRY!=0)
+  const struct zerofs_geometry *geo=zfs->fls->geometry;
+  uint32_t n=ZEROFS_NUMBER_OF_SECTORS;
+
+  if(NULL!=geo&&geo->sectors>0) n=MIN(geo->sectors, ZEROFS_NUMBER_OF_SECTORS);
+  n-=n%(ZEROFS_DATA_DEVICES*ZEROFS_SECTORS_PER_BLOCK);
+  if(n==0) return(ZEROFS_ERR_ARG);
+  zfs->sectors=n;
+  zfs->ring_mask=((n&(n-1))==0)?n-1:0;
+  zfs->erase_us=(NULL!=geo&&geo->erase_us>0)?geo->erase_us:ZEROFS_SECTOR_ERASE_US;
+  zfs->program_byte_ns=(NULL!=geo&&geo->program_byte_ns>0)?geo->program_byte_ns:ZEROFS_PROGRAM_BYTE_NS;
+#endif
+  return(0);
+}
+
+int zerofs_init(struct zerofs *zfs, const struct zerofs_flash_access *fls_acc)
+{
+  int i,bank;
+  uint16_t v,newest=0;
+  uint32_t offs;
+  struct zerofs_namemap nm;
+  struct zerofs_applog rec;
+
+  if(NULL==zfs||NULL==fls_acc) return(ZEROFS_ERR_ARG);
+
+  memset(zfs, 0, sizeof(struct zerofs));
+  zfs->fls=fls_acc;
+  if(zerofs_geometry_init(zfs)<0) return(ZEROFS_ERR_ARG);
+#if (ZEROFS_SUPER_PAGED!=0)
+  zerofs_super_cache_flush(zfs);
+#endif
+
+  // look for the newest valid bank of the ring
+  zfs->bank=ZEROFS_SUPER_BANKS;
+  for(bank=0;bank<ZEROFS_SUPER_BANKS;bank++)
+  {
+    zerofs_super_read(zfs, bank, offsetof(struct zerofs_superblock, meta)+offsetof(struct zerofs_metadata, version), &v, sizeof(v));
+    if(!zerofs_version_valid(v)) continue;
+    if(zfs->bank>=ZEROFS_SUPER_BANKS||zerofs_version_newer(v, newest)) { zfs->bank=bank; newest=v; }
+  }
+  if(zfs->bank>=ZEROFS_SUPER_BANKS)
+  {
+    zfs->bank=0;
+    zerofs_format(zfs);
+  }
+  else for(bank=0;bank<ZEROFS_SUPER_BANKS;bank++) if(bank!=zfs->bank&&zerofs_super_bank_blank(zfs, bank)) zfs->super_erased|=(1u<<bank);
+  zfs->superblock=ZEROFS_SUPER_BANK(zfs, zfs->bank);
+  zerofs_super_read(zfs, zfs->bank, offsetof(struct zerofs_superblock, meta), &zfs->meta, sizeof(struct zerofs_metadata));
+  if(zfs->meta.version>ZEROFS_SUPERBLOCK_VERSION_MAX) zfs->meta.version=ZEROFS_SUPERBLOCK_VERSION_MAX;
+#if (ZEROFS_VERIFY!=0)
+  zfs->verify_cnt=zfs->verify=ZEROFS_VERIFY;
+#endif
+  zfs->sector_map=NULL;
+  zfs->erased_max=0;
+  // entries are allocated in order, the first blank entry ends the namemap
+  for(i=0;i<ZEROFS_MAX_NUMBER_OF_FILES;i++)
+  {
+    zerofs_nm_read(zfs, i, &nm);
+#if (ZEROFS_SUPER_PAGED!=0)
+    zfs->name_hash[i]=zerofs_name_hash(nm.name);
+#endif
+    if(zerofs_nm_blank(&nm)) break;
+  }
+  zfs->last_namemap_id=i;
+  // append log records left by an unfinished WRITE session are skipped
+  for(zfs->applog=(i+1)*sizeof(struct zerofs_namemap);zfs->applog<ZEROFS_APPLOG_TOP;zfs->applog+=sizeof(rec))
+  {
+    zerofs_super_read(zfs, zfs->bank, offsetof(struct zerofs_superblock, namemap)+zfs->applog, &rec, sizeof(rec));
+    if(rec.first_sector!=0xffff||rec.first_offset!=0xffff||rec.id_len!=0xffffffff) break;
+  }
+  if(zfs->applog>ZEROFS_APPLOG_TOP) zfs->applog=ZEROFS_APPLOG_TOP;
+  zfs->applog_end=zfs->applog;
+  // the newest erase log record tells how far the background erase got before the reset
+  for(offs=zfs->applog;offs<ZEROFS_APPLOG_TOP;offs+=sizeof(rec))
+  {
+    zerofs_super_read(zfs, zfs->bank, offsetof(struct zerofs_superblock, namemap)+offs, &rec, sizeof(rec));
+    if((rec.id_len>>24)!=ZEROFS_APPLOG_ERASED||rec.id_len==0xffffffff) continue;
+    zfs->erased_max=zfs->erased_logged=MIN(rec.id_len&0xffffff, ZEROFS_SECTORS(zfs));
+    break;
+  }
+
+  return(0);
+}
+
+static uint32_t zerofs_le32(const uint8_t *p)
+{
+  return(p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24));
+}
+
+// fill the geometry from the SFDP tables of the data flash (JESD216, read with instruction 0x5a from address 0)
+// the data devices are the same part, the erase type of ZEROFS_ERASE_BLOCK_SIZE is used
+int zerofs_sfdp_parse(const uint8_t *sfdp, uint32_t len, struct zerofs_geometry *geo)
+{
+  static const uint16_t erase_unit_ms[]={ 1, 16, 128, 1000 };
+  const uint8_t *ph,*bfpt=NULL;
+  uint32_t i,n,dw,ptp,t;
+  uint64_t bytes;
+
+  if(NULL==sfdp||NULL==geo||len<16||zerofs_le32(sfdp)!=0x50444653u) return(ZEROFS_ERR_ARG);
+  // basic flash parameter table, parameter id 0xff00
+  for(i=0;i<=sfdp[6]&&16+i*8<=len;i++)
+  {
+    ph=sfdp+8+i*8;
+    ptp=ph[4]|(ph[5]<<8)|(ph[6]<<16);
+    n=ph[3];
+    if(ph[0]==0x00&&ph[7]==0xff&&n>=9&&ptp+n*4<=len) { bfpt=sfdp+ptp; break; }
+  }
+  if(NULL==bfpt) return(ZEROFS_ERR_ARG);
+  memset(geo, 0, sizeof(struct zerofs_geometry));
+  // density in bits, 2^N bits above 2 Gbit
+  dw=zerofs_le32(bfpt+4);
+  if(dw&0x80000000u)
+  {
+    if((dw&0x7fffffffu)>=40) return(ZEROFS_ERR_ARG);
+    bytes=((uint64_t)1<<(dw&0x7fffffffu))/8;
+  }
+  else bytes=((uint64_t)dw+1)/8;
+  geo->sectors=MIN(bytes/ZEROFS_FLASH_SECTOR_SIZE*ZEROFS_DATA_DEVICES, 0xffff);
+  // four erase types: size exponent and instruction
+  for(t=0;t<4;t++) if(bfpt[28+t*2]>0&&bfpt[28+t*2]<32&&(1u<<bfpt[28+t*2])==ZEROFS_ERASE_BLOCK_SIZE) break;
+  if(t>=4) return(ZEROFS_ERR_ARG);
+  geo->erase_opcode=bfpt[29+t*2];
+  geo->page_size=256;
+  // JESD216A and later: typical erase and page program times
+  if(n>=11)
+  {
+    dw=zerofs_le32(bfpt+36)>>(4+t*7);
+    geo->erase_us=((dw&0x1f)+1)*erase_unit_ms[(dw>>5)&3]*1000u;
+    dw=zerofs_le32(bfpt+40);
+    geo->page_size=1u<<((dw>>4)&0xf);
+    geo->program_byte_ns=(((dw>>8)&0x1f)+1)*((dw&(1u<<13))?64:8)*1000u/geo->page_size;
+  }
+
+  return(0);
+}
+
+// is zerofs in read only mode?
+int zerofs_is_readonly_mode(struct zerofs *zfs)
+{
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  return(NULL==zfs->sector_map);
+}
+
+#define ZEROFS_SUPER_PROGRAM_US(n) ((uint32_t)(((uint64_t)(n)*ZEROFS_SUPER_PROGRAM_BYTE_NS+999)/1000))
+
+// copy superblock to the secondary flash sector and 
+// update the sector_map and compact the namemap entries
+// the copy stops when the estimated flash time of the call reaches budget_us,
+// returns ZEROFS_IN_PROGRESS until the new bank is active
+static int zerofs_repack_step(struct zerofs *zfs, struct zerofs_repack *rp, uint32_t budget_us)
+{
+  static const char zero[6];
+  struct zerofs_namemap nm;
+  uint8_t below[ZEROFS_IDSET_SIZE],b;
+  uint32_t spent=0,n;
+  int j,id,nb=(zfs->bank+1)%ZEROFS_SUPER_BANKS;
+
+  switch(rp->phase)
+  {
+    case 0:
+      ZEROFS_SPAN(zfs, "repack", 1);
+      memset(rp, 0, sizeof(struct zerofs_repack));
+      rp->phase=1;
+      // erase the next superblock bank of the ring unless it was erased in advance
+      if((zfs->super_erased&(1u<<nb))==0)
+      {
+        zerofs_super_erase_bank(zfs, nb, 0);
+        spent=ZEROFS_SUPER_ERASE_US;
+      }
+      zfs->super_erased&=~(1u<<nb);
+      // fall through
+    case 1:
+      // program the namemap and skip the deleted items
+      for(;rp->id<zfs->last_namemap_id;rp->id++)
+      {
+        // the append log records are folded into the entries
+        zerofs_nm_get(zfs, rp->id, &nm);
+        if(memcmp(&nm.name, zero, sizeof(zero))==0||ZEROFS_NM_GET_SIZE(&nm)==0||nm.type_len==0xffffffff)
+        {
+          ZEROFS_IDSET_ADD(rp->ids, rp->id);
+          rp->dropped++;
+          continue;
+        }
+        if(spent>0&&spent+ZEROFS_SUPER_PROGRAM_US(sizeof(nm))>budget_us) return(ZEROFS_IN_PROGRESS);
+        // program the name entry
+        zerofs_super_write(zfs, nb, offsetof(struct zerofs_superblock, namemap)+(rp->id-rp->dropped)*sizeof(struct zerofs_namemap), &nm, sizeof(struct zerofs_namemap));
+        spent+=ZEROFS_SUPER_PROGRAM_US(sizeof(nm));
+      }
+      // the ids move down by the deleted entries below them, one sector_map pass
+      if(rp->dropped>0)
+      {
+        for(j=n=0;j<ZEROFS_IDSET_SIZE;j++)
+        {
+          below[j]=n;
+          for(b=rp->ids[j];b!=0;b&=b-1) n++;
+        }
+        for(j=0;j<ZEROFS_SECTORS(zfs);j++)
+        {
+          id=zfs->sector_map[j];
+          if(id>=ZEROFS_MAP_BAD) continue;
+          if(id>=rp->id) zfs->sector_map[j]-=rp->dropped;
+          else
+          {
+            n=below[id>>3];
+            for(b=rp->ids[id>>3]&((1u<<(id&7))-1);b!=0;b&=b-1) n++;
+            zfs->sector_map[j]-=n;
+          }
+        }
+        ZEROFS_COUNT(zfs, map_probes, ZEROFS_SECTORS(zfs));
+      }
+      // update the free slot for the next namemap entry
+      zfs->last_namemap_id=rp->id-rp->dropped;
+      rp->phase=2;
+      // fall through
+    case 2:
+      // program the updated RAM sector map, in granules that fit the budget
+      while(rp->pos<ZEROFS_NUMBER_OF_SECTORS)
+      {
+        n=(budget_us>spent?(uint32_t)MIN((uint64_t)(budget_us-spent)*1000/ZEROFS_SUPER_PROGRAM_BYTE_NS, ZEROFS_NUMBER_OF_SECTORS):0);
+        n-=n%ZEROFS_SUPER_WRITE_GRANULARITY;
+        if(n==0)
+        {
+          if(spent>0) return(ZEROFS_IN_PROGRESS);
+          n=ZEROFS_SUPER_WRITE_GRANULARITY;
+        }
+        n=MIN(n, ZEROFS_NUMBER_OF_SECTORS-rp->pos);
+        zerofs_super_write(zfs, nb, offsetof(struct zerofs_superblock, sector_map)+rp->pos, zfs->sector_map+rp->pos, n);
+        rp->pos+=n;
+        spent+=ZEROFS_SUPER_PROGRAM_US(n);
+      }
+      rp->phase=3;
+      // fall through
+    case 3:
+      if(spent>0&&spent+ZEROFS_SUPER_PROGRAM_US(sizeof(struct zerofs_metadata))>budget_us) return(ZEROFS_IN_PROGRESS);
+      // copy the metadata fields from RAM if present, the new bank is valid from here
+      zfs->meta.version--;
+      if(zfs->meta.version==0) zfs->meta.version=ZEROFS_SUPERBLOCK_VERSION_MAX;
+      zerofs_super_write(zfs, nb, offsetof(struct zerofs_superblock, meta), &zfs->meta, sizeof(struct zerofs_metadata));
+      // no erase on version wrap, the boot time selection handles it
+      zfs->bank=nb;
+      zfs->superblock=ZEROFS_SUPER_BANK(zfs, zfs->bank);
+      zfs->applog=zfs->applog_end=ZEROFS_APPLOG_TOP;
+      zfs->repacks++;
+      rp->phase=0;
+      ZEROFS_SPAN(zfs, "repack", 0);
+  }
+
+  return(0);
+}
+
+static void zerofs_repack_superblock(struct zerofs *zfs)
+{
+  struct zerofs_repack rp={0};
+
+  if(NULL==zfs||zerofs_is_readonly_mode(zfs)) return;
+  while(zerofs_repack_step(zfs, &rp, ~(uint32_t)0)==ZEROFS_IN_PROGRESS);
+}
+
+// program an erase log record below the append log, every record goes to blank flash once
+static void zerofs_erase_log_put(struct zerofs *zfs, uint32_t erased)
+{
+  struct zerofs_applog rec={ 0xffff, 0xffff, (ZEROFS_APPLOG_ERASED<<24)|erased };
+
+  zfs->applog-=sizeof(rec);
+  zerofs_super_write(zfs, zfs->bank, offsetof(struct zerofs_superblock, namemap)+zfs->applog, &rec, sizeof(rec));
+  zfs->erased_logged=erased;
+}
+
+// the mode switch after the repack of the READ mode commit
+static int zerofs_mode_set(struct zerofs *zfs, uint8_t *sector_map)
+{
+  zfs->sector_map=sector_map;
+  zfs->ahead=0;
+  if(NULL!=sector_map)
+  {
+    // SET WRITE MODE
+    // the sectors of the erase log can be written from here, a reset must not find them erased
+    if(zfs->erased_logged>0) zerofs_erase_log_put(zfs, 0);
+    if((zfs->flags&ZEROFS_FLAGS_EMPTY)==0) zerofs_super_read(zfs, zfs->bank, offsetof(struct zerofs_superblock, sector_map), sector_map, ZEROFS_NUMBER_OF_SECTORS);
+    else memset(sector_map, ZEROFS_MAP_EMPTY, ZEROFS_NUMBER_OF_SECTORS);
+    zfs->flags&=~ZEROFS_FLAGS_EMPTY;
+    uint8_t *sm=sector_map;
+    // mark all background erased sectors erased, the scan skipped the blocks holding data
+    for(int i=0; i<zfs->erased_max; i++) if(sm[ZEROFS_BLOCK(zfs, i)]==ZEROFS_MAP_EMPTY&&zerofs_block_empty(zfs, ZEROFS_BLOCK(zfs, i))>0) sm[ZEROFS_BLOCK(zfs, i)]=ZEROFS_MAP_ERASED;
+    ZEROFS_COUNT(zfs, map_probes, zfs->erased_max);
+    zfs->erased_max=0;
+    // the hint is for one session only
+    zfs->erase_hint=0;
+  }
+  
+  zerofs_fop_drain(zfs);
+  return(0);
+}
+
+int zerofs_readonly_mode(struct zerofs *zfs, uint8_t *sector_map)
+{
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  
+  if(NULL==sector_map&&NULL!=zfs->sector_map)
+  {
+    // SET READ MODE
+    zerofs_repack_superblock(zfs);
+  }
+
+  return(zerofs_mode_set(zfs, sector_map));
+}
+
+// helper to convert a char to the 6bit encoded version
+static inline uint8_t str6bit(char a)
+{
+  if(a>='a'&&a<='z') return(2+a-'a');
+  if(a>='A'&&a<='Z') return(2+26+a-'A');
+  if(a>='0'&&a<='9') return(2+2*26+a-'0');
+  if(a=='-') return(1);
+  return(0);
+}
+
+static inline int zerofs_get_type(const char *extension)
+{
+  int ret=ZEROFS_TYPE_UNKNOWN;
+  int i;
+
+  assert(extension);
+  
+  for(i=0; NULL!=zerofs_extensions[i]; i++)
+  {
+    if(zerofs_extensions[i][0]>extension[0]) break;
+    if(zerofs_extensions[i][0]==extension[0])
+    {
+      if(zerofs_extensions[i][1]==extension[1] && zerofs_extensions[i][2]==extension[2]) { ret=i; break; }
+    }
+  }
+
+  return(ret);
+}
+
+// code/decode name
+// if str is empty, decode the encoded name to str
+// otherwise encode str to encoded array
+// length is fixed 8 char and 6 byte encoded
+static int zerofs_name_codec(char *str, uint8_t *encoded, uint8_t *type)
+{
+  static const char hexdigits[]="_-abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"; // 64 char
+
+  assert(str&&encoded);
+
+  if(str[0]=='\0')
+  {
+    // decode
+    str[0]=hexdigits[encoded[0]&0x3f];
+    str[1]=hexdigits[encoded[1]&0x3f];
+    str[2]=hexdigits[encoded[2]&0x3f];
+    str[3]=hexdigits[ (encoded[0]&0xc0)>>2 | (encoded[1]&0xc0)>>4 | (encoded[2]&0xc0)>>6 ];
+    str[4]=hexdigits[encoded[3]&0x3f];
+    str[5]=hexdigits[encoded[4]&0x3f];
+    str[6]=hexdigits[encoded[5]&0x3f];
+    str[7]=hexdigits[ (encoded[3]&0xc0)>>2 | (encoded[4]&0xc0)>>4 | (encoded[5]&0xc0)>>6 ];
+    str[8]='\0';
+  }
+  else
+  {
+    // encode
+    uint8_t x;
+    char n[8];
+    int j,i;
+    for(i=0;str[i]!='.'&&str[i]!='\0';i++);  // find '.'
+    if(str[i]=='\0'||i>8) return(ZEROFS_ERR_INVALIDNAME);
+    if(NULL!=type) *type=zerofs_get_type(&str[i+1]);
+    for(j=7,--i;i>=0;--i) n[j--]=str[i]; // copy basename to n[]
+    for(;j>=0;--j) n[j]='_'; // fill rest of n[] with '_'
+    x=str6bit(n[3]);
+    encoded[0]=str6bit(n[0]) | ((x&0x30)<<2);
+    encoded[1]=str6bit(n[1]) | ((x&0x0c)<<4);
+    encoded[2]=str6bit(n[2]) | ((x&0x03)<<6);
+    x=str6bit(n[7]);
+    encoded[3]=str6bit(n[4]) | ((x&0x30)<<2);
+    encoded[4]=str6bit(n[5]) | ((x&0x0c)<<4);
+    encoded[5]=str6bit(n[6]) | ((x&0x03)<<6);
+  }
+  return(0);
+}
+
+// look for available sector for data in ring order after 'from' and before 'end'
+// the sectors of a file follow each other in ring order from its first sector, 'end' is the first
+// sector of the file being written, from==end searches the whole ring
+// erased sectors first, they fill the erase blocks already erased before new blocks are erased
+static int zerofs_find_free_block(struct zerofs *zfs, sector_t from, sector_t end)
+{
+  int ret=-1;
+  int i,n,fre=-1;
+  const uint8_t *sm;
+  sector_t sec;
+
+  assert(zfs);
+
+  sm=zfs->sector_map;
+  n=ZEROFS_RING(zfs, end+ZEROFS_SECTORS(zfs)-from);
+  if(0==n) n=ZEROFS_SECTORS(zfs);
+  for(i=0;i<n;i++)
+  {
+    sec=ZEROFS_RING(zfs, from+i);
+    ZEROFS_COUNT(zfs, map_probes, 1);
+    if(sm[sec]==ZEROFS_MAP_ERASED) break;
+    // an EMPTY sector is erased with its block, the block should not hold data
+    if(fre<0&&sm[sec]==ZEROFS_MAP_EMPTY&&zerofs_block_empty(zfs, sec)>0) fre=sec;
+  }
+  if(i<n) ret=sec;
+  else if(fre>=0) ret=fre;
+  
+  return(ret);
+}
+
+// striped data area, the next free sector is prepared on another device while sector s is written
+// the sector stays EMPTY in the map so the allocation order does not change, the next
+// zerofs_erase_empty() of the session skips its erase, a blank check longer than chunks reads is left to it
+static void zerofs_erase_ahead(struct zerofs *zfs, sector_t s, sector_t first, uint32_t chunks)
+{
+#if (ZEROFS_DATA_DEVICES>1)
+  int t=zerofs_find_free_block(zfs, s, first);
+
+  if(t<0||zfs->ahead!=0||zfs->sector_map[t]!=ZEROFS_MAP_EMPTY||(t%ZEROFS_DATA_DEVICES)==(s%ZEROFS_DATA_DEVICES)) return;
+  zfs->ahead=t+1;
+#if (ZEROFS_BLANK_CHECK!=0)
+  uint32_t pos=0;
+  // the reads wait only for the device of t, fls_blank_check() would need all devices idle
+  if(NULL==zfs->fls->fls_blank_check)
+  {
+    int ret=zerofs_blank_read(zfs, t, &pos, ZEROFS_FLASH_SECTOR_SIZE, chunks);
+    if(ret<0) zfs->ahead=0;
+    if(ret!=0) return;
+  }
+#endif
+  zerofs_data_access(zfs);
+  zerofs_fls_erase(zfs, zfs->fls->data_ud, t*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE, 0);
+#endif
+}
+
+// look for a specific type of sector
+static int zerofs_find_sector_type(struct zerofs *zfs, sector_t from, uint8_t type)
+{
+  int ret;
+  int i;
+
+  assert(zfs);
+
+  for(i=1;i<ZEROFS_SECTORS(zfs);i++)
+  {
+    if(zerofs_map_get(zfs, ZEROFS_RING(zfs, from+i))==type) break;
+  }
+  ret=ZEROFS_RING(zfs, from+i);
+  if(zerofs_map_get(zfs, ret)!=type) ret=-1;
+
+  return(ret);
+}
+
+// look for the given name and type in the namemap (ignores other field in nm)
+static uint8_t zerofs_namemap_find_name(struct zerofs *zfs, struct zerofs_namemap *nm, uint8_t type)
+{
+  struct zerofs_namemap e;
+  int id;
+
+  if(NULL==zfs||NULL==nm) return(ZEROFS_MAP_EMPTY);
+
+#if (ZEROFS_SUPER_PAGED!=0)
+  uint8_t h=zerofs_name_hash(nm->name);
+#endif
+  for(id=0;id<zfs->last_namemap_id;id++)
+  {
+#if (ZEROFS_SUPER_PAGED!=0)
+    // only fetch the entries from flash with matching name index
+    ZEROFS_COUNT(zfs, map_probes, 1);
+    if(zfs->name_hash[id]!=h) continue;
+#endif
+    zerofs_nm_read(zfs, id, &e);
+    if(e.type_len!=0 && ZEROFS_NM_GET_TYPE(&e)==type && memcmp(e.name, nm->name, sizeof(e.name))==0) return(id);
+  }
+
+  return(ZEROFS_MAP_EMPTY);
+}
+
+// fill the dirent with the data of file 'id'
+static void zerofs_dirent_fill(struct zerofs_dirent *de, int id, struct zerofs_namemap *nm)
 {
-  uint8_t id;
-  const struct zerofs_namemap *nmp;
   uint8_t type=0;
   uint8_t basename[sizeof(((struct zerofs_namemap *)0)->name)];
   char name[9];
+  int i,j;
+
+  memcpy(basename, nm->name, sizeof(((struct zerofs_namemap *)0)->name));
+  name[0]='\0';
+  zerofs_name_codec(name, basename, &type);
+  for(j=i=0;name[i]=='_'&&i<(sizeof(name)-1);i++);
+  for(;name[i]!='\0'&&i<sizeof(name);i++) de->name[j++]=name[i];
+  type=ZEROFS_NM_GET_TYPE(nm);
+  de->name[j++]='.';
+  de->name[j++]=zerofs_extensions[type][0];
+  de->name[j++]=zerofs_extensions[type][1];
+  de->name[j++]=zerofs_extensions[type][2];
+  de->name[j]='\0';
+  de->len=ZEROFS_NM_GET_SIZE(nm);
+  de->id=id;
+}
+
+// fill out next file in provided struct zerofs_dirent
+// if name is \0 it returns the first file
+// return 0 if ok, -1 if last file reached
+int zerofs_dir_next(struct zerofs *zfs, struct zerofs_dirent *de)
+{
+  uint8_t id;
+  struct zerofs_namemap nm;
 
   if(NULL==zfs||NULL==de) return(ZEROFS_ERR_ARG);
 
   if(de->name[0]!='\0') id=de->id+1;
   else id=0;
-  for(nmp=&zfs->superblock->namemap[id];id<zfs->last_namemap_id;nmp++,id++) if(nmp->type_len!=0) break;
-  if(id<zfs->last_namemap_id)
-  {
-    int i,j;
-    // fill the dirent with the data of file 'id'
-    memcpy(basename, zfs->superblock->namemap[id].name, sizeof(((struct zerofs_namemap *)0)->name));
-    name[0]='\0';
-    zerofs_name_codec(name, basename, &type);
-    for(j=i=0;name[i]=='_'&&i<(sizeof(name)-1);i++);
-    for(;name[i]!='\0'&&i<sizeof(name);i++) de->name[j++]=name[i];
-    type=ZEROFS_NM_GET_TYPE(&zfs->superblock->namemap[id]);
-    de->name[j++]='.';
-    de->name[j++]=zerofs_extensions[type][0];
-    de->name[j++]=zerofs_extensions[type][1];
-    de->name[j++]=zerofs_extensions[type][2];
-    de->name[j]='\0';
-    de->len=ZEROFS_NM_GET_SIZE(&zfs->superblock->namemap[id]);
-    de->id=id;
+  for(;id<zfs->last_namemap_id;id++)
+  {
+    zerofs_nm_get(zfs, id, &nm);
+    if(nm.type_len!=0) break;
   }
+  if(id<zfs->last_namemap_id) zerofs_dirent_fill(de, id, &nm);
   else return(ZEROFS_ERR_ENDOFDIR);
 
   return(0);
@@ -613,16 +1640,17 @@ int zerofs_open(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
     if(id!=ZEROFS_MAP_EMPTY)
     {
       // 3.
-      sc=zfs->superblock->namemap[id].first_sector;
-      of=zfs->superblock->namemap[id].first_offset;
+      zerofs_nm_get(zfs, id, &nm);
+      sc=nm.first_sector;
+      of=nm.first_offset;
       fp->pos=of;
       fp->bytepos=0;
       // 4.
       fp->sector=sc;
       fp->id=id;
       fp->mode=ZEROFS_MODE_READ_ONLY;
-      fp->size=ZEROFS_NM_GET_SIZE(&zfs->superblock->namemap[id]);
-      fp->type=ZEROFS_NM_GET_TYPE(&zfs->superblock->namemap[id]);
+      fp->size=ZEROFS_NM_GET_SIZE(&nm);
+      fp->type=ZEROFS_NM_GET_TYPE(&nm);
       ret=0;
     }
     else ret=ZEROFS_ERR_NOTFOUND;
@@ -642,14 +1670,8 @@ static int zerofs_namemap_find_slot(struct zerofs *zfs)
 
   if(!zerofs_is_readonly_mode(zfs))
   {
-    ret=zfs->last_namemap_id;
-    ++zfs->last_namemap_id;
-    if(zfs->last_namemap_id>=ZEROFS_MAX_NUMBER_OF_FILES)
-    {
-      zerofs_repack_superblock(zfs);
-      ret=zfs->last_namemap_id;
-      if(zfs->last_namemap_id>=ZEROFS_MAX_NUMBER_OF_FILES) ret=-1;
-    }
+    if(zfs->last_namemap_id>=zerofs_namemap_limit(zfs)) zerofs_repack_superblock(zfs);
+    if(zfs->last_namemap_id<zerofs_namemap_limit(zfs)) ret=zfs->last_namemap_id++;
   }
   
   return(ret);
@@ -673,69 +1695,206 @@ int zerofs_fs_unlink(const char *name);
      e) set the beginning sector of the found entry to the newly allocated sector <-- namemap is RO flash, we need to restore original sector map
      f) do 7.b. here to 'last' <-- no need
 */
-static int zerofs_delete_by_id(struct zerofs *zfs, int id)
+// a freed last sector may hold the beginning of a remaining file, hand it over
+static void zerofs_sector_adopt(struct zerofs *zfs, uint8_t skip)
+{
+  struct zerofs_namemap nm;
+  int id;
+
+  for(id=0;id<zfs->last_namemap_id;id++)
+  {
+    if(id==skip) continue;
+    zerofs_nm_get(zfs, id, &nm);
+    if(nm.type_len==0||nm.first_sector>=ZEROFS_SECTORS(zfs)) continue;
+    if(zfs->sector_map[nm.first_sector]==ZEROFS_MAP_EMPTY) zfs->sector_map[nm.first_sector]=id;
+  }
+}
+
+// 4. zero the namemap records of the id set, adjacent records are programmed together
+// returns the number of deleted files
+static int zerofs_zero_ids(struct zerofs *zfs, const uint8_t *ids)
+{
+  static const struct zerofs_namemap zero[4];
+  int id,run,cnt=0;
+
+  for(id=0;id<zfs->last_namemap_id;id+=run)
+  {
+    for(run=0;id+run<zfs->last_namemap_id&&run<(int)(sizeof(zero)/sizeof(zero[0]))&&ZEROFS_IDSET_HAS(ids, id+run);run++);
+    if(0==run) { run=1; continue; }
+    zerofs_super_write(zfs, zfs->bank, (id*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap), zero, run*sizeof(struct zerofs_namemap));
+    cnt+=run;
+  }
+
+  return(cnt);
+}
+
+// free the sectors of the deleted id set with one sector_map pass
+static void zerofs_release_ids(struct zerofs *zfs, const uint8_t *ids)
 {
-  int ret=0;
   uint8_t *sm;
-  sector_t sec;
-  int i,last;
-  static const struct zerofs_namemap zero;
+  int i;
+
+  sm=zfs->sector_map; // valid because we are in write mode, sector_map is in RAM
+  // 6.
+  for(i=0;i<ZEROFS_SECTORS(zfs);i++) if(sm[i]<ZEROFS_MAP_BAD&&ZEROFS_IDSET_HAS(ids, sm[i])) sm[i]=ZEROFS_MAP_EMPTY;
+  ZEROFS_COUNT(zfs, map_probes, ZEROFS_SECTORS(zfs));
+  // 7.
+  zerofs_sector_adopt(zfs, ZEROFS_MAP_EMPTY);
+}
+
+// delete all files of the id set, returns the number of deleted files
+static int zerofs_delete_ids(struct zerofs *zfs, const uint8_t *ids)
+{
+  int cnt=zerofs_zero_ids(zfs, ids);
+
+  if(cnt>0) zerofs_release_ids(zfs, ids);
+
+  return(cnt);
+}
+
+static int zerofs_delete_by_id(struct zerofs *zfs, int id)
+{
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
 
   // 1. in zerofs_delete()
-  if(id!=ZEROFS_MAP_EMPTY)
-  {
-    // 3.
-    sm=(uint8_t *)ZEROFS_SECTOR_MAP(zfs); // valid because we are in write mode, superblock is in RAM
-    sector_t from=zfs->superblock->namemap[id].first_sector;
-    // 4.
-    uint32_t addr = (id*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap);
-    zfs->fls->fls_write(zfs->fls->super_ud, addr+(zfs->bank*ZEROFS_SUPER_SECTOR_SIZE), ((uint8_t *)&zero), sizeof(zero));
-    // 6.
-    for(last=-1,i=0;i<ZEROFS_NUMBER_OF_SECTORS;i++)
-    {
-      sec=(i+from)%ZEROFS_NUMBER_OF_SECTORS;
-      if(sm[sec]==id)
-      {
-        last=sec;
-        sm[sec]=ZEROFS_MAP_EMPTY;
-      }
-    }
-    // 7.
-    if(last>=0)
-    {
-      sm[last]=zerofs_namemap_find_sector(zfs, last);
-    }
+  if(id==ZEROFS_MAP_EMPTY) return(ZEROFS_ERR_NOTFOUND);
+  ZEROFS_IDSET_ADD(ids, id);
+  zerofs_delete_ids(zfs, ids);
+
+  return(0);
+}
+
+// the namemap entry of the name, ZEROFS_MAP_EMPTY if there is no such file
+static int zerofs_name_id(struct zerofs *zfs, const char *name, int *id)
+{
+  struct zerofs_namemap nm={0};
+  uint8_t type;
+  int ret=zerofs_name_codec((char *)name, nm.name, &type);
+
+  if(0==ret)
+  {
+    nm.type_len=((uint32_t)type)<<24;
+    *id=zerofs_namemap_find_name(zfs, &nm, type);
   }
-  else ret=ZEROFS_ERR_NOTFOUND;
-  
+
   return(ret);
 }
 
+// collect the ids of the names, unknown names are skipped
+static int zerofs_idset_names(struct zerofs *zfs, uint8_t *ids, const char *names[], int n)
+{
+  int i,id,ret;
+
+  for(i=0;i<n;i++)
+  {
+    if(NULL==names[i]) return(ZEROFS_ERR_ARG);
+    ret=zerofs_name_id(zfs, names[i], &id);
+    if(ret!=0) return(ret);
+    if(id!=ZEROFS_MAP_EMPTY) ZEROFS_IDSET_ADD(ids, id);
+  }
+
+  return(0);
+}
+
 int zerofs_delete(struct zerofs *zfs, const char *name)
 {
   int ret=0;
-  struct zerofs_namemap nm={0};
   int id;
-  uint8_t type;
 
   if(NULL==zfs||NULL==name) return(ZEROFS_ERR_ARG);
 
   if(!zerofs_is_readonly_mode(zfs))
   {
     // 1.
-    ret=zerofs_name_codec((char *)name, nm.name, &type);
-    if(0==ret)
-    {
-      nm.type_len=((uint32_t)type)<<24;
-      id=zerofs_namemap_find_name(zfs, &nm, type);
-      ret=zerofs_delete_by_id(zfs, id);
-    }
+    ret=zerofs_name_id(zfs, name, &id);
+    if(0==ret) ret=zerofs_delete_by_id(zfs, id);
   }
   else ret=ZEROFS_ERR_READMODE;
   
   return(ret);
 }
 
+// deletes the listed files, returns the number of deleted files
+int zerofs_delete_many(struct zerofs *zfs, const char *names[], int n)
+{
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
+  int ret;
+
+  if(NULL==zfs||(NULL==names&&n>0)) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
+
+  ret=zerofs_idset_names(zfs, ids, names, n);
+  if(0==ret) ret=zerofs_delete_ids(zfs, ids);
+
+  return(ret);
+}
+
+// deletes the files accepted by match(), returns the number of deleted files
+int zerofs_delete_if(struct zerofs *zfs, int (*match)(const struct zerofs_dirent *de, void *ud), void *ud)
+{
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
+  struct zerofs_dirent de;
+  struct zerofs_namemap nm;
+  int id;
+
+  if(NULL==zfs||NULL==match) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
+
+  for(id=0;id<zfs->last_namemap_id;id++)
+  {
+    zerofs_nm_get(zfs, id, &nm);
+    // deleted entries and the files being written are skipped, the latter have no type and length yet
+    if(nm.type_len==0||nm.type_len==0xffffffff) continue;
+    zerofs_dirent_fill(&de, id, &nm);
+    if(match(&de, ud)) ZEROFS_IDSET_ADD(ids, id);
+  }
+
+  return(zerofs_delete_ids(zfs, ids));
+}
+
+// deletes all files with the extension, returns the number of deleted files
+int zerofs_delete_by_type(struct zerofs *zfs, const char *extension)
+{
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
+  struct zerofs_namemap nm;
+  int id,type;
+
+  if(NULL==zfs||NULL==extension) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
+
+  type=zerofs_get_type(extension);
+  for(id=0;id<zfs->last_namemap_id;id++)
+  {
+    zerofs_nm_read(zfs, id, &nm);
+    // deleted entries and the files being written are skipped
+    if(nm.type_len!=0&&nm.type_len!=0xffffffff&&ZEROFS_NM_GET_TYPE(&nm)==type) ZEROFS_IDSET_ADD(ids, id);
+  }
+
+  return(zerofs_delete_ids(zfs, ids));
+}
+
+// deletes all files but the listed ones, returns the number of deleted files
+int zerofs_delete_except(struct zerofs *zfs, const char *names[], int n)
+{
+  uint8_t keep[ZEROFS_IDSET_SIZE]={0};
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
+  struct zerofs_namemap nm;
+  int id,ret;
+
+  if(NULL==zfs||(NULL==names&&n>0)) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
+
+  ret=zerofs_idset_names(zfs, keep, names, n);
+  if(ret!=0) return(ret);
+  for(id=0;id<zfs->last_namemap_id;id++)
+  {
+    zerofs_nm_read(zfs, id, &nm);
+    if(nm.type_len!=0&&nm.type_len!=0xffffffff&&!ZEROFS_IDSET_HAS(keep, id)) ZEROFS_IDSET_ADD(ids, id);
+  }
+
+  return(zerofs_delete_ids(zfs, ids));
+}
+
 /*
 struct zerofs_fs *zerofs_create(const char *name);                                     - WO write only creation of a file
   0. check if file exists and delete if it is
@@ -756,10 +1915,64 @@ struct zerofs_fs *zerofs_create(const char *name);
      fp->sector = beginning
      fp->mode = WO
 */
-int zerofs_create(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+// 3.-4. the first sector of the new file, an EMPTY one is prepared by the caller
+static int zerofs_create_sector(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+{
+  struct zerofs_namemap nm;
+  int ret;
+
+  // 3
+  ret=zerofs_name_codec((char *)name, nm.name, &fp->type);
+  if(0==ret)
+  {
+    // 4
+    // a deleted last sector is erased with its erase block, it cannot be used while the block holds data
+    if(zfs->meta.last_written_len>0 && zfs->meta.last_written_len<ZEROFS_FLASH_SECTOR_SIZE &&
+       (zfs->sector_map[zfs->meta.last_written]!=ZEROFS_MAP_EMPTY||zerofs_block_empty(zfs, zfs->meta.last_written)>0))
+    {
+      // 4.0 set nomore flag to prevent multiple starter files in the same sector
+      fp->flags|=ZEROFS_FILE_NOMORE;
+      // 4.a)
+      fp->first_sector=fp->sector=zfs->meta.last_written;
+      fp->pos=zfs->meta.last_written_len;
+    }
+    else
+    {
+      // 4.b)
+      int s=zerofs_find_free_block(zfs, zfs->meta.last_written, zfs->meta.last_written); //HURKA
+      if(s>=0)
+      {
+        fp->first_sector=fp->sector=(uint16_t)s;
+        fp->pos=0;
+      }
+      else ret=ZEROFS_ERR_NOSPACE;
+    }
+  }
+
+  return(ret);
+}
+
+// 5.-7. the first sector is prepared, map it and program the namemap entry of the file
+static void zerofs_create_entry(struct zerofs *zfs, struct zerofs_file *fp, const char *name, int id)
+{
+  struct zerofs_namemap nm={0};
+
+  zerofs_name_codec((char *)name, nm.name, &fp->type);
+  if(ZEROFS_MAP_ERASED==zfs->sector_map[fp->sector]) zfs->sector_map[fp->sector]=id;
+  // 6. write name and first_sector/offset only
+  nm.first_sector=fp->first_sector;
+  nm.first_offset=fp->pos;
+  nm.type_len=~0;
+  zerofs_super_write(zfs, zfs->bank, ((id)*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap), &nm, sizeof(struct zerofs_namemap));
+  // 7.
+  fp->id=id;
+  fp->mode=ZEROFS_MODE_WRITE_ONLY;
+}
+
+// zerofs_create() without waiting for the erase of the first sector
+static int zerofs_create_submit(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
 {
   int ret=0;
-  struct zerofs_namemap nm={0};
 
   if(NULL==zfs||NULL==fp||NULL==name) return(ZEROFS_ERR_ARG);
 
@@ -775,48 +1988,16 @@ int zerofs_create(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
     if(id>=0)
     {
       // 2 <-- handled in zerofs_namemap_find_slot()
-      // 3
-      ret=zerofs_name_codec((char *)name, nm.name, &fp->type);
-      if(0==ret)
-      {
-        // 4
-        if(zfs->meta.last_written_len>0 && zfs->meta.last_written_len<ZEROFS_FLASH_SECTOR_SIZE)
-        {
-          // 4.0 set nomore flag to prevent multiple starter files in the same sector
-          fp->flags|=ZEROFS_FILE_NOMORE;
-          // 4.a)
-          nm.first_sector=fp->sector=zfs->meta.last_written;
-          nm.first_offset=fp->pos=zfs->meta.last_written_len;
-        }
-        else
-        {
-          // 4.b)
-          int s=zerofs_find_free_block(zfs); //HURKA
-          if(s>=0)
-          {
-            nm.first_sector=fp->sector=(uint16_t)s;
-            nm.first_offset=0;
-            fp->pos=0;
-          }
-          else ret=ZEROFS_ERR_NOSPACE;
-        }
-      }
+      ret=zerofs_create_sector(zfs, fp, name);
       if(ret==0)
       {
         // 5.
-        uint8_t *sm=(uint8_t *)ZEROFS_SECTOR_MAP(zfs);
-        if(ZEROFS_MAP_EMPTY==sm[fp->sector])
+        if(ZEROFS_MAP_EMPTY==zfs->sector_map[fp->sector])
         {
-          zfs->fls->fls_erase(zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE, 0);
-          sm[fp->sector]=ZEROFS_MAP_ERASED;
+          zerofs_erase_empty(zfs, fp->sector);
+          zfs->sector_map[fp->sector]=ZEROFS_MAP_ERASED;
         }
-        if(ZEROFS_MAP_ERASED==sm[fp->sector]) sm[fp->sector]=id;
-        // 6. write name and first_sector/offset only
-        nm.type_len=~0;
-        zfs->fls->fls_write(zfs->fls->super_ud, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE) + ((id)*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap), (uint8_t *)&nm, sizeof(struct zerofs_namemap));
-        // 7.
-        fp->id=id;
-        fp->mode=ZEROFS_MODE_WRITE_ONLY;
+        zerofs_create_entry(zfs, fp, name, id);
       }
     }
     else ret=ZEROFS_ERR_MAXFILES;
@@ -826,6 +2007,39 @@ int zerofs_create(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
   return(ret);
 }
 
+int zerofs_create(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+{
+  int ret=zerofs_create_submit(zfs, fp, name);
+
+  if(NULL!=zfs) zerofs_fop_drain(zfs);
+  return(ret);
+}
+
+// room for one more append log record before the namemap entries, keep the blank separator entry
+static inline int zerofs_applog_room(struct zerofs *zfs)
+{
+  return((int)((zfs->applog-sizeof(struct zerofs_applog))/sizeof(struct zerofs_namemap))-1>=zfs->last_namemap_id);
+}
+
+// a superblock repack since the reservation renumbered the namemap entries and restarted the append log,
+// the id of the appended file follows the sector map and its record is reserved again
+static int zerofs_append_sync(struct zerofs_file *fp)
+{
+  struct zerofs *zfs=fp->zfs;
+
+  if((fp->flags&ZEROFS_FILE_APPEND)==0||fp->repacks==zfs->repacks) return(0);
+  fp->id=zfs->sector_map[fp->sector];
+  fp->repacks=zfs->repacks;
+  if(!zerofs_applog_room(zfs))
+  {
+    fp->applog=0;
+    return(ZEROFS_ERR_MAXFILES);
+  }
+  zfs->applog-=sizeof(struct zerofs_applog);
+  fp->applog=zfs->applog;
+  return(0);
+}
+
 // closes the file after write
 int zerofs_close(struct zerofs_file *fp)
 {
@@ -836,12 +2050,23 @@ int zerofs_close(struct zerofs_file *fp)
 
   zfs=fp->zfs;
   if(NULL==zfs) return(ZEROFS_ERR_INVALIDFP);
-  if(ZEROFS_MODE_WRITE_ONLY==fp->mode)
+  if(ZEROFS_MODE_WRITE_ONLY==fp->mode&&(fp->flags&ZEROFS_FILE_APPEND)!=0)
+  {
+    // the namemap entry is programmed already, the new length goes to the append log
+    struct zerofs_applog rec;
+
+    zerofs_append_sync(fp);
+    rec=(struct zerofs_applog){ fp->first_sector, fp->first_offset, (((uint32_t)fp->id)<<24) | fp->size };
+    // without a record the file keeps its length before the append
+    if(fp->applog>0) zerofs_super_write(zfs, zfs->bank, offsetof(struct zerofs_superblock, namemap) + fp->applog, &rec, sizeof(rec));
+    else ret=ZEROFS_ERR_MAXFILES;
+  }
+  else if(ZEROFS_MODE_WRITE_ONLY==fp->mode)
   {
     uint32_t type_len=(((uint32_t)fp->type)<<24) | fp->size;
     uint16_t addr=((fp->id)*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap) + offsetof(struct zerofs_namemap, type_len);
 
-    zfs->fls->fls_write(zfs->fls->super_ud, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE) + addr, (uint8_t *)&type_len, sizeof(type_len));
+    zerofs_super_write(zfs, zfs->bank, addr, &type_len, sizeof(type_len));
     #if 0
     if( (fp->flags&ZEROFS_FILE_NOMORE)!=0 ) zfs->meta.last_written_len=0;
     #endif
@@ -872,7 +2097,7 @@ int zerofs_read(struct zerofs_file *fp, uint8_t *buf, uint32_t len)
   while(len>0)
   {
     l=MIN((int)len, (ZEROFS_FLASH_SECTOR_SIZE-fp->pos));
-    zfs->fls->fls_read(zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l);
+    zerofs_fls_read(zfs, zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l);
     len-=l;
     buf+=l;
     fp->pos+=l;
@@ -895,10 +2120,10 @@ int zerofs_seek(struct zerofs_file *fp, int32_t pos)
 {
   int ret=0;
   int i;
-  const uint8_t *sm;
   int32_t dec;
   sector_t sec;
   uint16_t first_block_fill;
+  struct zerofs_namemap nm;
 
   if(NULL==fp) return(ZEROFS_ERR_ARG);
 
@@ -908,17 +2133,17 @@ int zerofs_seek(struct zerofs_file *fp, int32_t pos)
     {
       pos=( pos>=0 ? pos : fp->size+pos);
       fp->bytepos=pos;
-      first_block_fill=ZEROFS_FLASH_SECTOR_SIZE-fp->zfs->superblock->namemap[fp->id].first_offset;
-      sec=fp->zfs->superblock->namemap[fp->id].first_sector;
+      zerofs_nm_get(fp->zfs, fp->id, &nm);
+      first_block_fill=ZEROFS_FLASH_SECTOR_SIZE-nm.first_offset;
+      sec=nm.first_sector;
       if(pos > first_block_fill)
       {
-        sm=ZEROFS_SECTOR_MAP(fp->zfs);
         dec=first_block_fill;
         do
         {
-          for(i=1; fp->id!=sm[(i+sec)%ZEROFS_NUMBER_OF_SECTORS] && i<ZEROFS_NUMBER_OF_SECTORS; i++);
-          if(i>=ZEROFS_NUMBER_OF_SECTORS) { ret=ZEROFS_ERR_OVERFLOW; break; }
-          sec=(i+sec)%ZEROFS_NUMBER_OF_SECTORS;
+          for(i=1; fp->id!=zerofs_map_get(fp->zfs, ZEROFS_RING(fp->zfs, i+sec)) && i<ZEROFS_SECTORS(fp->zfs); i++);
+          if(i>=ZEROFS_SECTORS(fp->zfs)) { ret=ZEROFS_ERR_OVERFLOW; break; }
+          sec=ZEROFS_RING(fp->zfs, i+sec);
           pos-=dec;
           dec=ZEROFS_FLASH_SECTOR_SIZE;
         } while(pos>=ZEROFS_FLASH_SECTOR_SIZE);
@@ -931,7 +2156,7 @@ int zerofs_seek(struct zerofs_file *fp, int32_t pos)
       else
       {
         fp->sector=sec;
-        fp->pos=pos+fp->zfs->superblock->namemap[fp->id].first_offset;
+        fp->pos=pos+nm.first_offset;
       }
     }
     else ret=ZEROFS_ERR_ARG;
@@ -941,89 +2166,141 @@ int zerofs_seek(struct zerofs_file *fp, int32_t pos)
   return(ret);
 }
 
+// the tail of a file reached its first sector, the sectors of a file follow each other in ring order
+// so the file is copied to a run of empty erase blocks, returns the new last sector
+static int zerofs_relocate(struct zerofs *zfs, struct zerofs_namemap *nm, uint8_t id, uint32_t size)
+{
+  int i,k,b,c,t=-1;
+  uint32_t n,l,end;
+  uint8_t *sm;
+  uint8_t buf[32];
+
+  sm=zfs->sector_map;
+  end=nm->first_offset+size;
+  k=(end+ZEROFS_FLASH_SECTOR_SIZE-1)/ZEROFS_FLASH_SECTOR_SIZE;
+  for(b=0,i=0;b<ZEROFS_SECTORS(zfs)&&i*ZEROFS_SECTORS_PER_BLOCK<k;b+=ZEROFS_SECTORS_PER_BLOCK) i=(zerofs_block_empty(zfs, b)>0?i+1:0);
+  if(i*ZEROFS_SECTORS_PER_BLOCK<k) return(-1);
+  b-=i*ZEROFS_SECTORS_PER_BLOCK;
+  c=nm->first_sector;
+  for(i=0;i<k;i++)
+  {
+    t=b+i;
+    if(sm[t]!=ZEROFS_MAP_ERASED) zerofs_erase_empty(zfs, t);
+    for(n=(i==0?nm->first_offset:0);n<MIN(end-i*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE);n+=l)
+    {
+      l=MIN(sizeof(buf), MIN(end-i*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE)-n);
+      zerofs_fls_read(zfs, zfs->fls->data_ud, c*ZEROFS_FLASH_SECTOR_SIZE+n, buf, l);
+      zerofs_fls_program(zfs, zfs->fls->data_ud, t*ZEROFS_FLASH_SECTOR_SIZE+n, buf, l, 1);
+      ZEROFS_COUNT(zfs, copied, l);
+    }
+    sm[t]=id;
+    if(sm[c]==id) sm[c]=ZEROFS_MAP_EMPTY;
+    if(i+1<k)
+    {
+      // the copies are skipped, the old sectors are never in the empty blocks
+      c=zerofs_find_sector_type(zfs, c, id);
+      if(c>=0&&ZEROFS_RING(zfs, c+ZEROFS_SECTORS(zfs)-b)<=i) c=zerofs_find_sector_type(zfs, t, id);
+      if(c<0) return(-1);
+    }
+  }
+  zerofs_sector_adopt(zfs, id);
+  nm->first_sector=b;
+
+  return(t);
+}
+
 int zerofs_append(struct zerofs *zfs, struct zerofs_file *fp, const char *name)
 {
   int ret=0;
   struct zerofs_namemap nm;
-  int id,ni;
-  int pos,dec;
-  int i;
+  int id,s;
   uint8_t *sm;
   sector_t sec;
-  static const uint8_t buf[8]={0,0,0,0,0,0,0,0};
+  uint32_t end,src,n,l;
+  uint8_t buf[32];
 
   if(NULL==zfs||NULL==fp||NULL==name) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
 
-  if(!zerofs_is_readonly_mode(zfs))
+  memset(fp, 0, sizeof(struct zerofs_file));
+  fp->zfs=zfs;
+  ret=zerofs_name_codec((char *)name, nm.name, &fp->type);
+  if(0!=ret) return(ret);
+  // room for the append log record
+  if(!zerofs_applog_room(zfs)) zerofs_repack_superblock(zfs);
+  if(!zerofs_applog_room(zfs)) return(ZEROFS_ERR_MAXFILES);
+  nm.type_len=((uint32_t)fp->type)<<24;
+  id=zerofs_namemap_find_name(zfs, &nm, fp->type);
+  if(ZEROFS_MAP_EMPTY==id) return(ZEROFS_ERR_NOTFOUND);
+  zerofs_nm_get(zfs, id, &nm);
+  if(nm.type_len==0xffffffff) return(ZEROFS_ERR_OPEN);
+  sm=zfs->sector_map;
+  fp->size=ZEROFS_NM_GET_SIZE(&nm);
+  fp->bytepos=fp->size;
+  fp->first_sector=nm.first_sector;
+  fp->first_offset=nm.first_offset;
+  // search the last sector
+  sec=nm.first_sector;
+  end=nm.first_offset+fp->size;
+  while(end>ZEROFS_FLASH_SECTOR_SIZE)
   {
-    memset(fp, 0, sizeof(struct zerofs_file));
-    fp->zfs=zfs;
-    fp->bytepos=fp->size;
-    ret=zerofs_name_codec((char *)name, nm.name, &fp->type);
-    if(0==ret)
+    s=zerofs_find_sector_type(zfs, sec, id);
+    if(s<0) return(ZEROFS_ERR_OVERFLOW);
+    sec=s;
+    end-=ZEROFS_FLASH_SECTOR_SIZE;
+  }
+  if(end<ZEROFS_FLASH_SECTOR_SIZE&&(zfs->meta.last_written!=sec||zfs->meta.last_written_len!=end))
+  {
+    // other files continue in the last sector, move the tail of the file to a new sector
+    s=zerofs_find_free_block(zfs, sec, (sec==nm.first_sector?sec:nm.first_sector));
+    if(s<0&&sec!=nm.first_sector)
+    {
+      // the tail reached the first sector of the file, the whole file is copied
+      ZEROFS_SPAN(zfs, "relocate", 1);
+      s=zerofs_relocate(zfs, &nm, id, fp->size);
+      ZEROFS_SPAN(zfs, "relocate", 0);
+      if(s<0) return(ZEROFS_ERR_NOSPACE);
+      fp->first_sector=nm.first_sector;
+      n=end;
+    }
+    else
     {
-      nm.type_len=((uint32_t)fp->type)<<24;
-      id=zerofs_namemap_find_name(zfs, &nm, fp->type);
-      if(ZEROFS_MAP_EMPTY!=id)
+      if(s<0) return(ZEROFS_ERR_NOSPACE);
+      if(sm[s]!=ZEROFS_MAP_ERASED) zerofs_erase_empty(zfs, s);
+      src=(sec==nm.first_sector?nm.first_offset:0);
+      for(n=0;src+n<end;n+=l)
       {
-        // find a new name slot
-        ni=zerofs_namemap_find_slot(zfs);
-        if(ni>=0)
-        {
-          sm=(uint8_t *)ZEROFS_SECTOR_MAP(fp->zfs);
-          // copy existing namemap entry
-          nm.first_sector=zfs->superblock->namemap[id].first_sector;
-          nm.first_offset=zfs->superblock->namemap[id].first_offset;
-          nm.type_len=zfs->superblock->namemap[id].type_len;
-          // set size
-          fp->size=ZEROFS_NM_GET_SIZE(&zfs->superblock->namemap[id]);
-          // set pos
-          fp->pos=(fp->size+nm.first_offset) % ZEROFS_FLASH_SECTOR_SIZE;
-          // search the last sector
-          pos=fp->size;
-          dec=nm.first_offset;
-          sec=nm.first_sector;
-          do
-          {
-            for(i=0; id!=sm[(i+sec)%ZEROFS_FLASH_SECTOR_SIZE] && i<ZEROFS_NUMBER_OF_SECTORS; i++);
-            if(i>=ZEROFS_NUMBER_OF_SECTORS) { ret=ZEROFS_ERR_OVERFLOW; break; }
-            sec=(i+sec)%ZEROFS_FLASH_SECTOR_SIZE;
-            pos-=dec;
-            dec=ZEROFS_FLASH_SECTOR_SIZE;
-          } while(pos>0);
-          // allocate new sector if needed
-          fp->sector=sec;
-          if(0==fp->pos)
-          {
-            int s=zerofs_find_free_block(zfs); //HURKA
-            if(s>=0)
-            {
-              fp->sector=(uint16_t)s;
-              sm[s]=ni;
-            }
-            else ret=ZEROFS_ERR_NOSPACE;
-          }
-          if(0==ret)
-          {
-            // rename id in map
-            for(i=0;i<ZEROFS_NUMBER_OF_SECTORS;i++) if(sm[i]==id) sm[i]=ni;
-            // flash new namemap entry
-            nm.type_len=~0;
-            zfs->fls->fls_write(zfs->fls->super_ud, (zfs->bank*ZEROFS_SUPER_SECTOR_SIZE) + ((ni)*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap), (uint8_t *)&nm, sizeof(struct zerofs_namemap) );
-            // delete old namemap entry
-            uint32_t addr = (id*(sizeof(struct zerofs_namemap))) + offsetof(struct zerofs_superblock, namemap);
-            zfs->fls->fls_write(zfs->fls->super_ud, addr+(zfs->bank*ZEROFS_SUPER_SECTOR_SIZE), buf, sizeof(buf));
-            // set new id in opened fp
-            fp->id=ni;
-            fp->mode=ZEROFS_MODE_WRITE_ONLY;
-          }
-        }
-        else ret=ZEROFS_ERR_MAXFILES;
+        l=MIN(sizeof(buf), end-src-n);
+        zerofs_fls_read(zfs, zfs->fls->data_ud, sec*ZEROFS_FLASH_SECTOR_SIZE+src+n, buf, l);
+        zerofs_fls_program(zfs, zfs->fls->data_ud, s*ZEROFS_FLASH_SECTOR_SIZE+n, buf, l, 1);
+        ZEROFS_COUNT(zfs, copied, l);
+      }
+      sm[s]=id;
+      if(sm[sec]==id)
+      {
+        sm[sec]=ZEROFS_MAP_EMPTY;
+        zerofs_sector_adopt(zfs, id);
+      }
+      if(sec==nm.first_sector)
+      {
+        fp->first_sector=s;
+        fp->first_offset=0;
       }
-      else ret=ZEROFS_ERR_NOTFOUND;
     }
+    sec=s;
+    end=n;
+    zfs->meta.last_written=sec;
+    zfs->meta.last_written_len=end;
   }
-  else ret=ZEROFS_ERR_READMODE;
+  // continue at the end of the file, write() allocates the next sector for a full one
+  fp->sector=sec;
+  fp->pos=end;
+  zfs->applog-=sizeof(struct zerofs_applog);
+  fp->applog=zfs->applog;
+  fp->repacks=zfs->repacks;
+  fp->id=id;
+  fp->mode=ZEROFS_MODE_WRITE_ONLY;
+  fp->flags|=ZEROFS_FILE_APPEND;
 
   return(ret);
 }
@@ -1052,6 +2329,49 @@ static uint8_t zerofs_crc8(uint8_t *msg, int len, uint8_t init)
 };
 #endif
 
+// step 2. of zerofs_write(), continue the file in a new sector
+// the erase of the new sector is left in flight
+// without prepare an EMPTY next sector is left to the caller, returns 1 then
+static int zerofs_write_next_sector(struct zerofs_file *fp, int prepare)
+{
+  struct zerofs *zfs=fp->zfs;
+  uint8_t *sm=zfs->sector_map;
+
+  // 2. remove nomore flag to let new files to start here
+  fp->flags&=~ZEROFS_FILE_NOMORE;
+  // 2.a.
+  int s=zerofs_find_free_block(zfs, fp->sector, fp->first_sector);
+  if(s>=0)
+  {
+    // 2.d.
+    fp->sector=s;
+    fp->pos=0;
+    // 2.c.
+    if(sm[fp->sector]!=ZEROFS_MAP_ERASED)
+    {
+      if(!prepare) return(1);
+      zerofs_erase_empty(zfs, fp->sector);
+    }
+    // 2.e.
+    sm[fp->sector]=fp->id;
+    return(0);
+  }
+  // 2.b.
+  if((fp->flags&ZEROFS_FILE_APPEND)!=0)
+  {
+    // keep the appended file with the data written so far
+    zerofs_close(fp);
+  }
+  else
+  {
+    for(int i=0;i<ZEROFS_SECTORS(zfs);i++) if(sm[i]==fp->id) sm[i]=ZEROFS_MAP_EMPTY;
+    ZEROFS_COUNT(zfs, map_probes, ZEROFS_SECTORS(zfs));
+    fp->mode=ZEROFS_MODE_CLOSED;
+  }
+
+  return(ZEROFS_ERR_NOSPACE);
+}
+
 /*
 int32_t zerofs_fs_write(struct zerofs_fp *fp, const uint8_t *buf, uint32_t len);        - write buffer to WO opened file pointer
   1. write bytes to flash with flash_write() to fp->sector, fp->pos until it is full
@@ -1063,37 +2383,39 @@ int32_t zerofs_fs_write(struct zerofs_fp *fp, const uint8_t *buf, uint32_t len);
      e) update MAP with fp->id -- zerofs_super_set_map(fp->sector, fp->id)
   RETURN: written bytes
 */
-int zerofs_write(struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+// the programs are left in flight, buf should be valid until they are done
+// the blank check of the erase ahead reads max chunks
+static int zerofs_write_submit(struct zerofs_file *fp, uint8_t *buf, uint32_t len, uint32_t chunks)
 {
   int ret=0;
   int l;
-  uint8_t *sm;
-  struct zerofs *zfs;
+  struct zerofs *zfs=fp->zfs;
 
-  if(NULL==fp||NULL==buf) return(ZEROFS_ERR_ARG);
-  
-  zfs=fp->zfs;
   if(!zerofs_is_readonly_mode(zfs))
   {
+    // the new sectors are mapped to the current id of an appended file
+    zerofs_append_sync(fp);
     // cast away the const, safe because we are in RW mode
     // 1.
-    sm=(uint8_t *)ZEROFS_SECTOR_MAP(zfs);
     while(len>0)
     {
       l=MIN(len, (ZEROFS_FLASH_SECTOR_SIZE-fp->pos));
       if(l>0)
       {
-        zfs->fls->fls_write(zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l);
+        zerofs_data_access(zfs);
+        zerofs_fls_program(zfs, zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l, 0);
+        // after the first program of the sector, the other device can wait for the blank check
+        if(fp->pos==0||fp->size==0) zerofs_erase_ahead(zfs, fp->sector, fp->first_sector, chunks);
 #if (ZEROFS_VERIFY!=0)
         if(zfs->verify>0&&--zfs->verify_cnt==0)
         {
           // verify required
           zfs->verify_cnt=zfs->verify;
           uint8_t crc=zerofs_crc8(buf,l,0);
-          zfs->fls->fls_read(zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l);
+          zerofs_fls_read(zfs, zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE+fp->pos, buf, l);
           if(crc!=zerofs_crc8(buf,l,0))
           {
-            sm[fp->sector]=ZEROFS_MAP_BAD;
+            zfs->sector_map[fp->sector]=ZEROFS_MAP_BAD;
             return(ZEROFS_ERR_BADSECTOR);
           }
         }
@@ -1102,67 +2424,464 @@ int zerofs_write(struct zerofs_file *fp, uint8_t *buf, uint32_t len)
         buf+=l;
         fp->pos+=l;
         fp->size+=l;
+        fp->bytepos+=l;
         zfs->meta.last_written=fp->sector;
         zfs->meta.last_written_len=fp->pos;
       }
       // 2.
       if(l==0)
       {
-        // 2. remove nomore flag to let new files to start here
-        fp->flags&=~ZEROFS_FILE_NOMORE;
-        // 2.a.
-        int s=zerofs_find_free_block(zfs);
-        if(s>=0)
-        {
-          // 2.d.
-          fp->sector=s;
-          fp->pos=0;
-          // 2.c.
-          if(sm[fp->sector]!=ZEROFS_MAP_ERASED) zfs->fls->fls_erase(zfs->fls->data_ud, fp->sector*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE, 0);
-          // 2.e.
-          sm[fp->sector]=fp->id;
-        }
-        // 2.b.
-        else
-        {
-          for(int i=0;i<ZEROFS_NUMBER_OF_SECTORS;i++) if(sm[i]==fp->id) sm[i]=ZEROFS_MAP_EMPTY;
-          fp->mode=ZEROFS_MODE_CLOSED;
-          ret=ZEROFS_ERR_NOSPACE;
-          break;
-        }
+        ret=zerofs_write_next_sector(fp, 1);
+        if(ret<0) break;
       }
     }
   }
   else ret=ZEROFS_ERR_READMODE;
 
-  if(ret>0) fp->bytepos+=ret;
+  return(ret);
+}
+
+int zerofs_write(struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+{
+  int ret;
+
+  if(NULL==fp||NULL==buf) return(ZEROFS_ERR_ARG);
+
+  // the caller's buffer is valid until return, the programs are drained here
+  ret=zerofs_write_submit(fp, buf, len, ~(uint32_t)0);
+  zerofs_fop_drain(fp->zfs);
 
   return(ret);
 }
 
-int zerofs_background_erase(struct zerofs *zfs)
+// the data devices finished the erases submitted so far, a powered down flash is idle
+// without fls_busy() the erases of the previous zerofs_background_erase_budget() call are taken as finished
+static int zerofs_data_busy(struct zerofs *zfs)
+{
+  const struct zerofs_flash_access *f=zfs->fls;
+
+  if(NULL==f->fls_busy||(zfs->flags&ZEROFS_FLAGS_ASLEEP)!=0) return(0);
+#if (ZEROFS_DATA_DEVICES>1)
+  for(int d=0;d<ZEROFS_DATA_DEVICES;d++) if(f->fls_busy(f->data_devs[d])) return(1);
+  return(0);
+#else
+  return(f->fls_busy(f->data_ud)!=0);
+#endif
+}
+
+// persist the background erase progress once its erases are finished, a reset during an erase must not
+// leave a half erased sector marked erased. One record per ZEROFS_ERASE_LOG_STEP sectors and one at the end,
+// the room of the void record of the next WRITE session is kept
+static void zerofs_erase_log(struct zerofs *zfs)
+{
+  if((zfs->flags&ZEROFS_FLAGS_EMPTY)!=0||zfs->erased_max==zfs->erased_logged) return;
+  if(zfs->erased_max-zfs->erased_logged<ZEROFS_ERASE_LOG_STEP&&zfs->erased_max<ZEROFS_SECTORS(zfs)) return;
+  if((int)((zfs->applog-2*sizeof(struct zerofs_applog))/sizeof(struct zerofs_namemap))-1<zfs->last_namemap_id) return;
+  if(zerofs_data_busy(zfs)) return;
+  zerofs_erase_log_put(zfs, zfs->erased_max);
+}
+
+// count the erased and the still EMPTY data sectors
+static void zerofs_erase_count(struct zerofs *zfs, struct zerofs_erase_report *r)
 {
   int i;
-  const uint8_t *sm;
+  uint8_t v;
+
+  for(i=0;i<ZEROFS_SECTORS(zfs);i++)
+  {
+    v=zerofs_map_get(zfs, ZEROFS_BLOCK(zfs, i));
+    if(v==ZEROFS_MAP_ERASED||(v==ZEROFS_MAP_EMPTY&&i<zfs->erased_max&&zerofs_block_empty(zfs, ZEROFS_BLOCK(zfs, i))>0)) r->ready++;
+    else if(v==ZEROFS_MAP_EMPTY) r->remaining++;
+  }
+}
+
+// erase stale superblock banks and EMPTY data sectors in the background until the budget is used up
+// or the erase reserve is reached. max_sectors==0 only fills the report, max_us==0 means no time limit
+// (estimated with ZEROFS_*_ERASE_US)
+int zerofs_background_erase_budget(struct zerofs *zfs, int max_sectors, uint32_t max_us, struct zerofs_erase_report *report)
+{
+  int i,k,n,e,bank,target;
   sector_t sc;
+  struct zerofs_erase_report r={0};
 
-  if(NULL==zfs) return(ZEROFS_ERR_ARG);
-  if(zfs->erased_max<ZEROFS_NUMBER_OF_SECTORS)
+  if(NULL==zfs||max_sectors<0) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) zerofs_erase_log(zfs);
+  target=MAX(zfs->erase_reserve, zfs->erase_hint);
+  if(NULL!=report||target>0) zerofs_erase_count(zfs, &r);
+  if(zerofs_is_readonly_mode(zfs))
   {
-    if(zerofs_is_readonly_mode(zfs))
+    // stale superblock banks go first in ring order, the next commit should not wait for them
+    for(i=1;i<ZEROFS_SUPER_BANKS&&r.erased<max_sectors;i++)
     {
-      sm=ZEROFS_SECTOR_MAP(zfs);
-      for(i=zfs->erased_max;i<ZEROFS_NUMBER_OF_SECTORS;i++) if(sm[ZEROFS_BLOCK(zfs, i)]==ZEROFS_MAP_EMPTY) break;
-      sc=ZEROFS_BLOCK(zfs, i);
-      if(i<ZEROFS_NUMBER_OF_SECTORS && sm[sc]==ZEROFS_MAP_EMPTY)
+      bank=(zfs->bank+i)%ZEROFS_SUPER_BANKS;
+      if((zfs->super_erased&(1u<<bank))!=0) continue;
+      if(max_us>0&&r.elapsed_us+ZEROFS_SUPER_ERASE_US>max_us) break;
+      zerofs_super_erase_bank(zfs, bank, 1);
+      r.erased++;
+      r.elapsed_us+=ZEROFS_SUPER_ERASE_US;
+    }
+    // data sectors in allocation order, whole erase blocks without data
+    while(zfs->erased_max<ZEROFS_SECTORS(zfs)&&r.erased<max_sectors&&(0==target||r.ready<target))
+    {
+      for(i=zfs->erased_max;i<ZEROFS_SECTORS(zfs);i++)
+      {
+        sc=ZEROFS_BLOCK(zfs, i);
+        if(zerofs_map_get(zfs, sc)==ZEROFS_MAP_EMPTY&&zerofs_block_empty(zfs, sc)>0) break;
+      }
+      if(i>=ZEROFS_SECTORS(zfs))
+      {
+        // nothing left to erase
+        zfs->erased_max=ZEROFS_SECTORS(zfs);
+        break;
+      }
+      // ring position of the block start, negative if the ring starts inside the block
+      i-=sc%ZEROFS_SECTORS_PER_BLOCK;
+      sc-=sc%ZEROFS_SECTORS_PER_BLOCK;
+      // coalesce the following erasable blocks, they are adjacent in flash too until the ring wraps
+      n=zerofs_block_empty(zfs, sc);
+      for(k=1;k<ZEROFS_ERASE_COALESCE_MAX&&r.erased+k<max_sectors&&i+(k+1)*ZEROFS_SECTORS_PER_BLOCK<=ZEROFS_SECTORS(zfs)&&sc+k*ZEROFS_SECTORS_PER_BLOCK<ZEROFS_SECTORS(zfs);k++)
+      {
+        if(target>0&&r.ready+n>=target) break;
+        e=zerofs_block_empty(zfs, sc+k*ZEROFS_SECTORS_PER_BLOCK);
+        if(e<=0) break;
+        n+=e;
+      }
+      if(max_us>0)
       {
-        zfs->fls->fls_erase(zfs->fls->data_ud, sc*ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_FLASH_SECTOR_SIZE, 1);
-        zfs->erased_max=i+1;
+        if(r.elapsed_us+ZEROFS_ERASE_US(zfs)>max_us) break;
+        if(k>(int)((max_us-r.elapsed_us)/ZEROFS_ERASE_US(zfs))*ZEROFS_DATA_DEVICES)
+        {
+          k=(int)((max_us-r.elapsed_us)/ZEROFS_ERASE_US(zfs))*ZEROFS_DATA_DEVICES;
+          for(n=e=0;e<k;e++) n+=zerofs_block_empty(zfs, sc+e*ZEROFS_SECTORS_PER_BLOCK);
+        }
       }
+      zerofs_data_access(zfs);
+      zerofs_fls_erase(zfs, zfs->fls->data_ud, sc*ZEROFS_FLASH_SECTOR_SIZE, k*ZEROFS_ERASE_BLOCK_SIZE, 1);
+      zfs->erased_max=MIN(i+k*ZEROFS_SECTORS_PER_BLOCK, ZEROFS_SECTORS(zfs));
+      r.erased+=k;
+      r.ready+=n;
+      r.remaining-=MIN(r.remaining, n);
+      r.elapsed_us+=((k+ZEROFS_DATA_DEVICES-1)/ZEROFS_DATA_DEVICES)*ZEROFS_ERASE_US(zfs);
     }
   }
-  
+  if(r.ready<target) r.shortfall=target-r.ready;
+  zerofs_fop_drain(zfs);
+  if(NULL!=report) *report=r;
+
+  return(0);
+}
+
+// keep at least 'sectors' erased sectors ready for the next WRITE session, 0 erases all EMPTY sectors
+int zerofs_set_erase_reserve(struct zerofs *zfs, uint32_t sectors)
+{
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  zfs->erase_reserve=MIN(sectors, ZEROFS_SECTORS(zfs));
+  return(0);
+}
+
+// expected write volume of the next WRITE session, raises the erase reserve for that session
+int zerofs_hint_write(struct zerofs *zfs, uint32_t bytes)
+{
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  zfs->erase_hint=MIN((bytes+ZEROFS_FLASH_SECTOR_SIZE-1)/ZEROFS_FLASH_SECTOR_SIZE, ZEROFS_SECTORS(zfs));
+  return(0);
+}
+
+int zerofs_background_erase(struct zerofs *zfs)
+{
+  return(zerofs_background_erase_budget(zfs, 1, 0, NULL));
+}
+
+// power down the data flash after idle_us without data flash access, 0 never powers down
+// with erase_first the background erase is finished before powering down
+int zerofs_set_sleep_policy(struct zerofs *zfs, uint32_t idle_us, int erase_first)
+{
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  zfs->sleep_idle_us=idle_us;
+  if(erase_first) zfs->flags|=ZEROFS_FLAGS_SLEEP_ERASE;
+  else zfs->flags&=~ZEROFS_FLAGS_SLEEP_ERASE;
+  return(0);
+}
+
+// call from the idle loop with a free running microsecond clock, returns 1 if the data flash is powered down
+// the next data flash access wakes it up
+int zerofs_idle(struct zerofs *zfs, uint32_t now_us)
+{
+  struct zerofs_erase_report r;
+
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  if((zfs->flags&ZEROFS_FLAGS_ACTIVE)!=0)
+  {
+    zfs->flags&=~ZEROFS_FLAGS_ACTIVE;
+    zfs->idle_since=now_us;
+  }
+  else if((zfs->flags&ZEROFS_FLAGS_ASLEEP)==0&&zfs->sleep_idle_us>0&&now_us-zfs->idle_since>=zfs->sleep_idle_us)
+  {
+    // one erase batch per call, the flash is powered down when nothing is left
+    if((zfs->flags&ZEROFS_FLAGS_SLEEP_ERASE)!=0&&zerofs_is_readonly_mode(zfs))
+    {
+      zerofs_background_erase_budget(zfs, ZEROFS_ERASE_COALESCE_MAX, 0, &r);
+      zfs->flags&=~ZEROFS_FLAGS_ACTIVE;
+      if(r.erased>0) return(0);
+    }
+    zerofs_fop_drain(zfs);
+    zerofs_data_power(zfs, zfs->fls->fls_sleep);
+    zfs->flags|=ZEROFS_FLAGS_ASLEEP;
+    // the erases are over when the flash powers down
+    if(zerofs_is_readonly_mode(zfs)) zerofs_erase_log(zfs);
+  }
+
+  return((zfs->flags&ZEROFS_FLAGS_ASLEEP)!=0);
+}
+
+// non-blocking API
+// the *_start() functions only register the operation, zerofs_poll() advances it one step per call,
+// a step is bounded by the estimated flash time of budget_us and it does not wait for the programs and
+// erases of the data flash with the queue-based interface, see zerofs_poll() for what it cannot split
+
+#define ZEROFS_OP_STATE_RELEASE (1)     // the namemap entry of the deleted file is zeroed
+#define ZEROFS_OP_STATE_REPACK  (2)     // the superblock repack for a free namemap entry
+#define ZEROFS_OP_STATE_SECTOR  (3)
+#define ZEROFS_OP_STATE_PREPARE (4)     // blank check or erase of the first or the next sector
+#define ZEROFS_OP_STATE_ENTRY   (5)
+#define ZEROFS_OP_STATE_FINISH (0xff)
+
+static int zerofs_op_begin(struct zerofs *zfs, struct zerofs_op *op, uint8_t type)
+{
+  uint32_t budget;
+
+  if(NULL==zfs||NULL==op) return(ZEROFS_ERR_ARG);
+  if(NULL!=zfs->op) return(ZEROFS_ERR_BUSY);
+  budget=op->budget_us;
+  memset(op, 0, sizeof(struct zerofs_op));
+  op->budget_us=(budget>0?budget:ZEROFS_POLL_BUDGET_US);
+  op->type=type;
+  zfs->op=op;
+
+  return(ZEROFS_IN_PROGRESS);
+}
+
+// the result is returned when the flash operations of the last step are done
+static int zerofs_op_finish(struct zerofs *zfs, struct zerofs_op *op, int ret)
+{
+  zerofs_fop_retire(zfs);
+  if(zfs->fq_count>0)
+  {
+    op->ret=ret;
+    op->state=ZEROFS_OP_STATE_FINISH;
+    return(ZEROFS_IN_PROGRESS);
+  }
+  zfs->op=NULL;
+
+  return(ret);
+}
+
+int zerofs_write_start(struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+{
+  int ret;
+
+  if(NULL==zfs||NULL==fp||NULL==buf) return(ZEROFS_ERR_ARG);
+  if(zerofs_is_readonly_mode(zfs)) return(ZEROFS_ERR_READMODE);
+  ret=zerofs_op_begin(zfs, op, ZEROFS_OP_WRITE);
+  if(ret==ZEROFS_IN_PROGRESS)
+  {
+    op->fp=fp;
+    op->buf=buf;
+    op->len=len;
+  }
+
+  return(ret);
+}
+
+int zerofs_create_start(struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, const char *name)
+{
+  int ret;
+
+  if(NULL==fp||NULL==name) return(ZEROFS_ERR_ARG);
+  ret=zerofs_op_begin(zfs, op, ZEROFS_OP_CREATE);
+  if(ret==ZEROFS_IN_PROGRESS)
+  {
+    op->fp=fp;
+    op->name=name;
+  }
+
+  return(ret);
+}
+
+int zerofs_delete_start(struct zerofs *zfs, struct zerofs_op *op, const char *name)
+{
+  int ret;
+
+  if(NULL==name) return(ZEROFS_ERR_ARG);
+  ret=zerofs_op_begin(zfs, op, ZEROFS_OP_DELETE);
+  if(ret==ZEROFS_IN_PROGRESS) op->name=name;
+
+  return(ret);
+}
+
+int zerofs_readonly_mode_start(struct zerofs *zfs, struct zerofs_op *op, uint8_t *sector_map)
+{
+  int ret=zerofs_op_begin(zfs, op, ZEROFS_OP_READONLY_MODE);
+
+  if(ret==ZEROFS_IN_PROGRESS) op->buf=sector_map;
+
+  return(ret);
+}
+
+// blank check reads of one step
+static inline uint32_t zerofs_op_chunks(const struct zerofs_op *op)
+{
+  return(MAX(op->budget_us/ZEROFS_BLANK_CHECK_CHUNK_US, 1));
+}
+
+// one sector change (the blank check or the erase of the new sector) or a program of max budget_us within the sector
+static int zerofs_step_write(struct zerofs *zfs, struct zerofs_op *op)
+{
+  struct zerofs_file *fp=op->fp;
+  uint32_t l;
+  int ret;
+
+  if(op->state==0)
+  {
+    if(op->done>=op->len) return(0);
+    // the new sectors are mapped to the current id of an appended file
+    zerofs_append_sync(fp);
+    if(fp->pos>=ZEROFS_FLASH_SECTOR_SIZE)
+    {
+      ret=zerofs_write_next_sector(fp, 0);
+      if(ret<=0) return(ret<0?ret:ZEROFS_IN_PROGRESS);
+      op->state=ZEROFS_OP_STATE_PREPARE;
+      op->pos=0;
+    }
+  }
+  if(op->state==ZEROFS_OP_STATE_PREPARE)
+  {
+    if(zerofs_erase_empty_step(zfs, fp->sector, &op->pos, zerofs_op_chunks(op))==ZEROFS_IN_PROGRESS) return(ZEROFS_IN_PROGRESS);
+    zfs->sector_map[fp->sector]=fp->id;
+    op->state=0;
+    return(ZEROFS_IN_PROGRESS);
+  }
+  l=MIN(op->len-op->done, (uint32_t)(ZEROFS_FLASH_SECTOR_SIZE-fp->pos));
+  l=MIN(l, MAX((uint64_t)op->budget_us*1000/ZEROFS_BYTE_NS(zfs), 1));
+  ret=zerofs_write_submit(fp, op->buf+op->done, l, zerofs_op_chunks(op));
+  if(ret<0) return(ret);
+  op->done+=l;
+
+  return(op->done>=op->len?0:ZEROFS_IN_PROGRESS);
+}
+
+// the namemap entry is zeroed in one step, the sectors of the file are freed in the next
+static int zerofs_step_delete(struct zerofs *zfs, struct zerofs_op *op)
+{
+  uint8_t ids[ZEROFS_IDSET_SIZE]={0};
+  int ret;
+
+  if(op->state==0)
+  {
+    ret=zerofs_name_id(zfs, op->name, &op->id);
+    if(ret!=0) return(ret);
+    if(op->id==ZEROFS_MAP_EMPTY) return(ZEROFS_ERR_NOTFOUND);
+    ZEROFS_IDSET_ADD(ids, op->id);
+    zerofs_zero_ids(zfs, ids);
+    op->state=ZEROFS_OP_STATE_RELEASE;
+    return(ZEROFS_IN_PROGRESS);
+  }
+  ZEROFS_IDSET_ADD(ids, op->id);
+  zerofs_release_ids(zfs, ids);
+
+  return(0);
+}
+
+// zerofs_create_submit() split at the flash operations: the delete of the old file, the superblock
+// repack, the preparation of the first sector and the namemap entry
+static int zerofs_step_create(struct zerofs *zfs, struct zerofs_op *op)
+{
+  struct zerofs_file *fp=op->fp;
+  int ret;
+
+  switch(op->state)
+  {
+    case 0:
+    case ZEROFS_OP_STATE_RELEASE:
+      // 0 delete old file here
+      if(zerofs_step_delete(zfs, op)==ZEROFS_IN_PROGRESS) return(ZEROFS_IN_PROGRESS);
+      memset(fp, 0, sizeof(struct zerofs_file));
+      fp->zfs=zfs;
+      op->state=ZEROFS_OP_STATE_REPACK;
+      // fall through
+    case ZEROFS_OP_STATE_REPACK:
+      // 1 the repack for a free slot
+      if(op->repack.phase!=0||zfs->last_namemap_id>=zerofs_namemap_limit(zfs))
+      {
+        if(zerofs_repack_step(zfs, &op->repack, op->budget_us)==ZEROFS_IN_PROGRESS) return(ZEROFS_IN_PROGRESS);
+        op->state=ZEROFS_OP_STATE_SECTOR;
+        return(ZEROFS_IN_PROGRESS);
+      }
+      // fall through
+    case ZEROFS_OP_STATE_SECTOR:
+      // 2
+      if(zfs->last_namemap_id>=zerofs_namemap_limit(zfs)) return(ZEROFS_ERR_MAXFILES);
+      op->id=zfs->last_namemap_id++;
+      ret=zerofs_create_sector(zfs, fp, op->name);
+      if(ret!=0) return(ret);
+      op->state=ZEROFS_OP_STATE_PREPARE;
+      op->pos=0;
+      // fall through
+    case ZEROFS_OP_STATE_PREPARE:
+      // 5. the entry is programmed in the step of the erase, after the blank check reads in a step of its own
+      if(ZEROFS_MAP_EMPTY==zfs->sector_map[fp->sector])
+      {
+        if(zerofs_erase_empty_step(zfs, fp->sector, &op->pos, zerofs_op_chunks(op))==ZEROFS_IN_PROGRESS) return(ZEROFS_IN_PROGRESS);
+        zfs->sector_map[fp->sector]=ZEROFS_MAP_ERASED;
+        if(op->pos>0)
+        {
+          op->state=ZEROFS_OP_STATE_ENTRY;
+          return(ZEROFS_IN_PROGRESS);
+        }
+      }
+      // fall through
+    case ZEROFS_OP_STATE_ENTRY:
+      zerofs_create_entry(zfs, fp, op->name, op->id);
+  }
+
   return(0);
 }
 
+// advance the running non-blocking operation, returns ZEROFS_IN_PROGRESS or its result
+// a step cannot split one superblock bank erase, the fls_blank_check() of an erase block and,
+// with the synchronous callbacks, the data erase it starts
+int zerofs_poll(struct zerofs *zfs)
+{
+  struct zerofs_op *op;
+  int ret=ZEROFS_ERR_ARG;
+
+  if(NULL==zfs) return(ZEROFS_ERR_ARG);
+  op=zfs->op;
+  if(NULL==op) return(0);
+  // the flash operations of the previous step are still running
+  zerofs_fop_retire(zfs);
+  if(zfs->fq_count>0) return(ZEROFS_IN_PROGRESS);
+  if(op->state==ZEROFS_OP_STATE_FINISH) return(zerofs_op_finish(zfs, op, op->ret));
+  switch(op->type)
+  {
+    case ZEROFS_OP_WRITE:
+      ret=zerofs_step_write(zfs, op);
+      break;
+    case ZEROFS_OP_CREATE:
+      ret=(zerofs_is_readonly_mode(zfs)?ZEROFS_ERR_READMODE:zerofs_step_create(zfs, op));
+      break;
+    case ZEROFS_OP_DELETE:
+      ret=(zerofs_is_readonly_mode(zfs)?ZEROFS_ERR_READMODE:zerofs_step_delete(zfs, op));
+      break;
+    case ZEROFS_OP_READONLY_MODE:
+      // the commit repacks the superblock in steps of its own
+      if(NULL==op->buf&&!zerofs_is_readonly_mode(zfs)&&zerofs_repack_step(zfs, &op->repack, op->budget_us)==ZEROFS_IN_PROGRESS) return(ZEROFS_IN_PROGRESS);
+      ret=zerofs_mode_set(zfs, op->buf);
+      break;
+  }
+  if(ret==ZEROFS_IN_PROGRESS) return(ret);
+
+  return(zerofs_op_finish(zfs, op, ret));
+}
+
 #endif
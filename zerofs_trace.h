@@ -0,0 +1,452 @@
+/*
+    BSD 2-Clause License
+
+    Copyright (c) 2025, Gergely Gati
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+    OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// workload traces of the zerofs API calls
+// the recorder wraps the public API (include zerofs.h first), the decoder needs nothing from zerofs
+
+#ifndef ZEROFS_TRACE_H
+#define ZEROFS_TRACE_H
+
+// CONFIG AREA -----------------
+
+// files open at the same time, at most ZEROFS_TRACE_SLOTS
+#ifndef ZEROFS_TRACE_FILES
+#define ZEROFS_TRACE_FILES (4)
+#endif
+
+// recorded part of the file names, zerofs names are 8+3
+#ifndef ZEROFS_TRACE_NAME_MAX
+#define ZEROFS_TRACE_NAME_MAX (12)
+#endif
+
+// records are collected here before emit() is called
+#ifndef ZEROFS_TRACE_BUF_SIZE
+#define ZEROFS_TRACE_BUF_SIZE (64)
+#endif
+
+// shorter gaps between two calls are not recorded as idle time
+#ifndef ZEROFS_TRACE_IDLE_MIN_US
+#define ZEROFS_TRACE_IDLE_MIN_US (1000)
+#endif
+
+// END OF CONFIG AREA ----------
+
+#include <stdint.h>
+#include <string.h>
+
+// the trace starts with the magic, the version and the flags byte
+#define ZEROFS_TRACE_MAGIC   "ZFTR"
+#define ZEROFS_TRACE_VERSION (1)
+#define ZEROFS_TRACE_HEADER  (6)
+#define ZEROFS_TRACE_F_READ  (1<<0)   // the file system was in READ mode when the recording started
+#define ZEROFS_TRACE_SLOTS   (16)     // file slots of the format
+
+// record types, the low nibble of the first byte, the high nibble is the file slot
+// the arguments follow as LEB128 varints, the names with their length first
+#define ZEROFS_TRACE_CREATE      (1)  // slot, name
+#define ZEROFS_TRACE_APPEND      (2)  // slot, name
+#define ZEROFS_TRACE_OPEN        (3)  // slot, name
+#define ZEROFS_TRACE_CLOSE       (4)  // slot
+#define ZEROFS_TRACE_WRITE       (5)  // slot, length
+#define ZEROFS_TRACE_READ        (6)  // slot, length
+#define ZEROFS_TRACE_SEEK        (7)  // slot, position (zigzag encoded, negative is from the end)
+#define ZEROFS_TRACE_DELETE      (8)  // name
+#define ZEROFS_TRACE_DELETE_MANY (9)  // number of the DELETE records of the batch following it
+#define ZEROFS_TRACE_MODE        (10) // 1 READ mode, 0 WRITE mode
+#define ZEROFS_TRACE_ERASE       (11) // max sectors, max us of the background erase
+#define ZEROFS_TRACE_IDLE        (12) // us without file system calls
+#define ZEROFS_TRACE_OPS         (13)
+
+// longest record: type, two 32 bit varints, the name with its length
+#define ZEROFS_TRACE_REC_MAX     (1+5+5+1+ZEROFS_TRACE_NAME_MAX)
+
+struct zerofs_trace_rec
+{
+  uint8_t op;                   // ZEROFS_TRACE_*
+  uint8_t fd;                   // file slot
+  uint32_t arg;                 // length, position, mode, max sectors or idle time
+  uint32_t arg2;                // max us of the erase
+  char name[ZEROFS_TRACE_NAME_MAX+1];
+};
+
+int zerofs_trace_header(const uint8_t *buf, uint32_t len, uint32_t *pos);
+int zerofs_trace_next(const uint8_t *buf, uint32_t len, uint32_t *pos, struct zerofs_trace_rec *rec);
+
+#ifdef ZEROFS_H
+
+struct zerofs_trace
+{
+  int (*emit)(void *ud, const uint8_t *data, uint32_t len);   // stores the next part of the trace, <0 on error
+  uint32_t (*now_us)(void *ud);                               // free running clock of the idle gaps, may be NULL
+  void *ud;
+  uint32_t idle_min_us;         // ZEROFS_TRACE_IDLE_MIN_US
+  uint32_t last_us;             // end of the last call
+  uint32_t dropped;             // records lost: no free file slot or emit() failed
+  const struct zerofs_file *fp[ZEROFS_TRACE_FILES];
+  uint16_t n;                   // bytes in buf
+  uint16_t recs;                // records in buf
+  uint8_t buf[ZEROFS_TRACE_BUF_SIZE];
+};
+
+static_assert(ZEROFS_TRACE_FILES>=1&&ZEROFS_TRACE_FILES<=ZEROFS_TRACE_SLOTS, "ZEROFS_TRACE_FILES should be between 1 and 16");
+static_assert(ZEROFS_TRACE_BUF_SIZE>=ZEROFS_TRACE_REC_MAX, "ZEROFS_TRACE_BUF_SIZE cannot hold a record");
+
+int zerofs_trace_init(struct zerofs_trace *tr, struct zerofs *zfs, int (*emit)(void *ud, const uint8_t *data, uint32_t len), uint32_t (*now_us)(void *ud), void *ud);
+int zerofs_trace_flush(struct zerofs_trace *tr);
+int zerofs_trace_create(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name);
+int zerofs_trace_append(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name);
+int zerofs_trace_open(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name);
+int zerofs_trace_close(struct zerofs_trace *tr, struct zerofs_file *fp);
+int zerofs_trace_write(struct zerofs_trace *tr, struct zerofs_file *fp, uint8_t *buf, uint32_t len);
+int zerofs_trace_read(struct zerofs_trace *tr, struct zerofs_file *fp, uint8_t *buf, uint32_t len);
+int zerofs_trace_seek(struct zerofs_trace *tr, struct zerofs_file *fp, int32_t pos);
+int zerofs_trace_delete(struct zerofs_trace *tr, struct zerofs *zfs, const char *name);
+int zerofs_trace_delete_many(struct zerofs_trace *tr, struct zerofs *zfs, const char *names[], int n);
+int zerofs_trace_readonly_mode(struct zerofs_trace *tr, struct zerofs *zfs, uint8_t *sector_map);
+int zerofs_trace_background_erase(struct zerofs_trace *tr, struct zerofs *zfs);
+int zerofs_trace_background_erase_budget(struct zerofs_trace *tr, struct zerofs *zfs, int max_sectors, uint32_t max_us, struct zerofs_erase_report *report);
+int zerofs_trace_write_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, uint8_t *buf, uint32_t len);
+int zerofs_trace_create_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, const char *name);
+int zerofs_trace_delete_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, const char *name);
+int zerofs_trace_readonly_mode_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, uint8_t *sector_map);
+int zerofs_trace_poll(struct zerofs_trace *tr, struct zerofs *zfs);
+int zerofs_trace_gap(struct zerofs_trace *tr, uint32_t us);
+
+#endif
+
+#endif
+
+
+#ifdef ZEROFS_TRACE_IMPLEMENTATION
+
+// number of varint arguments and the name flag (4) of the record types
+static const uint8_t zerofs_trace_args[ZEROFS_TRACE_OPS]=
+{
+  0xff, 4, 4, 4, 0, 1, 1, 1, 4, 1, 1, 2, 1
+};
+
+static int zerofs_trace_varint(const uint8_t *buf, uint32_t len, uint32_t *pos, uint32_t *v)
+{
+  int i;
+
+  *v=0;
+  for(i=0; i<5; i++)
+  {
+    if(*pos>=len) return(-1);
+    *v|=(uint32_t)(buf[*pos]&0x7f)<<(7*i);
+    if((buf[(*pos)++]&0x80)==0) return(0);
+  }
+  return(-1);
+}
+
+// returns the flags and the position of the first record, -1 if it is not a trace
+int zerofs_trace_header(const uint8_t *buf, uint32_t len, uint32_t *pos)
+{
+  if(NULL==buf||len<ZEROFS_TRACE_HEADER||memcmp(buf, ZEROFS_TRACE_MAGIC, 4)!=0||buf[4]!=ZEROFS_TRACE_VERSION) return(-1);
+  *pos=ZEROFS_TRACE_HEADER;
+  return(buf[5]);
+}
+
+// returns 1 and the record at pos, 0 at the end of the trace, -1 if the record is broken
+int zerofs_trace_next(const uint8_t *buf, uint32_t len, uint32_t *pos, struct zerofs_trace_rec *rec)
+{
+  uint32_t l;
+  uint8_t a;
+
+  if(*pos>=len) return(0);
+  memset(rec, 0, sizeof(struct zerofs_trace_rec));
+  rec->op=buf[*pos]&0x0f;
+  rec->fd=buf[*pos]>>4;
+  if(rec->op==0||rec->op>=ZEROFS_TRACE_OPS) return(-1);
+  (*pos)++;
+  a=zerofs_trace_args[rec->op];
+  if((a&3)>0&&zerofs_trace_varint(buf, len, pos, &rec->arg)<0) return(-1);
+  if((a&3)>1&&zerofs_trace_varint(buf, len, pos, &rec->arg2)<0) return(-1);
+  if(a&4)
+  {
+    if(zerofs_trace_varint(buf, len, pos, &l)<0||l>ZEROFS_TRACE_NAME_MAX||*pos+l>len) return(-1);
+    memcpy(rec->name, buf+*pos, l);
+    *pos+=l;
+  }
+  if(rec->op==ZEROFS_TRACE_SEEK) rec->arg=(rec->arg>>1)^(0u-(rec->arg&1));
+  return(1);
+}
+
+#ifdef ZEROFS_H
+
+static uint8_t *zerofs_trace_put_varint(uint8_t *p, uint32_t v)
+{
+  while(v>=0x80)
+  {
+    *p++=(uint8_t)(v|0x80);
+    v>>=7;
+  }
+  *p++=(uint8_t)v;
+  return(p);
+}
+
+int zerofs_trace_flush(struct zerofs_trace *tr)
+{
+  int ret=0;
+
+  if(NULL==tr) return(ZEROFS_ERR_ARG);
+  if(tr->n>0&&tr->emit(tr->ud, tr->buf, tr->n)<0)
+  {
+    tr->dropped+=tr->recs;
+    ret=ZEROFS_ERR_ARG;
+  }
+  tr->n=0;
+  tr->recs=0;
+  return(ret);
+}
+
+static void zerofs_trace_put(struct zerofs_trace *tr, uint8_t op, int fd, uint32_t arg, uint32_t arg2, const char *name)
+{
+  uint8_t rec[ZEROFS_TRACE_REC_MAX], *p=rec;
+  uint8_t a=zerofs_trace_args[op];
+  uint32_t l;
+
+  *p++=(uint8_t)(op|(fd<<4));
+  if((a&3)>0) p=zerofs_trace_put_varint(p, arg);
+  if((a&3)>1) p=zerofs_trace_put_varint(p, arg2);
+  if(a&4)
+  {
+    for(l=0; l<ZEROFS_TRACE_NAME_MAX&&name[l]!='\0'; l++);
+    p=zerofs_trace_put_varint(p, l);
+    memcpy(p, name, l);
+    p+=l;
+  }
+  if(tr->n+(uint32_t)(p-rec)>sizeof(tr->buf)) zerofs_trace_flush(tr);
+  memcpy(tr->buf+tr->n, rec, p-rec);
+  tr->n+=p-rec;
+  tr->recs++;
+}
+
+// a record of a call, the time since the end of the last call goes first
+static void zerofs_trace_call(struct zerofs_trace *tr, uint8_t op, int fd, uint32_t arg, uint32_t arg2, const char *name)
+{
+  uint32_t gap;
+
+  if(NULL!=tr->now_us)
+  {
+    gap=tr->now_us(tr->ud)-tr->last_us;
+    if(gap>=tr->idle_min_us) zerofs_trace_put(tr, ZEROFS_TRACE_IDLE, 0, gap, 0, NULL);
+  }
+  if(fd>=0) zerofs_trace_put(tr, op, fd, arg, arg2, name);
+}
+
+static inline int zerofs_trace_done(struct zerofs_trace *tr, int ret)
+{
+  if(NULL!=tr->now_us) tr->last_us=tr->now_us(tr->ud);
+  return(ret);
+}
+
+// the slot of an open file, add takes a free slot for a new one, -1 if the calls of the file are not recorded
+static int zerofs_trace_fd(struct zerofs_trace *tr, const struct zerofs_file *fp, int add)
+{
+  int i;
+
+  for(i=0; i<ZEROFS_TRACE_FILES; i++) if(tr->fp[i]==fp) return(i);
+  if(add) for(i=0; i<ZEROFS_TRACE_FILES; i++) if(NULL==tr->fp[i]) { tr->fp[i]=fp; return(i); }
+  tr->dropped++;
+  return(-1);
+}
+
+int zerofs_trace_init(struct zerofs_trace *tr, struct zerofs *zfs, int (*emit)(void *ud, const uint8_t *data, uint32_t len), uint32_t (*now_us)(void *ud), void *ud)
+{
+  if(NULL==tr||NULL==zfs||NULL==emit) return(ZEROFS_ERR_ARG);
+  memset(tr, 0, sizeof(struct zerofs_trace));
+  tr->emit=emit;
+  tr->now_us=now_us;
+  tr->ud=ud;
+  tr->idle_min_us=ZEROFS_TRACE_IDLE_MIN_US;
+  memcpy(tr->buf, ZEROFS_TRACE_MAGIC, 4);
+  tr->buf[4]=ZEROFS_TRACE_VERSION;
+  tr->buf[5]=(zerofs_is_readonly_mode(zfs)?ZEROFS_TRACE_F_READ:0);
+  tr->n=ZEROFS_TRACE_HEADER;
+  zerofs_trace_done(tr, 0);
+  return(0);
+}
+
+// the file is opened by the caller, the slot is released if it failed
+static int zerofs_trace_opened(struct zerofs_trace *tr, int fd, int ret)
+{
+  if(fd>=0&&ret<0) tr->fp[fd]=NULL;
+  return(zerofs_trace_done(tr, ret));
+}
+
+int zerofs_trace_create(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+{
+  int fd;
+
+  if(NULL==tr||NULL==name) return(zerofs_create(zfs, fp, name));
+  fd=zerofs_trace_fd(tr, fp, 1);
+  zerofs_trace_call(tr, ZEROFS_TRACE_CREATE, fd, 0, 0, name);
+  return(zerofs_trace_opened(tr, fd, zerofs_create(zfs, fp, name)));
+}
+
+int zerofs_trace_append(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+{
+  int fd;
+
+  if(NULL==tr||NULL==name) return(zerofs_append(zfs, fp, name));
+  fd=zerofs_trace_fd(tr, fp, 1);
+  zerofs_trace_call(tr, ZEROFS_TRACE_APPEND, fd, 0, 0, name);
+  return(zerofs_trace_opened(tr, fd, zerofs_append(zfs, fp, name)));
+}
+
+int zerofs_trace_open(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_file *fp, const char *name)
+{
+  int fd;
+
+  if(NULL==tr||NULL==name) return(zerofs_open(zfs, fp, name));
+  fd=zerofs_trace_fd(tr, fp, 1);
+  zerofs_trace_call(tr, ZEROFS_TRACE_OPEN, fd, 0, 0, name);
+  return(zerofs_trace_opened(tr, fd, zerofs_open(zfs, fp, name)));
+}
+
+int zerofs_trace_close(struct zerofs_trace *tr, struct zerofs_file *fp)
+{
+  int fd;
+
+  if(NULL==tr) return(zerofs_close(fp));
+  fd=zerofs_trace_fd(tr, fp, 0);
+  zerofs_trace_call(tr, ZEROFS_TRACE_CLOSE, fd, 0, 0, NULL);
+  if(fd>=0) tr->fp[fd]=NULL;
+  return(zerofs_trace_done(tr, zerofs_close(fp)));
+}
+
+int zerofs_trace_write(struct zerofs_trace *tr, struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+{
+  if(NULL==tr) return(zerofs_write(fp, buf, len));
+  zerofs_trace_call(tr, ZEROFS_TRACE_WRITE, zerofs_trace_fd(tr, fp, 0), len, 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_write(fp, buf, len)));
+}
+
+int zerofs_trace_read(struct zerofs_trace *tr, struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+{
+  if(NULL==tr) return(zerofs_read(fp, buf, len));
+  zerofs_trace_call(tr, ZEROFS_TRACE_READ, zerofs_trace_fd(tr, fp, 0), len, 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_read(fp, buf, len)));
+}
+
+int zerofs_trace_seek(struct zerofs_trace *tr, struct zerofs_file *fp, int32_t pos)
+{
+  if(NULL==tr) return(zerofs_seek(fp, pos));
+  zerofs_trace_call(tr, ZEROFS_TRACE_SEEK, zerofs_trace_fd(tr, fp, 0), ((uint32_t)pos<<1)^(uint32_t)(pos>>31), 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_seek(fp, pos)));
+}
+
+int zerofs_trace_delete(struct zerofs_trace *tr, struct zerofs *zfs, const char *name)
+{
+  if(NULL==tr||NULL==name) return(zerofs_delete(zfs, name));
+  zerofs_trace_call(tr, ZEROFS_TRACE_DELETE, 0, 0, 0, name);
+  return(zerofs_trace_done(tr, zerofs_delete(zfs, name)));
+}
+
+int zerofs_trace_delete_many(struct zerofs_trace *tr, struct zerofs *zfs, const char *names[], int n)
+{
+  int i;
+
+  if(NULL==tr||NULL==names||n<=0) return(zerofs_delete_many(zfs, names, n));
+  for(i=0; i<n; i++) if(NULL==names[i]) return(zerofs_delete_many(zfs, names, n));
+  zerofs_trace_call(tr, ZEROFS_TRACE_DELETE_MANY, 0, n, 0, NULL);
+  for(i=0; i<n; i++) zerofs_trace_put(tr, ZEROFS_TRACE_DELETE, 0, 0, 0, names[i]);
+  return(zerofs_trace_done(tr, zerofs_delete_many(zfs, names, n)));
+}
+
+int zerofs_trace_readonly_mode(struct zerofs_trace *tr, struct zerofs *zfs, uint8_t *sector_map)
+{
+  if(NULL==tr) return(zerofs_readonly_mode(zfs, sector_map));
+  zerofs_trace_call(tr, ZEROFS_TRACE_MODE, 0, (NULL==sector_map), 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_readonly_mode(zfs, sector_map)));
+}
+
+int zerofs_trace_background_erase(struct zerofs_trace *tr, struct zerofs *zfs)
+{
+  if(NULL==tr) return(zerofs_background_erase(zfs));
+  zerofs_trace_call(tr, ZEROFS_TRACE_ERASE, 0, 1, 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_background_erase(zfs)));
+}
+
+// report only calls (max_sectors of 0) are not recorded
+int zerofs_trace_background_erase_budget(struct zerofs_trace *tr, struct zerofs *zfs, int max_sectors, uint32_t max_us, struct zerofs_erase_report *report)
+{
+  if(NULL==tr||max_sectors<=0) return(zerofs_background_erase_budget(zfs, max_sectors, max_us, report));
+  zerofs_trace_call(tr, ZEROFS_TRACE_ERASE, 0, max_sectors, max_us, NULL);
+  return(zerofs_trace_done(tr, zerofs_background_erase_budget(zfs, max_sectors, max_us, report)));
+}
+
+// the non-blocking operations are recorded as their blocking calls, the time of the zerofs_poll() steps is not idle time
+int zerofs_trace_write_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, uint8_t *buf, uint32_t len)
+{
+  if(NULL==tr) return(zerofs_write_start(zfs, op, fp, buf, len));
+  zerofs_trace_call(tr, ZEROFS_TRACE_WRITE, zerofs_trace_fd(tr, fp, 0), len, 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_write_start(zfs, op, fp, buf, len)));
+}
+
+int zerofs_trace_create_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, struct zerofs_file *fp, const char *name)
+{
+  int fd;
+
+  if(NULL==tr||NULL==name) return(zerofs_create_start(zfs, op, fp, name));
+  fd=zerofs_trace_fd(tr, fp, 1);
+  zerofs_trace_call(tr, ZEROFS_TRACE_CREATE, fd, 0, 0, name);
+  return(zerofs_trace_opened(tr, fd, zerofs_create_start(zfs, op, fp, name)));
+}
+
+int zerofs_trace_delete_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, const char *name)
+{
+  if(NULL==tr||NULL==name) return(zerofs_delete_start(zfs, op, name));
+  zerofs_trace_call(tr, ZEROFS_TRACE_DELETE, 0, 0, 0, name);
+  return(zerofs_trace_done(tr, zerofs_delete_start(zfs, op, name)));
+}
+
+int zerofs_trace_readonly_mode_start(struct zerofs_trace *tr, struct zerofs *zfs, struct zerofs_op *op, uint8_t *sector_map)
+{
+  if(NULL==tr) return(zerofs_readonly_mode_start(zfs, op, sector_map));
+  zerofs_trace_call(tr, ZEROFS_TRACE_MODE, 0, (NULL==sector_map), 0, NULL);
+  return(zerofs_trace_done(tr, zerofs_readonly_mode_start(zfs, op, sector_map)));
+}
+
+int zerofs_trace_poll(struct zerofs_trace *tr, struct zerofs *zfs)
+{
+  if(NULL==tr) return(zerofs_poll(zfs));
+  return(zerofs_trace_done(tr, zerofs_poll(zfs)));
+}
+
+// idle time of recorders without a clock
+int zerofs_trace_gap(struct zerofs_trace *tr, uint32_t us)
+{
+  if(NULL==tr) return(ZEROFS_ERR_ARG);
+  if(us>0) zerofs_trace_put(tr, ZEROFS_TRACE_IDLE, 0, us, 0, NULL);
+  return(0);
+}
+
+#endif
+
+#endif